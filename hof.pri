@@ -14,7 +14,7 @@ isEmpty(OUTPUT_DIR):OUTPUT_DIR=$$PWD/build
 QT += core
 QT -= gui
 
-CONFIG += qt warn_on c++11
+CONFIG += qt warn_on c++14
 
 DEBUG_MODE = $$(DEBUG_MODE)
 contains(DEBUG_MODE, 1) {
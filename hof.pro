@@ -1,3 +1,3 @@
 TEMPLATE = subdirs
 CONFIG += ordered
-SUBDIRS = src/hof.pro src/tests.pro
+SUBDIRS = src/libhof.pro src/hof.pro src/tests.pro
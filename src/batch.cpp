@@ -0,0 +1,259 @@
+#include "batch.h"
+
+#include "cache.h"
+#include "hof.h"
+#include "lambda.h"
+#include "ski.h"
+#include "threadpool.h"
+
+class BatchRunnable : public QRunnable {
+public:
+    BatchRunnable(Batch* batch, int index)
+        : m_batch(batch)
+        , m_index(index) { }
+
+    void run() { m_batch->runJob(m_index); }
+
+private:
+    Batch* m_batch;
+    int m_index;
+};
+
+Batch::Batch(QTextStream* results, int threads, Order order)
+    : m_stream(results)
+    , m_order(order)
+    , m_pool(new WorkStealingPool(threads))
+    , m_sharedCache(0)
+    , m_timeSlice(0)
+    , m_nextResult(0)
+    , m_failed(0)
+{
+    for (int i = 0; i < m_pool->threadCount(); ++i)
+        m_engines.append(new Hof(0));
+}
+
+Batch::~Batch()
+{
+    delete m_pool;
+    qDeleteAll(m_engines);
+    delete m_sharedCache;
+}
+
+void Batch::setSharedCache(bool shared)
+{
+    if (shared == !!m_sharedCache)
+        return;
+
+    foreach (Hof* hof, m_engines)
+        hof->context()->setCache(0);
+    delete m_sharedCache;
+    m_sharedCache = 0;
+
+    if (!shared)
+        return;
+
+    m_sharedCache = new EvaluationCache(EvaluationCache::Concurrent);
+    foreach (Hof* hof, m_engines)
+        hof->context()->setCache(m_sharedCache);
+}
+
+void Batch::setLimits(const HofLimits& limits)
+{
+    m_limits = limits;
+    foreach (Hof* hof, m_engines)
+        hof->context()->setLimits(limits);
+}
+
+void Batch::addJobs(const QByteArray& jobs)
+{
+    foreach (QByteArray line, jobs.split('\n')) {
+        line = line.trimmed();
+        if (!line.isEmpty())
+            addJob(line);
+    }
+}
+
+void Batch::addJob(const QByteArray& line)
+{
+    Job job;
+    job.id = m_jobs.count();
+
+    if (!line.startsWith("{")) {
+        job.program = QString::fromUtf8(line);
+        m_jobs.append(job);
+        return;
+    }
+
+    QJsonParseError parseError;
+    QJsonDocument document = QJsonDocument::fromJson(line, &parseError);
+    if (parseError.error != QJsonParseError::NoError || !document.isObject()) {
+        job.error = "Error: job is not a valid JSON object: " + parseError.errorString();
+        m_jobs.append(job);
+        return;
+    }
+
+    QJsonObject object = document.object();
+    if (object.contains("id"))
+        job.id = object.value("id");
+
+    QString program = object.value("program").toString();
+    QString translate = object.value("translate").toString();
+    if (object.contains("file")) {
+        QString fileName = object.value("file").toString();
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly)) {
+            job.error = "Error: could not open file for reading: " + fileName;
+            m_jobs.append(job);
+            return;
+        }
+        program = file.readAll();
+        translate = QFileInfo(file).suffix();
+    }
+
+    bool ok = true;
+    if (translate == "ski")
+        program = Ski::fromSki(program, &ok);
+    else if (translate == "lambda")
+        program = Lambda::fromLambda(program, &ok);
+
+    if (!ok) {
+        job.error = program;
+        m_jobs.append(job);
+        return;
+    }
+
+    job.program = program + object.value("input").toString();
+    m_jobs.append(job);
+}
+
+int Batch::run()
+{
+    m_results.clear();
+    for (int i = 0; i < m_jobs.count(); ++i)
+        m_results.append(Result());
+    m_nextResult = 0;
+    m_failed = 0;
+
+    if (m_timeSlice > 0) {
+        runSliced();
+    } else {
+        for (int i = 0; i < m_jobs.count(); ++i)
+            m_pool->start(new BatchRunnable(this, i));
+        m_pool->waitForDone();
+    }
+    m_stream->flush();
+
+    return m_failed;
+}
+
+void Batch::runJob(int index)
+{
+    const Job& job = m_jobs.at(index);
+    Result result;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if (!job.error.isEmpty()) {
+        result.exitCode = -1;
+        result.status = "error";
+        result.output = job.error;
+    } else {
+        Hof* hof = m_engines.at(m_pool->currentWorker());
+        QTextStream stream(&result.output);
+        hof->context()->setOutput(&stream);
+        HofContext::Status status = hof->run(job.program);
+        hof->context()->setOutput(0);
+        stream.flush();
+        setStatus(&result, status);
+    }
+
+    result.nsecs = timer.nsecsElapsed();
+    result.finished = true;
+    publish(index, result);
+}
+
+void Batch::runSliced()
+{
+    m_tasks.clear();
+    m_partial.fill(QString(), m_jobs.count());
+    m_timer.start();
+
+    Scheduler scheduler(this, m_pool->threadCount(), m_timeSlice);
+    scheduler.setCache(m_sharedCache);
+    scheduler.setLimits(m_limits);
+    for (int i = 0; i < m_jobs.count(); ++i) {
+        if (!m_jobs.at(i).error.isEmpty()) {
+            runJob(i);
+            continue;
+        }
+
+        // hold the lock so a fast job cannot finish before we know its index
+        QMutexLocker locker(&m_resultsMutex);
+        scheduler.submit(m_jobs.at(i).program);
+        m_tasks.append(i);
+    }
+    scheduler.waitForDone();
+}
+
+void Batch::output(int id, const QString& output)
+{
+    QMutexLocker locker(&m_resultsMutex);
+    m_partial[m_tasks.at(id)].append(output);
+}
+
+void Batch::finished(int id, HofContext::Status status, qint64 reductions)
+{
+    Q_UNUSED(reductions);
+    Result result;
+    int index;
+    {
+        QMutexLocker locker(&m_resultsMutex);
+        index = m_tasks.at(id);
+        result.output = m_partial.at(index);
+        m_partial[index].clear();
+    }
+
+    setStatus(&result, status);
+    result.nsecs = m_timer.nsecsElapsed();
+    result.finished = true;
+    publish(index, result);
+}
+
+void Batch::setStatus(Result* result, HofContext::Status status) const
+{
+    result->exitCode = HofContext::exitCode(status);
+    result->status = HofContext::statusName(status);
+}
+
+void Batch::publish(int index, const Result& result)
+{
+    QMutexLocker locker(&m_resultsMutex);
+    m_results[index] = result;
+    if (result.exitCode != EXIT_SUCCESS)
+        m_failed++;
+
+    if (m_order == CompletionOrder) {
+        write(index);
+    } else {
+        while (m_nextResult < m_results.count() && m_results.at(m_nextResult).finished)
+            write(m_nextResult++);
+    }
+    m_stream->flush();
+}
+
+void Batch::write(int index)
+{
+    const Result& result = m_results.at(index);
+
+    QJsonObject object;
+    object.insert("id", m_jobs.at(index).id);
+    object.insert("exit", result.exitCode);
+    object.insert("status", result.status);
+    object.insert("msecs", result.nsecs / 1000000.0);
+    object.insert("output", result.output);
+    *m_stream << QString::fromUtf8(QJsonDocument(object).toJson(QJsonDocument::Compact)) << "\n";
+
+    // results are not kept around once they have been written
+    m_results[index].output = QString();
+}
@@ -0,0 +1,101 @@
+#ifndef batch_h
+#define batch_h
+
+#include <QtCore>
+
+#include "context.h"
+#include "scheduler.h"
+
+class EvaluationCache;
+class Hof;
+class WorkStealingPool;
+
+/**
+ * Runs many independent Hof jobs inside one process on a work stealing
+ * thread pool.  Every worker thread owns its own Hof engine which it
+ * reuses from job to job so the evaluation cache stays warm.
+ *
+ * Jobs are read one per line.  A line is either a plain Hof program or a
+ * JSON object with the keys "program" or "file" and optionally "input",
+ * "translate" (ski|lambda) and "id".  For each job a JSON object with the
+ * id, exit code, status, elapsed msecs and the program output is written
+ * to the result stream either in submission order or as jobs complete.
+ *
+ * With a time slice set the jobs are instead interleaved on a Scheduler
+ * so a runaway job cannot hold up the ones behind it; elapsed msecs are
+ * then measured from the start of the batch.
+ */
+class Batch : public SchedulerListener {
+public:
+    enum Order {
+        SubmissionOrder,
+        CompletionOrder
+    };
+
+    Batch(QTextStream* results, int threads, Order order = SubmissionOrder);
+    ~Batch();
+
+    void addJobs(const QByteArray& jobs);
+    void addJob(const QByteArray& line);
+
+    int jobCount() const { return m_jobs.count(); }
+
+    // share one concurrent evaluation cache between all the workers
+    void setSharedCache(bool shared);
+    EvaluationCache* sharedCache() const { return m_sharedCache; }
+
+    // limits applied to every job
+    HofLimits limits() const { return m_limits; }
+    void setLimits(const HofLimits& limits);
+
+    // interleave jobs, switching between them every slice reductions, or not if 0
+    void setTimeSlice(qint64 slice) { m_timeSlice = slice; }
+
+    // returns the number of jobs that did not exit with EXIT_SUCCESS
+    int run();
+
+    void runJob(int index);
+
+    void output(int id, const QString& output);
+    void finished(int id, HofContext::Status status, qint64 reductions);
+
+private:
+    struct Job {
+        QJsonValue id;
+        QString program;
+        QString error;
+    };
+
+    struct Result {
+        Result() : finished(false), exitCode(EXIT_SUCCESS), nsecs(0) { }
+        bool finished;
+        int exitCode;
+        QString status;
+        qint64 nsecs;
+        QString output;
+    };
+
+    Q_DISABLE_COPY(Batch)
+    void runSliced();
+    void setStatus(Result* result, HofContext::Status status) const;
+    void publish(int index, const Result& result);
+    void write(int index);
+
+    QTextStream* m_stream;
+    Order m_order;
+    WorkStealingPool* m_pool;
+    EvaluationCache* m_sharedCache;
+    QList<Hof*> m_engines;
+    QList<Job> m_jobs;
+    QList<Result> m_results;
+    HofLimits m_limits;
+    qint64 m_timeSlice;
+    QElapsedTimer m_timer;
+    QVector<int> m_tasks;
+    QVector<QString> m_partial;
+    QMutex m_resultsMutex;
+    int m_nextResult;
+    int m_failed;
+};
+
+#endif // batch_h
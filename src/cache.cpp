@@ -1,19 +1,157 @@
 #include "cache.h"
 
+EvaluationCache::EvaluationCache(Mode mode, int shards)
+    : m_mode(mode)
+    , m_cachesCaptures(true)
+    , m_hits(0)
+    , m_misses(0)
+    , m_inserts(0)
+    , m_locks(0)
+    , m_contended(0)
+{
+    // shards are picked by masking the key hash so round up to a power of two
+    int count = 1;
+    while (mode == Concurrent && count < shards)
+        count <<= 1;
+
+    for (int i = 0; i < count; ++i)
+        m_shards.append(new Shard);
+}
+
+EvaluationCache::~EvaluationCache()
+{
+    qDeleteAll(m_shards);
+}
+
+EvaluationCache::Shard* EvaluationCache::shard(const QString& key) const
+{
+    if (m_shards.count() == 1)
+        return m_shards.at(0);
+    return m_shards.at(qHash(key) & (m_shards.count() - 1));
+}
+
+void EvaluationCache::lockForRead(Shard* shard) const
+{
+    if (m_mode == Private)
+        return;
+
+    m_locks.fetchAndAddRelaxed(1);
+    if (!shard->lock.tryLockForRead()) {
+        m_contended.fetchAndAddRelaxed(1);
+        shard->lock.lockForRead();
+    }
+}
+
+void EvaluationCache::lockForWrite(Shard* shard) const
+{
+    if (m_mode == Private)
+        return;
+
+    m_locks.fetchAndAddRelaxed(1);
+    if (!shard->lock.tryLockForWrite()) {
+        m_contended.fetchAndAddRelaxed(1);
+        shard->lock.lockForWrite();
+    }
+}
+
+void EvaluationCache::unlock(Shard* shard) const
+{
+    if (m_mode == Private)
+        return;
+
+    shard->lock.unlock();
+}
+
+CombinatorPtr EvaluationCache::value(const QString& key) const
+{
+    Shard* s = shard(key);
+    lockForRead(s);
+    CombinatorPtr v;
+    QHash<QString, Entry>::const_iterator it = s->cache.constFind(key);
+    if (it != s->cache.constEnd()) {
+        v = it.value().value;
+        it.value().hit.store(1);
+    }
+    unlock(s);
+    return v;
+}
+
 void EvaluationCache::insert(const QString& key, const CombinatorPtr& value)
 {
-    if (m_cache.contains(key) || key == value->toString())
+    if (!m_cachesCaptures && value->type() == Combinator::capture_)
+        return;
+
+    if (key == value->toString() || !this->value(key).isNull())
         return;
 
     CombinatorPtr v = value;
-    while (m_cache.contains(v->toString()))
-        v = m_cache.value(v->toString());
+    forever {
+        CombinatorPtr next = this->value(v->toString());
+        if (next.isNull())
+            break;
+        v = next;
+    }
 
-    if (!m_cache.contains(key))
-        m_cache.insert(key, v);
+    Shard* s = shard(key);
+    lockForWrite(s);
+    if (!s->cache.contains(key)) {
+        s->cache.insert(key, Entry(v));
+        m_inserts.fetchAndAddRelaxed(1);
+    }
+    unlock(s);
 }
 
 CombinatorPtr EvaluationCache::result(const QString& key) const
 {
-    return m_cache.value(key, CombinatorPtr());
+    CombinatorPtr v = value(key);
+    if (v.isNull())
+        m_misses.fetchAndAddRelaxed(1);
+    else
+        m_hits.fetchAndAddRelaxed(1);
+    return v;
+}
+
+void EvaluationCache::clear()
+{
+    foreach (Shard* s, m_shards) {
+        lockForWrite(s);
+        s->cache.clear();
+        unlock(s);
+    }
+}
+
+int EvaluationCache::sweep()
+{
+    int swept = 0;
+    foreach (Shard* s, m_shards) {
+        lockForWrite(s);
+        QHash<QString, Entry>::iterator it = s->cache.begin();
+        while (it != s->cache.end()) {
+            if (!it.value().hit.load()) {
+                it = s->cache.erase(it);
+                ++swept;
+            } else {
+                it.value().hit.store(0);
+                ++it;
+            }
+        }
+        unlock(s);
+    }
+    return swept;
+}
+
+EvaluationCache::Stats EvaluationCache::stats() const
+{
+    Stats stats;
+    stats.hits = m_hits.load();
+    stats.misses = m_misses.load();
+    stats.inserts = m_inserts.load();
+    stats.locks = m_locks.load();
+    stats.contended = m_contended.load();
+    foreach (Shard* s, m_shards) {
+        lockForRead(s);
+        stats.size += s->cache.count();
+        unlock(s);
+    }
+    return stats;
 }
@@ -5,24 +5,88 @@
 
 #include <QtCore>
 
+/**
+ * Memoizes the result of applying one term to another keyed by the string
+ * form of the application.
+ *
+ * A Private cache belongs to a single context and takes no locks.  A
+ * Concurrent cache can be shared by contexts on many threads; it is split
+ * into lock striped shards so threads only contend when they touch keys
+ * that hash to the same shard.
+ *
+ * Only results computed without an effect are inserted, see
+ * HofContext::effects, so an entry holds the same value for every context
+ * that shares the cache and serving it never skips output.
+ *
+ * Entries are weak: sweep() drops every entry that was not hit since the
+ * sweep before, so results nobody asks for again stop being pinned.
+ */
 class EvaluationCache {
 public:
-    static EvaluationCache* instance()
-    {
-        static EvaluationCache* s_instance = 0;
-        if (!s_instance)
-            s_instance = new EvaluationCache;
-        return s_instance;
-    }
+    enum Mode {
+        Private,
+        Concurrent
+    };
+
+    struct Stats {
+        Stats() : hits(0), misses(0), inserts(0), locks(0), contended(0), size(0) { }
+        qreal hitRate() const { return hits + misses ? qreal(hits) / (hits + misses) : 0; }
+        qint64 hits;
+        qint64 misses;
+        qint64 inserts;
+        qint64 locks;
+        qint64 contended;
+        int size;
+    };
+
+    EvaluationCache(Mode mode = Private, int shards = 64);
+    ~EvaluationCache();
+
+    Mode mode() const { return m_mode; }
+
+    // on by default, off when results that are captures such as S x are
+    // left out and built again each time
+    bool cachesCaptures() const { return m_cachesCaptures; }
+    void setCachesCaptures(bool cachesCaptures) { m_cachesCaptures = cachesCaptures; }
 
     void insert(const QString& key, const CombinatorPtr& value);
     CombinatorPtr result(const QString& key) const;
 
+    // forget every entry, the statistics are kept
+    void clear();
+
+    // forget the entries not hit since the last sweep, returns how many
+    int sweep();
+
+    Stats stats() const;
+
 private:
-    EvaluationCache()
-    { }
+    struct Entry {
+        Entry(const CombinatorPtr& v = CombinatorPtr()) : value(v), hit(0) { }
+        CombinatorPtr value;
+        mutable QAtomicInt hit;     // set under the read lock
+    };
+
+    struct Shard {
+        QReadWriteLock lock;
+        QHash<QString, Entry> cache;
+    };
+
+    Q_DISABLE_COPY(EvaluationCache)
+    Shard* shard(const QString& key) const;
+    CombinatorPtr value(const QString& key) const;
+    void lockForRead(Shard* shard) const;
+    void lockForWrite(Shard* shard) const;
+    void unlock(Shard* shard) const;
 
-    QHash<QString, CombinatorPtr> m_cache;
+    Mode m_mode;
+    bool m_cachesCaptures;
+    QVector<Shard*> m_shards;
+    mutable QAtomicInteger<qint64> m_hits;
+    mutable QAtomicInteger<qint64> m_misses;
+    mutable QAtomicInteger<qint64> m_inserts;
+    mutable QAtomicInteger<qint64> m_locks;
+    mutable QAtomicInteger<qint64> m_contended;
 };
 
 #endif // cache_h
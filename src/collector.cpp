@@ -0,0 +1,49 @@
+#include "collector.h"
+
+#include "cache.h"
+#include "combinators.h"
+
+Collector::Collector()
+    : m_budget(0)
+    , m_threshold(0)
+{
+}
+
+void Collector::setBudget(qint64 budget)
+{
+    m_budget = qMax(qint64(0), budget);
+    m_threshold = m_budget;
+
+    // nodes are only counted once some collector needs them to be, and from
+    // then on for good, since a node counts itself out only if it counted in
+    if (m_budget)
+        Combinator::setCounting(true);
+}
+
+bool Collector::check(EvaluationCache* cache)
+{
+    if (!isEnabled())
+        return false;
+
+    qint64 live = Combinator::liveCount();
+    m_stats.peak = qMax(m_stats.peak, live);
+    if (live + cache->stats().size < m_threshold)
+        return false;
+
+    collect(cache);
+    return true;
+}
+
+void Collector::collect(EvaluationCache* cache)
+{
+    QElapsedTimer timer;
+    timer.start();
+    m_stats.swept += cache->sweep();
+    qint64 pause = timer.nsecsElapsed();
+
+    ++m_stats.collections;
+    m_stats.pauseNsecs += pause;
+    m_stats.maxPauseNsecs = qMax(m_stats.maxPauseNsecs, pause);
+    m_stats.live = Combinator::liveCount();
+    m_threshold = qMax(m_budget, 2 * (m_stats.live + cache->stats().size));
+}
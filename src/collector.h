@@ -0,0 +1,56 @@
+#ifndef collector_h
+#define collector_h
+
+#include <QtCore>
+
+class EvaluationCache;
+
+/**
+ * Keeps the memory a long running program holds on to bounded.  This is a
+ * sweep of the evaluation cache, not a tracing collector, and need not be
+ * one: terms are reference counted and never form cycles, since a node is
+ * only ever changed before anything else can point at it or, for a thunk,
+ * to remember the value computed from what it points at, so whatever the
+ * program drops is freed right away.  A mark phase would find nothing
+ * unreachable; what piles up is reachable through the cache, and only a
+ * policy can say which of it is garbage.
+ *
+ * Once the live nodes and cache entries together exceed the budget the
+ * context's checkpoint sweeps the cache, which frees every result that was
+ * not asked for again since the last collection.  The budget then grows to
+ * twice what survived, so a program that really needs that much is not
+ * collected over and over.
+ */
+class Collector {
+public:
+    struct Stats {
+        Stats() : collections(0), swept(0), pauseNsecs(0), maxPauseNsecs(0), live(0), peak(0) { }
+        int collections;
+        qint64 swept;           // cache entries freed
+        qint64 pauseNsecs;
+        qint64 maxPauseNsecs;
+        qint64 live;            // nodes after the last collection
+        qint64 peak;            // most nodes seen at a checkpoint
+    };
+
+    Collector();
+
+    // nodes plus cache entries, zero turns collection off
+    qint64 budget() const { return m_budget; }
+    void setBudget(qint64 budget);
+    bool isEnabled() const { return m_budget > 0; }
+
+    // collects if the budget is exceeded, returns whether it did
+    bool check(EvaluationCache* cache);
+    void collect(EvaluationCache* cache);
+
+    Stats stats() const { return m_stats; }
+
+private:
+    Q_DISABLE_COPY(Collector)
+    qint64 m_budget;
+    qint64 m_threshold;
+    Stats m_stats;
+};
+
+#endif // collector_h
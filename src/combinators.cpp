@@ -1,63 +1,112 @@
 #include "combinators.h"
 
+#include <limits>
+
 #include "cache.h"
 #include "colors.h"
+#include "context.h"
+#include "random.h"
+#include "speculate.h"
 #include "verbose.h"
 
-#include <random>
+// whether left applied to right always gives the same value, P and R at the
+// head have effects and native functions need not be pure
+static bool isPure(const CombinatorPtr& left)
+{
+    switch (left->type()) {
+    case Combinator::p_:
+    case Combinator::r_:
+    case Combinator::foreign_:
+        return false;
+    case Combinator::capture_:
+        return static_cast<const Capture*>(left.data())->callback->type() != Combinator::r_;
+    case Combinator::a_:
+        return !static_cast<A*>(left.data())->doNotCache();
+    case Combinator::fix_:
+      {
+          const Fix* fix = static_cast<const Fix*>(left.data());
+          return !fix->function || isPure(fix->function);
+      }
+    default:
+        return true;
+    }
+}
 
-CombinatorPtr eval(const CombinatorPtr& left, const CombinatorPtr& right)
+CombinatorPtr eval(HofContext* context, const CombinatorPtr& left, const CombinatorPtr& right)
 {
-    static int evaluationDepth = 0;
+    if (context->isStopped())
+        return i();
 
-    if (evaluationDepth >= 1000) {
-        qDebug() << "Hof program has exceed maximum stack depth!";
-        exit(2);
+    if (context->evaluationDepth >= context->limits().maxDepth) {
+        context->stop(HofContext::DepthExceeded);
+        return i();
     }
 
-    evaluationDepth++;
+    context->evaluationDepth++;
+    if (++context->reductions >= context->nextCheckpoint) {
+        context->checkpoint();
+        if (context->isStopped()) {
+            context->evaluationDepth--;
+            return i();
+        }
+    }
 
-    CombinatorPtr cached = EvaluationCache::instance()->result(left->toStringApply(right));
-    Verbose::instance()->generateEvalString(left, right, evaluationDepth, !cached.isNull());
+    // strict primitives are cheaper to run again than to print as a key, and
+    // native functions need not be pure
+    qint64 effects = context->effects;
+    bool isCached = left->type() != Combinator::primitive_ && left->type() != Combinator::foreign_;
+    CombinatorPtr cached = isCached ? context->cache()->result(left->toStringApply(right)) : CombinatorPtr();
+    context->verbose()->generateEvalString(left, right, context->evaluationDepth, !cached.isNull());
     if (!cached.isNull()) {
-        evaluationDepth--;
+        context->evaluationDepth--;
         return cached;
     }
 
     CombinatorPtr r;
     switch (left->type()) {
     case Combinator::i_:
-        r = static_cast<const I*>(left.data())->apply(right); break;
+        r = static_cast<const I*>(left.data())->apply(context, right); break;
     case Combinator::k_:
-        r = static_cast<const K*>(left.data())->apply(right); break;
+        r = static_cast<const K*>(left.data())->apply(context, right); break;
     case Combinator::s_:
-        r = static_cast<const S*>(left.data())->apply(right); break;
+        r = static_cast<const S*>(left.data())->apply(context, right); break;
     case Combinator::p_:
-        r = static_cast<const P*>(left.data())->apply(right); break;
+        r = static_cast<const P*>(left.data())->apply(context, right); break;
     case Combinator::r_:
-        r = static_cast<const R*>(left.data())->apply(right); break;
+        r = static_cast<const R*>(left.data())->apply(context, right); break;
     case Combinator::a_:
-        r = static_cast<const A*>(left.data())->apply(right); break;
+        r = static_cast<const A*>(left.data())->apply(context, right); break;
     case Combinator::var_:
-        r = static_cast<const Var*>(left.data())->apply(right); break;
+        r = static_cast<const Var*>(left.data())->apply(context, right); break;
+    case Combinator::numeral_:
+        r = static_cast<const Numeral*>(left.data())->apply(context, right); break;
+    case Combinator::arithmetic_:
+        r = static_cast<const Arithmetic*>(left.data())->apply(context, right); break;
+    case Combinator::bytes_:
+        r = static_cast<const ByteString*>(left.data())->apply(context, right); break;
+    case Combinator::primitive_:
+        r = static_cast<const Primitive*>(left.data())->apply(context, right); break;
+    case Combinator::foreign_:
+        r = static_cast<const Foreign*>(left.data())->apply(context, right); break;
+    case Combinator::fix_:
+        r = static_cast<const Fix*>(left.data())->apply(context, right, left); break;
     case Combinator::capture_:
       {
-          Capture* cap = static_cast<Capture*>(left.data());
+          const Capture* cap = static_cast<const Capture*>(left.data());
           if (!cap->isFull()) {
-              cap->append(right);
-              r = left;
+              r = cap->extend(right);
           } else {
               switch (cap->callback->type()) {
               case Combinator::k_:
-                  r = static_cast<const K*>(cap->callback.data())->apply(right, left); break;
+                  r = static_cast<const K*>(cap->callback.data())->apply(context, right, left); break;
               case Combinator::r_:
-                  r = static_cast<const R*>(cap->callback.data())->apply(right, left); break;
+                  r = static_cast<const R*>(cap->callback.data())->apply(context, right, left); break;
               case Combinator::s_:
-                  r = static_cast<const S*>(cap->callback.data())->apply(right, left); break;
+                  r = static_cast<const S*>(cap->callback.data())->apply(context, right, left); break;
               case Combinator::b_:
-                  r = static_cast<const B*>(cap->callback.data())->apply(right, left); break;
+                  r = static_cast<const B*>(cap->callback.data())->apply(context, right, left); break;
               case Combinator::c_:
-                  r = static_cast<const C*>(cap->callback.data())->apply(right, left); break;
+                  r = static_cast<const C*>(cap->callback.data())->apply(context, right, left); break;
               default:
                   {
                       Q_ASSERT(false);
@@ -76,18 +125,39 @@ CombinatorPtr eval(const CombinatorPtr& left, const CombinatorPtr& right)
         }
     }
 
-    evaluationDepth--;
+    context->evaluationDepth--;
 
-    if (r->type() != Combinator::capture_ &&
-        left->type() != Combinator::p_ &&
-        left->type() != Combinator::r_ &&
-        (left->type() != Combinator::a_ || !static_cast<A*>(left.data())->doNotCache())) {
-        EvaluationCache::instance()->insert(left->toStringApply(right), r);
-    }
+    if (context->isStopped())
+        return r;
+
+    // the head alone does not show a P or R reached further in, such as the
+    // P that AAKPba applies to a, so the result is only cached if none ran
+    if (isCached && isPure(left) && context->effects == effects)
+        context->cache()->insert(left->toStringApply(right), r);
 
     return r;
 }
 
+QAtomicInt Combinator::s_counting;
+static QAtomicInteger<qint64> s_liveCount;
+
+// published in batches so threads allocating side by side do not contend
+static thread_local int t_uncounted = 0;
+
+void Combinator::publish(int nodes)
+{
+    t_uncounted += nodes;
+    if (t_uncounted >= 256 || t_uncounted <= -256) {
+        s_liveCount.fetchAndAddRelaxed(t_uncounted);
+        t_uncounted = 0;
+    }
+}
+
+qint64 Combinator::liveCount()
+{
+    return s_liveCount.load() + t_uncounted;
+}
+
 QString Combinator::typeToString() const
 {
     switch (m_type) {
@@ -103,52 +173,163 @@ QString Combinator::typeToString() const
               return QStringLiteral("Var");
     case capture_:
               return QStringLiteral("Capture");
+    case numeral_:
+              return QStringLiteral("Numeral");
+    case arithmetic_:
+              return QStringLiteral("Arithmetic");
+    case bytes_:
+              return QStringLiteral("ByteString");
+    case primitive_:
+              return QStringLiteral("Primitive");
+    case foreign_:
+              return QStringLiteral("Foreign");
+    case fix_:
+              return QStringLiteral("Fix");
     default:
         Q_ASSERT(false);
         return QString();
     }
 }
 
-QString Combinator::toString() const
+// writes a term's printed form to a QString
+struct StringSink {
+    StringSink(QString* s) : string(s) { }
+    void write(QChar ch) { string->append(ch); }
+    void write(const QString& text) { string->append(text); }
+    QString* string;
+};
+
+// writes a term's printed form to a stream, counting the characters
+struct StreamSink {
+    StreamSink(QTextStream* s) : stream(s), count(0) { }
+    void write(QChar ch) { *stream << ch; ++count; }
+    void write(const QString& text) { *stream << text; count += text.length(); }
+    QTextStream* stream;
+    int count;
+};
+
+// walks the term with a stack of its own so deep terms can not overflow the
+// native one, and whatever a term prints ahead of its subterms is written as
+// it comes off the stack, so every character is written once
+template <typename Sink>
+static void printTerm(const Combinator* term, Sink* sink)
 {
-    switch(m_type) {
-    case i_:
-    case k_:
-    case s_:
-    case p_:
-    case r_:
-    case b_:
-    case c_:
-        return typeToString();
-    case var_:
-      {
-          const Var* v = static_cast<const Var*>(this);
-          return v->ch;
-      }
-    case a_:
-      {
-          const A* a = static_cast<const A*>(this);
-          return QString("%1%2%3").arg(!a->isThunk ? "A" : QString())
-                                  .arg(a->left ? a->left->toString() : QString())
-                                  .arg(a->right ? a->right->toString() : QString());
-      }
-    case capture_:
-      {
-          const Capture* cap = static_cast<const Capture*>(this);
-          QString str = cap->callback->toString();
-          foreach (CombinatorPtr ptr, cap->args)
-              str.append(ptr->toString());
-          return str;
-      }
-    default:
-        Q_ASSERT(false);
-        return QString();
+    QVector<const Combinator*> stack;
+    stack.append(term);
+    while (!stack.isEmpty()) {
+        const Combinator* c = stack.takeLast();
+        switch (c->type()) {
+        case Combinator::i_:
+        case Combinator::k_:
+        case Combinator::s_:
+        case Combinator::p_:
+        case Combinator::r_:
+        case Combinator::b_:
+        case Combinator::c_:
+            sink->write(c->typeToString());
+            break;
+        case Combinator::var_:
+            sink->write(static_cast<const Var*>(c)->ch);
+            break;
+        case Combinator::a_:
+          {
+              // subterms are pushed last first so they come off in order
+              const A* a = static_cast<const A*>(c);
+              if (!a->isThunk)
+                  sink->write(QChar('A'));
+              if (a->right)
+                  stack.append(a->right.data());
+              if (a->left)
+                  stack.append(a->left.data());
+              break;
+          }
+        case Combinator::capture_:
+          {
+              const Capture* cap = static_cast<const Capture*>(c);
+              for (int i = cap->args.count() - 1; i >= 0; --i)
+                  stack.append(cap->args.at(i).data());
+              stack.append(cap->callback.data());
+              break;
+          }
+        case Combinator::numeral_:
+          {
+              const Numeral* n = static_cast<const Numeral*>(c);
+              sink->write(QString("#%1;").arg(n->value));
+              if (n->function)
+                  stack.append(n->function.data());
+              break;
+          }
+        case Combinator::arithmetic_:
+            stack.append(static_cast<const Arithmetic*>(c)->definition.data());
+            break;
+        case Combinator::bytes_:
+          {
+              // escaped so it reads back as the same literal
+              QByteArray bytes = static_cast<const ByteString*>(c)->bytes;
+              bytes.replace('\\', "\\\\").replace('"', "\\\"");
+              sink->write(QChar('"'));
+              sink->write(QString::fromUtf8(bytes));
+              sink->write(QChar('"'));
+              break;
+          }
+        case Combinator::primitive_:
+          {
+              const Primitive* p = static_cast<const Primitive*>(c);
+              sink->write(QString("#%1;").arg(QLatin1Char(Primitive::symbol(p->operation))));
+              if (p->right)
+                  stack.append(p->right.data());
+              if (p->left)
+                  stack.append(p->left.data());
+              break;
+          }
+        case Combinator::foreign_:
+          {
+              const Foreign* f = static_cast<const Foreign*>(c);
+              sink->write(f->function->name);
+              for (int i = f->arguments.count() - 1; i >= 0; --i)
+                  stack.append(f->arguments.at(i).data());
+              break;
+          }
+        case Combinator::fix_:
+          {
+              const Fix* fix = static_cast<const Fix*>(c);
+              if (fix->function) {
+                  sink->write(QChar('A'));
+                  stack.append(fix->function.data());
+              }
+              stack.append(fix->definition.data());
+              break;
+          }
+        default:
+            Q_ASSERT(false);
+            break;
+        }
     }
 }
 
+QString Combinator::toString() const
+{
+    QString string;
+    print(&string);
+    return string;
+}
+
+void Combinator::print(QString* string) const
+{
+    StringSink sink(string);
+    printTerm(this, &sink);
+}
+
+int Combinator::print(QTextStream* stream) const
+{
+    StreamSink sink(stream);
+    printTerm(this, &sink);
+    return sink.count;
+}
+
 QString Combinator::toStringApply(const CombinatorPtr& arg, OutputFormat f) const
 {
-    QString argString = arg.isNull() ? RESET(f) : RED(f) + arg->toString() + RESET(f);
+    QString string;
     switch(m_type) {
     case i_:
     case k_:
@@ -159,38 +340,55 @@ QString Combinator::toStringApply(const CombinatorPtr& arg, OutputFormat f) cons
     case b_:
     case c_:
     case var_:
-        return GREEN(f) + toString() + argString;
+    case numeral_:
+    case arithmetic_:
+    case bytes_:
+    case primitive_:
+    case foreign_:
+    case fix_:
+        string = GREEN(f);
+        print(&string);
+        break;
     case capture_:
       {
           const Capture* cap = static_cast<const Capture*>(this);
           int l = cap->argsToCapture;
           Q_ASSERT(l <= 3);
-          QString s = toString();
+          string = CYAN(f);
+          int callback = string.length() + 1;
+          print(&string);
           if (l == 1)
-              s.insert(1, "₁");
+              string.insert(callback, "₁");
           else if (l == 2)
-              s.insert(1, "₂");
+              string.insert(callback, "₂");
           else
-              s.insert(1, "₃");
-          return CYAN(f) + s + argString;
+              string.insert(callback, "₃");
+          break;
       }
     default:
         Q_ASSERT(false);
         return QString();
     }
+
+    if (!arg.isNull()) {
+        string += RED(f);
+        arg->print(&string);
+    }
+    string += RESET(f);
+    return string;
 }
 
-CombinatorPtr I::apply(const CombinatorPtr& x) const
+CombinatorPtr I::apply(HofContext* context, const CombinatorPtr& x) const
 {
+    Q_UNUSED(context);
     return x;
 }
 
-CombinatorPtr K::apply(const CombinatorPtr& arg, CombinatorPtr capture) const
+CombinatorPtr K::apply(HofContext* context, const CombinatorPtr& arg, CombinatorPtr capture) const
 {
+    Q_UNUSED(context);
     if (capture.isNull()) {
-        CombinatorPtr newC(new Capture(k(), 1));
-        newC.staticCast<Capture>()->args.append(arg);
-        return newC;
+        return CombinatorPtr(new Capture(k(), arg));
     }
 
     Capture* cap = static_cast<Capture*>(capture.data());
@@ -198,7 +396,7 @@ CombinatorPtr K::apply(const CombinatorPtr& arg, CombinatorPtr capture) const
     return cap->x();
 }
 
-CombinatorPtr B::apply(const CombinatorPtr& arg, CombinatorPtr capture) const
+CombinatorPtr B::apply(HofContext* context, const CombinatorPtr& arg, CombinatorPtr capture) const
 {
     Q_ASSERT(!capture.isNull());
     Capture* cap = static_cast<Capture*>(capture.data());
@@ -207,12 +405,14 @@ CombinatorPtr B::apply(const CombinatorPtr& arg, CombinatorPtr capture) const
     CombinatorPtr y = cap->y();
     CombinatorPtr z = arg;
 
-    CombinatorPtr first = EvaluationCache::instance()->result(y->toStringApply(z));
+    CombinatorPtr first = context->cache()->result(y->toStringApply(z));
     if (first.isNull()) {
         A* yz = new A;
         yz->left = y;
         yz->right = z;
         yz->isThunk = true;
+        if (Speculator* speculator = context->speculator())
+            yz->spark = speculator->spark(context, y, z);
         first = CombinatorPtr(yz);
     }
 
@@ -224,7 +424,7 @@ CombinatorPtr B::apply(const CombinatorPtr& arg, CombinatorPtr capture) const
     return CombinatorPtr(evaluate);
 }
 
-CombinatorPtr C::apply(const CombinatorPtr& arg, CombinatorPtr capture) const
+CombinatorPtr C::apply(HofContext* context, const CombinatorPtr& arg, CombinatorPtr capture) const
 {
     Q_ASSERT(!capture.isNull());
     Capture* cap = static_cast<Capture*>(capture.data());
@@ -233,14 +433,14 @@ CombinatorPtr C::apply(const CombinatorPtr& arg, CombinatorPtr capture) const
     CombinatorPtr y = cap->y();
     CombinatorPtr z = arg;
 
-    CombinatorPtr first = EvaluationCache::instance()->result(x->toStringApply(z));
+    CombinatorPtr first = context->cache()->result(x->toStringApply(z));
     if (first.isNull()) {
-        if (Verbose::instance()->isVerbose()) {
-            SubEval subEval;
+        if (context->verbose()->isVerbose()) {
+            SubEval subEval(context->verbose());
             subEval.addPostfix(y->toString() + z->toString());
-            first = eval(x, z);
+            first = eval(context, x, z);
         } else
-            first = eval(x, z);
+            first = eval(context, x, z);
     }
 
     A* evaluate = new A;
@@ -251,12 +451,10 @@ CombinatorPtr C::apply(const CombinatorPtr& arg, CombinatorPtr capture) const
     return CombinatorPtr(evaluate);
 }
 
-CombinatorPtr S::apply(const CombinatorPtr& arg, CombinatorPtr capture) const
+CombinatorPtr S::apply(HofContext* context, const CombinatorPtr& arg, CombinatorPtr capture) const
 {
     if (capture.isNull()) {
-        CombinatorPtr newC(new Capture(s(), 1));
-        newC.staticCast<Capture>()->args.append(arg);
-        return newC;
+        return CombinatorPtr(new Capture(s(), arg));
     }
 
     Capture* cap = static_cast<Capture*>(capture.data());
@@ -271,14 +469,13 @@ CombinatorPtr S::apply(const CombinatorPtr& arg, CombinatorPtr capture) const
 
         /* identity optimization: SKx -> I */
         if (x->type() == Combinator::k_) {
-            Verbose::instance()->generateReplacementString(capture, i());
+            context->verbose()->generateReplacementString(capture, i());
             return i();
         }
 
-        cap->argsToCapture = 2; // capture one more...
-        cap->append(arg);
-
-        CombinatorPtr y = cap->y();
+        // capture one more...
+        CombinatorPtr extended = cap->extend(arg);
+        CombinatorPtr y = arg;
 
         if (x->type() == Combinator::a_) {
             A* aX = static_cast<A*>(x.data());
@@ -293,10 +490,9 @@ CombinatorPtr S::apply(const CombinatorPtr& arg, CombinatorPtr capture) const
                         pq->left = aX->right;
                         pq->right = aY->right;
 
-                        CombinatorPtr newC(new Capture(k(), 1));
-                        newC.staticCast<Capture>()->args.append(CombinatorPtr(pq));
+                        CombinatorPtr newC(new Capture(k(), CombinatorPtr(pq)));
 
-                        Verbose::instance()->generateReplacementString(capture, newC);
+                        context->verbose()->generateReplacementString(extended, newC);
                         return newC;
                     }
                 }
@@ -304,16 +500,14 @@ CombinatorPtr S::apply(const CombinatorPtr& arg, CombinatorPtr capture) const
                 /* b optimization: SAKxy -> Bxy*/
                 /* special b optimization */
                 if (y->type() == Combinator::i_) {
-                    Verbose::instance()->generateReplacementString(capture, aX->right);
+                    context->verbose()->generateReplacementString(extended, aX->right);
                     return aX->right;
                 }
 
 #if OPTIMIZATIONS
-                CombinatorPtr newC(new Capture(b(), 2));
-                newC.staticCast<Capture>()->args.append(aX->right);
-                newC.staticCast<Capture>()->args.append(y);
+                CombinatorPtr newC(new Capture(b(), aX->right, y));
 
-                Verbose::instance()->generateReplacementString(capture, newC);
+                context->verbose()->generateReplacementString(extended, newC);
                 return newC;
 #endif
             }
@@ -324,38 +518,38 @@ CombinatorPtr S::apply(const CombinatorPtr& arg, CombinatorPtr capture) const
         if (y->type() == Combinator::a_) {
             A* aY = static_cast<A*>(y.data());
             if (aY->left->type() == Combinator::k_) {
-                CombinatorPtr newC(new Capture(c(), 2));
-                newC.staticCast<Capture>()->args.append(x);
-                newC.staticCast<Capture>()->args.append(aY->right);
+                CombinatorPtr newC(new Capture(c(), x, aY->right));
 
-                Verbose::instance()->generateReplacementString(capture, newC);
+                context->verbose()->generateReplacementString(extended, newC);
                 return newC;
             }
         }
 #endif
 
-        return capture;
+        return extended;
     }
 
     Q_ASSERT(cap->args.length() == 2);
     CombinatorPtr y = cap->y();
     CombinatorPtr z = arg;
-    CombinatorPtr first = EvaluationCache::instance()->result(x->toStringApply(z));
+    CombinatorPtr first = context->cache()->result(x->toStringApply(z));
     if (first.isNull()) {
-        if (Verbose::instance()->isVerbose()) {
-            SubEval subEval;
+        if (context->verbose()->isVerbose()) {
+            SubEval subEval(context->verbose());
             subEval.addPostfix(y->toString() + z->toString());
-            first = eval(x, z);
+            first = eval(context, x, z);
         } else
-            first = eval(x, z);
+            first = eval(context, x, z);
     }
 
-    CombinatorPtr second = EvaluationCache::instance()->result(y->toStringApply(z));
+    CombinatorPtr second = context->cache()->result(y->toStringApply(z));
     if (second.isNull()) {
         A* yz = new A;
         yz->left = y;
         yz->right = z;
         yz->isThunk = true;
+        if (Speculator* speculator = context->speculator())
+            yz->spark = speculator->spark(context, y, z);
         second = CombinatorPtr(yz);
     }
 
@@ -367,68 +561,70 @@ CombinatorPtr S::apply(const CombinatorPtr& arg, CombinatorPtr capture) const
     return CombinatorPtr(evaluate);
 }
 
-CombinatorPtr P::apply(const CombinatorPtr& x) const
+CombinatorPtr P::apply(HofContext* context, const CombinatorPtr& x) const
 {
+    ++context->effects;
     CombinatorPtr toPrint = x;
-    while (toPrint->type() == Combinator::a_ && static_cast<A*>(toPrint.data())->isThunk) {
-        SubEval subEval;
+    forever {
+        bool isThunk = toPrint->type() == Combinator::a_ && static_cast<A*>(toPrint.data())->isThunk;
+        if (!isThunk && !Fix::isKnot(toPrint))
+            break;
+        SubEval subEval(context->verbose());
         subEval.addPrefix("P");
-        A* a = static_cast<A*>(toPrint.data());
-        toPrint = a->apply();
+        if (isThunk)
+            toPrint = static_cast<A*>(toPrint.data())->apply(context);
+        else
+            toPrint = static_cast<Fix*>(toPrint.data())->unroll(context, toPrint);
     }
 
-    if (m_stream) {
-        *m_stream << toPrint->toString();
-        Verbose::instance()->generateOutputString();
-        m_stream->flush();
-        Verbose::instance()->generateOutputStringEnd();
+    if (context->isStopped())
+        return toPrint;
+
+    QTextStream* stream = context->output();
+    if (stream) {
+        if (toPrint->type() == Combinator::bytes_) {
+            // a byte string is printed in bulk as its bytes, which need not be
+            // UTF-8, so they go to the device as they are unless there is none
+            QByteArray bytes = static_cast<const ByteString*>(toPrint.data())->bytes;
+            bytes.truncate(context->reserveOutput(bytes.size()));
+            if (QIODevice* device = stream->device()) {
+                stream->flush();
+                device->write(bytes);
+            } else {
+                *stream << QString::fromUtf8(bytes);
+            }
+        } else if (context->limits().maxOutput) {
+            QString string = toPrint->toString();
+            string.truncate(context->reserveOutput(string.length()));
+            *stream << string;
+        } else {
+            // nothing to cut short, so the term is written straight out
+            context->reserveOutput(toPrint->print(stream));
+        }
+        context->verbose()->generateOutputString();
+        stream->flush();
+        context->verbose()->generateOutputStringEnd();
     }
     return toPrint;
 }
 
-void P::setStream(QTextStream* stream)
-{
-    m_stream = stream;
-}
-
-class Random {
-public:
-    static Random* instance()
-    {
-        static Random* s_instance = 0;
-        if (!s_instance)
-            s_instance = new Random;
-        return s_instance;
-    }
-
-    bool boolean() const
-    {
-        return (*m_dist)(*m_gen);
-    }
-
-private:
-    Random()
-    {
-        std::random_device rd;
-        m_gen = new std::mt19937(rd());
-        m_dist = new std::bernoulli_distribution;
-    }
-
-    std::mt19937* m_gen;
-    std::bernoulli_distribution* m_dist;
-};
-
-CombinatorPtr R::apply(const CombinatorPtr& arg, CombinatorPtr capture) const
+CombinatorPtr R::apply(HofContext* context, const CombinatorPtr& arg, CombinatorPtr capture) const
 {
     if (capture.isNull()) {
-        CombinatorPtr newC(new Capture(r(), 1));
-        newC.staticCast<Capture>()->args.append(arg);
-        return newC;
+        return CombinatorPtr(new Capture(r(), arg));
     }
 
     Capture* cap = static_cast<Capture*>(capture.data());
     Q_ASSERT(cap->args.length() == 1);
-    return Random::instance()->boolean() ? cap->x() : arg /*y*/;
+    ++context->effects;
+    return context->random()->boolean() ? cap->x() : arg /*y*/;
+}
+
+A::~A()
+{
+    // nobody can force this thunk anymore so any speculation is wasted
+    if (spark)
+        spark->cancel();
 }
 
 bool A::isFull() const
@@ -438,6 +634,8 @@ bool A::isFull() const
 
 bool A::isWellFormed() const
 {
+    if (isComplete)
+        return true;
     if (!isFull())
         return false;
 
@@ -451,140 +649,508 @@ bool A::doNotCache() const
     Q_ASSERT(!left.isNull());
     if (left->type() == Combinator::a_)
         return static_cast<A*>(left.data())->doNotCache();
-    return left->type() == Combinator::r_ || left->type() == Combinator::p_;
+    return left->type() == Combinator::r_ || left->type() == Combinator::p_ || left->type() == Combinator::foreign_;
 }
 
 void A::addCombinator(const CombinatorPtr& term)
 {
     Q_ASSERT(!isWellFormed());
 
-    if (!left.isNull() && left->type() == Combinator::a_) {
-        A* leftA = static_cast<A*>(left.data());
-        if (!leftA->isWellFormed()) {
-            leftA->addCombinator(term);
-            return;
-        }
-    }
-
-    if (!right.isNull() && right->type() == Combinator::a_) {
-        A* rightA = static_cast<A*>(right.data());
-        if (!rightA->isWellFormed()) {
-            rightA->addCombinator(term);
-            return;
-        }
-    }
-
-    if (left.isNull())
+    A* leftA = !left.isNull() && left->type() == Combinator::a_ ? static_cast<A*>(left.data()) : 0;
+    A* rightA = !right.isNull() && right->type() == Combinator::a_ ? static_cast<A*>(right.data()) : 0;
+    if (leftA && !leftA->isWellFormed())
+        leftA->addCombinator(term);
+    else if (rightA && !rightA->isWellFormed())
+        rightA->addCombinator(term);
+    else if (left.isNull())
         left = term;
     else
         right = term;
+
+    isComplete = isWellFormed();
 }
 
-CombinatorPtr A::apply() const
+CombinatorPtr A::apply(HofContext* context) const
 {
     Q_ASSERT(isWellFormed());
-    if (isThunk)
-        return eval(left, right);
+    if (spark)
+        return spark->force(context);
+
+    if (isThunk) {
+        if (forced)
+            return forced;
+        qint64 effects = context->effects;
+        CombinatorPtr value = eval(context, left, right);
+        while (value->type() == Combinator::a_ && static_cast<A*>(value.data())->forced)
+            value = static_cast<A*>(value.data())->forced;
+
+        // a pure thunk remembers its value so it is never reduced twice, but
+        // only where no other thread can be looking at it; it still prints
+        // as it was written, so output does not depend on what was forced
+        if (!context->isStopped() && !context->speculator() &&
+            context->cache()->mode() == EvaluationCache::Private && isPure(left) &&
+            context->effects == effects)
+            const_cast<A*>(this)->forced = value;
+        return value;
+    }
 
-    if (Verbose::instance()->isVerbose()) {
-        SubEval subEval;
+    if (context->verbose()->isVerbose()) {
+        SubEval subEval(context->verbose());
         subEval.addPrefix(BLUE() + QStringLiteral("A") + RESET());
-        return eval(left, right);
+        return eval(context, left, right);
     } else
-        return eval(left, right);
+        return eval(context, left, right);
 }
 
-CombinatorPtr A::apply(const CombinatorPtr& x) const
+CombinatorPtr A::apply(HofContext* context, const CombinatorPtr& x) const
 {
     if (left.isNull() || right.isNull())
         return x;
 
     CombinatorPtr evaluate;
     {
-        if (Verbose::instance()->isVerbose()) {
-            SubEval subEval;
+        if (context->verbose()->isVerbose()) {
+            SubEval subEval(context->verbose());
             subEval.addPostfix(x->toString());
-            evaluate = apply();
+            evaluate = apply(context);
         } else
-            evaluate = apply();
+            evaluate = apply(context);
+    }
+    return eval(context, evaluate, x);
+}
+
+CombinatorPtr Capture::extend(const CombinatorPtr& arg) const
+{
+    Capture* cap = new Capture(*this);
+    cap->args.append(arg);
+    cap->argsToCapture = qMax(argsToCapture, cap->args.length());
+    return CombinatorPtr(cap);
+}
+
+CombinatorPtr Var::apply(HofContext* context, const CombinatorPtr& x) const
+{
+    Q_UNUSED(context);
+    return x;
+}
+
+// a^b, or -1 once it no longer fits
+static qint64 power(qint64 a, qint64 b)
+{
+    qint64 result = 1;
+    while (b) {
+        if (b & 1) {
+            if (a && result > std::numeric_limits<qint64>::max() / a)
+                return -1;
+            result *= a;
+        }
+        b >>= 1;
+        if (b && a > 1 && a > std::numeric_limits<qint64>::max() / a)
+            return -1;
+        a *= a;
+    }
+    return result;
+}
+
+// evaluates applications, unevaluated ones too, down to the value
+static void forceApplications(HofContext* context, CombinatorPtr* term)
+{
+    while (!context->isStopped()) {
+        if ((*term)->type() == Combinator::a_ && static_cast<A*>(term->data())->isFull())
+            *term = static_cast<A*>(term->data())->apply(context);
+        else if (Fix::isKnot(*term))
+            *term = static_cast<Fix*>(term->data())->unroll(context, *term);
+        else
+            break;
+    }
+}
+
+static CombinatorPtr application(const CombinatorPtr& left, const CombinatorPtr& right)
+{
+    A* a = new A;
+    a->left = left;
+    a->right = right;
+    a->isComplete = true;
+    return CombinatorPtr(a);
+}
+
+// FALSE as its definition KI returns it, unevaluated
+static CombinatorPtr falseTerm()
+{
+    return application(k(), i());
+}
+
+CombinatorPtr Numeral::apply(HofContext* context, const CombinatorPtr& x) const
+{
+    if (!function)
+        return CombinatorPtr(new Numeral(value, x));
+    if (!value)
+        return x;
+
+    // the function is applied at least once so it can be forced first, but
+    // only when that does not take away its printing or random choices
+    CombinatorPtr f = function;
+    if (f->type() != Combinator::a_ || !static_cast<A*>(f.data())->isFull() || !static_cast<A*>(f.data())->doNotCache())
+        forceApplications(context, &f);
+
+    CombinatorPtr argument = x;
+    switch (f->type()) {
+    case Combinator::arithmetic_:
+      {
+          Arithmetic::Operation operation = static_cast<const Arithmetic*>(f.data())->operation;
+          qint64 n = operation != Arithmetic::IsZero ? valueOf(context, &argument) : -1;
+          if (n >= 0 && operation == Arithmetic::Successor && n <= std::numeric_limits<qint64>::max() - value)
+              return CombinatorPtr(new Numeral(n + value));
+          if (n >= 0 && operation == Arithmetic::Predecessor)
+              return CombinatorPtr(new Numeral(n - qMin(n, value)));
+          break;
+      }
+    case Combinator::capture_:
+      {
+          // a constant function, as in ISZERO
+          const Capture* cap = static_cast<const Capture*>(f.data());
+          if (cap->callback->type() == Combinator::k_ && cap->args.length() == 1)
+              return cap->x();
+          break;
+      }
+    case Combinator::numeral_:
+      {
+          // m applied value times is m^value, and (m f) value times is f m*value times
+          const Numeral* m = static_cast<const Numeral*>(f.data());
+          if (!m->function) {
+              qint64 n = power(m->value, value);
+              if (n >= 0)
+                  return CombinatorPtr(new Numeral(n, x));
+          } else if (m->value <= std::numeric_limits<qint64>::max() / value) {
+              return Numeral(m->value * value, m->function).apply(context, x);
+          }
+          break;
+      }
+    default:
+        break;
+    }
+
+    // materialized as the thunks f (f (... x)) the numeral would build
+    for (qint64 n = 1; n < value && !context->isStopped(); ++n) {
+        A* a = new A;
+        a->left = f;
+        a->right = argument;
+        a->isThunk = true;
+        a->isComplete = true;
+        argument = CombinatorPtr(a);
     }
-    return eval(evaluate, x);
+    return eval(context, f, argument);
 }
 
-void Capture::append(const CombinatorPtr& arg)
+qint64 Numeral::valueOf(HofContext* context, CombinatorPtr* term)
 {
-    Q_ASSERT(args.length() < argsToCapture);
-    Q_ASSERT(arg.data() != this);
-    args.append(arg);
+    forceApplications(context, term);
+
+    const CombinatorPtr& t = *term;
+    switch (t->type()) {
+    case Combinator::numeral_:
+      {
+          // n applied to the numeral m is the numeral m^n
+          const Numeral* n = static_cast<const Numeral*>(t.data());
+          if (!n->function)
+              return n->value;
+          CombinatorPtr m = n->function;
+          qint64 base = m->type() == Combinator::a_ || m->type() == Combinator::numeral_ ? valueOf(context, &m) : -1;
+          return base < 0 ? -1 : power(base, n->value);
+      }
+    case Combinator::i_:
+        return 1;
+    case Combinator::capture_:
+      {
+          const Capture* cap = static_cast<const Capture*>(t.data());
+          bool isZero = cap->callback->type() == Combinator::k_ && cap->args.length() == 1 && cap->x()->type() == Combinator::i_;
+          return isZero ? 0 : -1;
+      }
+    default:
+        return -1;
+    }
 }
 
-CombinatorPtr Var::apply(const CombinatorPtr& x) const
+// whether the head of a forced term can be that of a Church numeral; a free
+// symbol returns what it is applied to so it would count as one, and the
+// others would be run for their effects or results rather than counted
+static bool isCountable(const CombinatorPtr& term)
 {
+    const Combinator* head = term.data();
+    forever {
+        if (head->type() == Combinator::a_ && static_cast<const A*>(head)->left)
+            head = static_cast<const A*>(head)->left.data();
+        else if (head->type() == Combinator::capture_)
+            head = static_cast<const Capture*>(head)->callback.data();
+        else
+            break;
+    }
+
+    switch (head->type()) {
+    case Combinator::var_:
+    case Combinator::bytes_:
+    case Combinator::primitive_:
+    case Combinator::foreign_:
+    case Combinator::p_:
+    case Combinator::r_:
+        return false;
+    default:
+        return true;
+    }
+}
+
+qint64 Numeral::count(HofContext* context, const CombinatorPtr& term)
+{
+    CombinatorPtr t = term;
+    qint64 n = valueOf(context, &t);
+    if (n >= 0 || context->isStopped() || !isCountable(t))
+        return n;
+
+    // INC is S(S(KS)K)
+    static const CombinatorPtr s_successor(new Arithmetic(Arithmetic::Successor,
+        application(s(), application(application(s(), application(k(), s())), k()))));
+    CombinatorPtr counted = eval(context, eval(context, t, s_successor), CombinatorPtr(new Numeral(0)));
+    return context->isStopped() ? -1 : valueOf(context, &counted);
+}
+
+CombinatorPtr Arithmetic::apply(HofContext* context, const CombinatorPtr& x) const
+{
+    CombinatorPtr argument = x;
+    qint64 n = Numeral::valueOf(context, &argument);
+    if (context->isStopped())
+        return argument;
+
+    if (n < 0 || (operation == Successor && n == std::numeric_limits<qint64>::max()))
+        return eval(context, definition, argument);
+
+    switch (operation) {
+    case Successor:
+        return CombinatorPtr(new Numeral(n + 1));
+    case Predecessor:
+        return CombinatorPtr(new Numeral(qMax(n - 1, qint64(0))));
+    case IsZero:
+    default:
+        break;
+    }
+    return !n ? k() : falseTerm();
+}
+
+CombinatorPtr Fix::apply(HofContext* context, const CombinatorPtr& x, const CombinatorPtr& self) const
+{
+    // Y f is f (Y f), left as a thunk just like the S reduction it replaces
+    if (!function) {
+        A* unrolled = new A;
+        unrolled->left = x;
+        unrolled->right = CombinatorPtr(new Fix(definition, x));
+        unrolled->isThunk = true;
+        unrolled->isComplete = true;
+        return CombinatorPtr(unrolled);
+    }
+
+    CombinatorPtr unrolled = unroll(context, self);
+    if (context->isStopped())
+        return unrolled;
+    return eval(context, unrolled, x);
+}
+
+CombinatorPtr Fix::unroll(HofContext* context, const CombinatorPtr& self) const
+{
+    Q_ASSERT(self.data() == this && function);
+    return eval(context, function, self);
+}
+
+bool Fix::isKnot(const CombinatorPtr& term)
+{
+    return term->type() == Combinator::fix_ && static_cast<const Fix*>(term.data())->function;
+}
+
+CombinatorPtr ByteString::apply(HofContext* context, const CombinatorPtr& x) const
+{
+    Q_UNUSED(context);
     return x;
 }
 
+static const char s_operators[] = "+-*/%=<";
+
+bool Primitive::fromSymbol(char symbol, Operation* operation)
+{
+    const char* found = symbol ? strchr(s_operators, symbol) : 0;
+    if (!found)
+        return false;
+    *operation = Operation(found - s_operators);
+    return true;
+}
+
+char Primitive::symbol(Operation operation)
+{
+    return s_operators[operation];
+}
+
+CombinatorPtr Primitive::apply(HofContext* context, const CombinatorPtr& x) const
+{
+    if (right)
+        return x;
+
+    CombinatorPtr argument = x;
+    forceApplications(context, &argument);
+    if (context->isStopped())
+        return argument;
+    if (!left)
+        return CombinatorPtr(new Primitive(operation, argument));
+
+    CombinatorPtr stuck(new Primitive(operation, left, argument));
+    if (left->type() == Combinator::bytes_ || argument->type() == Combinator::bytes_) {
+        if (left->type() != argument->type())
+            return stuck;
+        const QByteArray& a = static_cast<const ByteString*>(left.data())->bytes;
+        const QByteArray& b = static_cast<const ByteString*>(argument.data())->bytes;
+        switch (operation) {
+        case Add: return CombinatorPtr(new ByteString(a + b));
+        case Equal: return a == b ? k() : falseTerm();
+        case Less: return a < b ? k() : falseTerm();
+        default: return stuck;
+        }
+    }
+
+    // a Church numeral that is not a Numeral yet is counted
+    qint64 a = Numeral::count(context, left);
+    qint64 b = a < 0 ? -1 : Numeral::count(context, argument);
+    if (a < 0 || b < 0)
+        return stuck;
+
+    const qint64 max = std::numeric_limits<qint64>::max();
+    switch (operation) {
+    case Add:
+        return a <= max - b ? CombinatorPtr(new Numeral(a + b)) : stuck;
+    case Subtract:
+        return CombinatorPtr(new Numeral(a - qMin(a, b)));
+    case Multiply:
+        return !b || a <= max / b ? CombinatorPtr(new Numeral(a * b)) : stuck;
+    case Divide:
+        return b ? CombinatorPtr(new Numeral(a / b)) : stuck;
+    case Remainder:
+        return b ? CombinatorPtr(new Numeral(a % b)) : stuck;
+    case Equal:
+        return a == b ? k() : falseTerm();
+    case Less:
+    default:
+        return a < b ? k() : falseTerm();
+    }
+}
+
+CombinatorPtr Foreign::apply(HofContext* context, const CombinatorPtr& x) const
+{
+    int arity = function->signature.size();
+    if (arguments.count() == arity)
+        return x;
+
+    CombinatorPtr argument = x;
+    if (function->signature.at(arguments.count()) != HOF_FFI_TERM) {
+        forceApplications(context, &argument);
+        if (context->isStopped())
+            return argument;
+    }
+
+    Foreign* foreign = new Foreign(function);
+    foreign->arguments = arguments;
+    foreign->arguments.append(argument);
+    CombinatorPtr applied(foreign);
+    if (foreign->arguments.count() < arity)
+        return applied;
+
+    QVector<hof_ffi_value> values(arity);
+    for (int a = 0; a < arity; ++a) {
+        const CombinatorPtr& term = foreign->arguments.at(a);
+        hof_ffi_value& value = values[a];
+        value.type = hof_ffi_type(function->signature.at(a));
+        value.integer = a;
+        value.bytes = 0;
+        value.length = 0;
+        if (value.type == HOF_FFI_INTEGER) {
+            value.integer = Numeral::count(context, term);
+            if (value.integer < 0)
+                return applied;
+        } else if (value.type == HOF_FFI_BYTES) {
+            if (term->type() != Combinator::bytes_)
+                return applied;
+            const QByteArray& bytes = static_cast<const ByteString*>(term.data())->bytes;
+            value.bytes = bytes.constData();
+            value.length = size_t(bytes.size());
+        }
+    }
+    if (context->isStopped())
+        return applied;
+
+    ++context->effects;
+    hof_ffi_value result;
+    result.type = HOF_FFI_TERM;
+    result.integer = -1;
+    result.bytes = 0;
+    result.length = 0;
+    if (function->function(values.constData(), &result, function->userData))
+        return applied;
+
+    switch (result.type) {
+    case HOF_FFI_INTEGER:
+        return result.integer >= 0 ? CombinatorPtr(new Numeral(result.integer)) : applied;
+    case HOF_FFI_BYTES:
+        return CombinatorPtr(new ByteString(result.bytes ? QByteArray(result.bytes, int(result.length)) : QByteArray()));
+    case HOF_FFI_TERM:
+        return result.integer >= 0 && result.integer < arity ? foreign->arguments.at(int(result.integer)) : applied;
+    default:
+        return applied;
+    }
+}
+
 CombinatorPtr i()
 {
-    static CombinatorPtr s_instance;
-    if (!s_instance)
-        s_instance = CombinatorPtr(new I);
+    static CombinatorPtr s_instance(new I);
     return s_instance;
 }
 
 CombinatorPtr k()
 {
-    static CombinatorPtr s_instance;
-    if (!s_instance)
-        s_instance = CombinatorPtr(new K);
+    static CombinatorPtr s_instance(new K);
     return s_instance;
 }
 
 CombinatorPtr s()
 {
-    static CombinatorPtr s_instance;
-    if (!s_instance)
-        s_instance = CombinatorPtr(new S);
+    static CombinatorPtr s_instance(new S);
     return s_instance;
 }
 
 CombinatorPtr p()
 {
-    static CombinatorPtr s_instance;
-    if (!s_instance)
-        s_instance = CombinatorPtr(new P);
+    static CombinatorPtr s_instance(new P);
     return s_instance;
 }
 
 CombinatorPtr r()
 {
-    static CombinatorPtr s_instance;
-    if (!s_instance)
-        s_instance = CombinatorPtr(new R);
+    static CombinatorPtr s_instance(new R);
     return s_instance;
 }
 
 CombinatorPtr b()
 {
-    static CombinatorPtr s_instance;
-    if (!s_instance)
-        s_instance = CombinatorPtr(new B);
+    static CombinatorPtr s_instance(new B);
     return s_instance;
 }
 
 CombinatorPtr c()
 {
-    static CombinatorPtr s_instance;
-    if (!s_instance)
-        s_instance = CombinatorPtr(new C);
+    static CombinatorPtr s_instance(new C);
     return s_instance;
 }
 
-SubEval::SubEval()
-    : m_prefixNumber(-1)
+SubEval::SubEval(Verbose* verbose)
+    : m_verbose(verbose)
+    , m_prefixNumber(-1)
     , m_postfixNumber(-1) { }
 
 SubEval::SubEval(const SubEval& other)
 {
+    m_verbose = other.m_verbose;
     m_prefixNumber = other.m_prefixNumber;
     m_postfixNumber = other.m_postfixNumber;
     other.m_prefixNumber = -1;
@@ -599,25 +1165,25 @@ SubEval::~SubEval()
 void SubEval::clear()
 {
     if (m_prefixNumber != -1)
-        Verbose::instance()->removePrefix(m_prefixNumber);
+        m_verbose->removePrefix(m_prefixNumber);
     if (m_postfixNumber != -1)
-        Verbose::instance()->removePostfix(m_postfixNumber);
+        m_verbose->removePostfix(m_postfixNumber);
 }
 
 void SubEval::replacePrefix(const QString& prefix)
 {
     Q_ASSERT(m_prefixNumber != -1);
-    Verbose::instance()->replacePrefix(m_prefixNumber, prefix);
+    m_verbose->replacePrefix(m_prefixNumber, prefix);
 }
 
 void SubEval::addPrefix(const QString& prefix)
 {
-    m_prefixNumber = Verbose::instance()->addPrefix(prefix);
+    m_prefixNumber = m_verbose->addPrefix(prefix);
     Q_ASSERT(m_prefixNumber != -1);
 }
 
 void SubEval::addPostfix(const QString& postfix)
 {
-    m_postfixNumber = Verbose::instance()->addPostfix(postfix);
+    m_postfixNumber = m_verbose->addPostfix(postfix);
     Q_ASSERT(m_postfixNumber != -1);
 }
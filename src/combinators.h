@@ -3,10 +3,16 @@
 
 #include <QtCore>
 
+#include "hofffi.h"
+
 #define OPTIMIZATIONS 1
 
 class Combinator;
+class HofContext;
+class Spark;
+class Verbose;
 typedef QSharedPointer<Combinator> CombinatorPtr;
+typedef QSharedPointer<Spark> SparkPtr;
 
 // singleton combinators
 CombinatorPtr i();
@@ -18,7 +24,7 @@ CombinatorPtr b();
 CombinatorPtr c();
 
 // general evaluation function
-CombinatorPtr eval(const CombinatorPtr& left, const CombinatorPtr& right);
+CombinatorPtr eval(HofContext* context, const CombinatorPtr& left, const CombinatorPtr& right);
 
 enum OutputFormat {
   None,
@@ -27,29 +33,59 @@ enum OutputFormat {
 
 class Combinator {
 public:
-    enum Type { i_, k_, s_, p_, r_, a_, b_, c_, capture_, var_ };
+    enum Type { i_, k_, s_, p_, r_, a_, b_, c_, capture_, var_, numeral_, arithmetic_, bytes_, primitive_, foreign_, fix_ };
 
-    Combinator() : m_type(Type(-1)) { }
-    Combinator(Type t) : m_type(t) { }
-    ~Combinator() { }
+    Combinator() : m_type(Type(-1)), m_counted(s_counting.load()) { count(1); }
+    Combinator(Type t) : m_type(t), m_counted(s_counting.load()) { count(1); }
+    Combinator(const Combinator& other) : m_type(other.m_type), m_counted(s_counting.load()) { count(1); }
+    ~Combinator() { count(-1); }
     Type type() const { return m_type; }
-    CombinatorPtr apply(const CombinatorPtr& x) const;
+
+    // nodes alive in the whole process, other threads publish theirs in
+    // batches so this is off by a few hundred for each of them; only nodes
+    // made after setCounting() are counted, so without a collector a node
+    // costs nothing more than its type
+    static qint64 liveCount();
+    static void setCounting(bool counting) { s_counting.store(counting ? 1 : 0); }
     QString toString() const;
+
+    // writes the same as toString() without building it first, in time linear
+    // in the term however deep it is, the stream one returns the characters
+    void print(QString* string) const;
+    int print(QTextStream* stream) const;
+
     QString toStringApply(const CombinatorPtr& arg, OutputFormat f = None) const;
     QString typeToString() const;
 
 private:
+    void count(int nodes) const { if (m_counted) publish(nodes); }
+    static void publish(int nodes);
+    static QAtomicInt s_counting;
     Type m_type;
+    bool m_counted;
 };
 
+/**
+ * A partial application of a combinator to the arguments it has been given
+ * so far.  Captures are persistent values: they are complete once made and
+ * never changed, extending one returns a copy with the new argument, so the
+ * cache can hand the same capture to any number of applications.
+ */
 struct Capture : Combinator {
-    Capture(const CombinatorPtr& c, int args)
+    Capture(const CombinatorPtr& c, const CombinatorPtr& x)
         : Combinator(Combinator::capture_)
         , callback(c)
-        , argsToCapture(args) { }
+        , argsToCapture(1) { args.append(x); }
+
+    Capture(const CombinatorPtr& c, const CombinatorPtr& x, const CombinatorPtr& y)
+        : Combinator(Combinator::capture_)
+        , callback(c)
+        , argsToCapture(2) { args.append(x); args.append(y); }
 
     bool isFull() const { return argsToCapture == args.length(); }
-    void append(const CombinatorPtr& c);
+
+    // a copy with one more argument
+    CombinatorPtr extend(const CombinatorPtr& c) const;
     QList<CombinatorPtr> args;
     CombinatorPtr callback;
     int argsToCapture;
@@ -62,37 +98,34 @@ struct Capture : Combinator {
 
 struct I : Combinator {
     I() : Combinator(Combinator::i_) { }
-    CombinatorPtr apply(const CombinatorPtr& x) const;
+    CombinatorPtr apply(HofContext* context, const CombinatorPtr& x) const;
 };
 
 struct K : Combinator {
     K() : Combinator(Combinator::k_) { }
-    CombinatorPtr apply(const CombinatorPtr& arg, CombinatorPtr cap = CombinatorPtr()) const;
+    CombinatorPtr apply(HofContext* context, const CombinatorPtr& arg, CombinatorPtr cap = CombinatorPtr()) const;
 };
 
 struct S : Combinator {
     S() : Combinator(Combinator::s_) { }
-    CombinatorPtr apply(const CombinatorPtr& arg, CombinatorPtr cap = CombinatorPtr()) const;
+    CombinatorPtr apply(HofContext* context, const CombinatorPtr& arg, CombinatorPtr cap = CombinatorPtr()) const;
 };
 
-class P : public Combinator {
-public:
-    P() : Combinator(Combinator::p_) { m_stream = 0; }
-    CombinatorPtr apply(const CombinatorPtr& x) const;
-    void setStream(QTextStream* stream);
-private:
-    QTextStream* m_stream;
+struct P : Combinator {
+    P() : Combinator(Combinator::p_) { }
+    CombinatorPtr apply(HofContext* context, const CombinatorPtr& x) const;
 };
 
 struct R : Combinator {
     R() : Combinator(Combinator::r_) { }
-    CombinatorPtr apply(const CombinatorPtr& arg, CombinatorPtr cap = CombinatorPtr()) const;
+    CombinatorPtr apply(HofContext* context, const CombinatorPtr& arg, CombinatorPtr cap = CombinatorPtr()) const;
 };
 
 struct A : Combinator {
-    A() : Combinator(Combinator::a_), isThunk(false) { }
-    CombinatorPtr apply() const;
-    CombinatorPtr apply(const CombinatorPtr& x) const;
+    A() : Combinator(Combinator::a_), isThunk(false), isComplete(false) { }
+    ~A();
+    CombinatorPtr apply(HofContext* context) const;
+    CombinatorPtr apply(HofContext* context, const CombinatorPtr& x) const;
 
     bool isFull() const;
     bool isWellFormed() const;
@@ -101,27 +134,165 @@ struct A : Combinator {
     CombinatorPtr left;
     CombinatorPtr right;
     bool isThunk;
+
+    // set by the parsers once the term is well formed, so a shared subterm
+    // is not walked again by every application it is added to
+    bool isComplete;
+
+    // the value of a thunk that has been evaluated, it prints as before
+    CombinatorPtr forced;
+
+    // set when a pure thunk has been handed to the speculator
+    SparkPtr spark;
 };
 
 struct B : Combinator {
     B() : Combinator(Combinator::b_) { }
-    CombinatorPtr apply(const CombinatorPtr& arg, CombinatorPtr cap = CombinatorPtr()) const;
+    CombinatorPtr apply(HofContext* context, const CombinatorPtr& arg, CombinatorPtr cap = CombinatorPtr()) const;
 };
 
 struct C : Combinator {
     C() : Combinator(Combinator::c_) { }
-    CombinatorPtr apply(const CombinatorPtr& arg, CombinatorPtr cap = CombinatorPtr()) const;
+    CombinatorPtr apply(HofContext* context, const CombinatorPtr& arg, CombinatorPtr cap = CombinatorPtr()) const;
 };
 
 struct Var : Combinator {
     Var(QChar c) : Combinator(Combinator::var_), ch(c) { }
-    CombinatorPtr apply(const CombinatorPtr& x) const;
+    CombinatorPtr apply(HofContext* context, const CombinatorPtr& x) const;
     QChar ch;
 };
 
+/**
+ * A Church numeral held as a native integer.  Applied to a function it
+ * waits for one more argument, then the standard successor, predecessor,
+ * constant functions and other numerals are iterated in O(1), and anything
+ * else gets the function applied value times, as the numeral would.
+ */
+struct Numeral : Combinator {
+    Numeral(qint64 v, const CombinatorPtr& f = CombinatorPtr())
+        : Combinator(Combinator::numeral_)
+        , value(v)
+        , function(f) { }
+    CombinatorPtr apply(HofContext* context, const CombinatorPtr& x) const;
+
+    // the number a term behaves as once forced, I and KI included, or -1
+    static qint64 valueOf(HofContext* context, CombinatorPtr* term);
+
+    // valueOf, or what any other term that could be a Church numeral counts
+    // to given a native successor and zero, which runs it
+    static qint64 count(HofContext* context, const CombinatorPtr& term);
+
+    qint64 value;
+    CombinatorPtr function;
+};
+
+/**
+ * INC, DEC or ISZERO recognized in a program.  A numeral argument is forced
+ * and computed natively, anything else goes to the definition, which is
+ * also what it prints as.
+ */
+struct Arithmetic : Combinator {
+    enum Operation { Successor, Predecessor, IsZero };
+
+    Arithmetic(Operation o, const CombinatorPtr& d)
+        : Combinator(Combinator::arithmetic_)
+        , operation(o)
+        , definition(d) { }
+    CombinatorPtr apply(HofContext* context, const CombinatorPtr& x) const;
+
+    Operation operation;
+    CombinatorPtr definition;
+};
+
+/**
+ * A fixpoint combinator recognized in a program.  Applied to a function f it
+ * gives f applied to a Fix holding f, which stands for the whole fixpoint:
+ * applied to an argument it unrolls once more by applying f to itself.  So
+ * recursion costs one application, which the cache remembers, rather than
+ * copying x x with S reductions, and every unrolling refers back to the
+ * same node.  It prints as the definition applied to f.
+ */
+struct Fix : Combinator {
+    Fix(const CombinatorPtr& d, const CombinatorPtr& f = CombinatorPtr())
+        : Combinator(Combinator::fix_)
+        , definition(d)
+        , function(f) { }
+    CombinatorPtr apply(HofContext* context, const CombinatorPtr& x, const CombinatorPtr& self) const;
+
+    // f applied to the fixpoint, what it is when forced like a thunk
+    CombinatorPtr unroll(HofContext* context, const CombinatorPtr& self) const;
+
+    // whether term is a Fix that has its function
+    static bool isKnot(const CombinatorPtr& term);
+
+    CombinatorPtr definition;
+    CombinatorPtr function;
+};
+
+/**
+ * A byte string literal.  Like a Var it is data and applied returns its
+ * argument, P prints the bytes themselves rather than the literal.
+ */
+struct ByteString : Combinator {
+    ByteString(const QByteArray& b)
+        : Combinator(Combinator::bytes_)
+        , bytes(b) { }
+    CombinatorPtr apply(HofContext* context, const CombinatorPtr& x) const;
+    QByteArray bytes;
+};
+
+/**
+ * A strict binary operation on integers or byte strings, each argument is
+ * forced as it is applied.  Numbers are natural like the Church numerals
+ * they stand for, so subtraction stops at zero, and comparisons return K
+ * or KI.  An application with no result, on the wrong types, dividing by
+ * zero or overflowing, is left as it is and applied like a Var.
+ */
+struct Primitive : Combinator {
+    enum Operation { Add, Subtract, Multiply, Divide, Remainder, Equal, Less };
+
+    Primitive(Operation o, const CombinatorPtr& l = CombinatorPtr(), const CombinatorPtr& r = CombinatorPtr())
+        : Combinator(Combinator::primitive_)
+        , operation(o)
+        , left(l)
+        , right(r) { }
+    CombinatorPtr apply(HofContext* context, const CombinatorPtr& x) const;
+
+    // the operation #op; stands for, false if there is none
+    static bool fromSymbol(char symbol, Operation* operation);
+    static char symbol(Operation operation);
+
+    Operation operation;
+    CombinatorPtr left;
+    CombinatorPtr right;
+};
+
+// a native function loaded by ForeignFunctions
+struct ForeignFunction {
+    QChar name;
+    QByteArray signature;   // an hof_ffi_type for each argument
+    hof_ffi_function function;
+    void* userData;
+};
+
+/**
+ * A native function and the arguments given to it so far, forced as its
+ * signature says.  Once it has them all the function is called, and when
+ * it fails the application is left as it is and applied like a Var.
+ */
+struct Foreign : Combinator {
+    Foreign(const QSharedPointer<const ForeignFunction>& f)
+        : Combinator(Combinator::foreign_)
+        , function(f) { }
+    CombinatorPtr apply(HofContext* context, const CombinatorPtr& x) const;
+
+    QSharedPointer<const ForeignFunction> function;
+    QList<CombinatorPtr> arguments;
+};
+
 class SubEval {
 public:
-    SubEval();
+    SubEval(Verbose* verbose);
     SubEval(const SubEval& other);
     ~SubEval();
 
@@ -131,6 +302,7 @@ public:
     void addPostfix(const QString& postfix);
 
 private:
+    Verbose* m_verbose;
     mutable int m_prefixNumber;
     mutable int m_postfixNumber;
 };
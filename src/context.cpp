@@ -0,0 +1,201 @@
+#include "context.h"
+
+#include "cache.h"
+#include "collector.h"
+#include "fiber.h"
+#include "random.h"
+#include "verbose.h"
+
+#include <limits>
+
+#if defined(Q_OS_LINUX)
+#include <unistd.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+
+// reading the clock and the process memory is too costly for every reduction
+static const qint64 s_checkpointInterval = 1024;
+
+static qint64 residentMemory()
+{
+#if defined(Q_OS_LINUX)
+    QFile statm("/proc/self/statm");
+    if (!statm.open(QIODevice::ReadOnly))
+        return 0;
+    QList<QByteArray> fields = statm.readAll().split(' ');
+    return fields.count() > 1 ? fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE) : 0;
+#elif defined(Q_OS_UNIX)
+    // only the peak is portable
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#if defined(Q_OS_MAC)
+    return usage.ru_maxrss;
+#else
+    return qint64(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+static qint64 tighter(qint64 a, qint64 b)
+{
+    if (!a || !b)
+        return qMax(a, b);
+    return qMin(a, b);
+}
+
+HofLimits HofLimits::tightened(const HofLimits& other) const
+{
+    HofLimits limits;
+    limits.maxDepth = qMin(maxDepth, other.maxDepth);
+    limits.maxReductions = tighter(maxReductions, other.maxReductions);
+    limits.maxMsecs = tighter(maxMsecs, other.maxMsecs);
+    limits.maxMemory = tighter(maxMemory, other.maxMemory);
+    limits.maxOutput = tighter(maxOutput, other.maxOutput);
+    return limits;
+}
+
+HofContext::HofContext()
+    : evaluationDepth(0)
+    , reductions(0)
+    , nextCheckpoint(std::numeric_limits<qint64>::max())
+    , outputSize(0)
+    , effects(0)
+    , m_privateCache(new EvaluationCache)
+    , m_cache(m_privateCache)
+    , m_verbose(new Verbose)
+    , m_random(new Random)
+    , m_collector(new Collector)
+    , m_output(0)
+    , m_speculator(0)
+    , m_interrupt(0)
+    , m_fiber(0)
+    , m_slice(0)
+    , m_nextYield(std::numeric_limits<qint64>::max())
+    , m_status(Running)
+{
+    m_timer.start();
+}
+
+HofContext::~HofContext()
+{
+    delete m_privateCache;
+    delete m_verbose;
+    delete m_random;
+    delete m_collector;
+}
+
+void HofContext::stop(Status status)
+{
+    Q_ASSERT(status != Running);
+    if (m_status == Running)
+        m_status = status;
+}
+
+void HofContext::reset()
+{
+    evaluationDepth = 0;
+    reductions = 0;
+    outputSize = 0;
+    m_nextYield = m_fiber ? m_slice : std::numeric_limits<qint64>::max();
+    m_status = Running;
+    m_timer.restart();
+    scheduleCheckpoint();
+}
+
+QString HofContext::statusName(Status status)
+{
+    switch (status) {
+    case Running:            return QStringLiteral("running");
+    case Finished:           return QStringLiteral("finished");
+    case DepthExceeded:      return QStringLiteral("depth-exceeded");
+    case Cancelled:          return QStringLiteral("cancelled");
+    case ReductionsExceeded: return QStringLiteral("reductions-exceeded");
+    case TimeExceeded:       return QStringLiteral("time-exceeded");
+    case MemoryExceeded:     return QStringLiteral("memory-exceeded");
+    case OutputExceeded:     return QStringLiteral("output-exceeded");
+    default:
+        Q_ASSERT(false);
+        return QString();
+    }
+}
+
+int HofContext::exitCode(Status status)
+{
+    switch (status) {
+    case Running:
+    case Finished:           return EXIT_SUCCESS;
+    case DepthExceeded:      return 2;
+    case Cancelled:          return 3;
+    case ReductionsExceeded: return 4;
+    case TimeExceeded:       return 5;
+    case MemoryExceeded:     return 6;
+    case OutputExceeded:     return 7;
+    default:
+        Q_ASSERT(false);
+        return -1;
+    }
+}
+
+void HofContext::setLimits(const HofLimits& limits)
+{
+    m_limits = limits;
+    scheduleCheckpoint();
+}
+
+void HofContext::setCollectorBudget(qint64 budget)
+{
+    m_collector->setBudget(budget);
+    scheduleCheckpoint();
+}
+
+void HofContext::setFiber(Fiber* fiber, qint64 slice)
+{
+    m_fiber = fiber;
+    m_slice = qMax(qint64(1), slice);
+    m_nextYield = m_fiber ? reductions + m_slice : std::numeric_limits<qint64>::max();
+    scheduleCheckpoint();
+}
+
+void HofContext::scheduleCheckpoint()
+{
+    qint64 next = m_nextYield;
+    if (m_limits.maxReductions)
+        next = qMin(next, m_limits.maxReductions);
+    if (m_limits.maxMsecs || m_limits.maxMemory || m_collector->isEnabled())
+        next = qMin(next, reductions + s_checkpointInterval);
+    nextCheckpoint = next;
+}
+
+void HofContext::checkpoint()
+{
+    // before the memory limit so it sees what collecting freed
+    m_collector->check(m_cache);
+
+    if (m_limits.maxReductions && reductions >= m_limits.maxReductions)
+        stop(ReductionsExceeded);
+    if (m_limits.maxMsecs && m_timer.elapsed() >= m_limits.maxMsecs)
+        stop(TimeExceeded);
+    if (m_limits.maxMemory && residentMemory() >= m_limits.maxMemory)
+        stop(MemoryExceeded);
+
+    if (m_fiber && reductions >= m_nextYield) {
+        m_fiber->yield();
+        m_nextYield = reductions + m_slice;
+    }
+
+    scheduleCheckpoint();
+}
+
+int HofContext::reserveOutput(int size)
+{
+    if (m_limits.maxOutput && outputSize + size > m_limits.maxOutput) {
+        size = int(qMax(qint64(0), m_limits.maxOutput - outputSize));
+        stop(OutputExceeded);
+    }
+    outputSize += size;
+    return size;
+}
@@ -0,0 +1,136 @@
+#ifndef context_h
+#define context_h
+
+#include <QtCore>
+
+class Collector;
+class EvaluationCache;
+class Fiber;
+class Random;
+class Speculator;
+class Verbose;
+
+// zero means no limit for everything but the depth
+struct HofLimits {
+    HofLimits()
+        : maxDepth(1000)
+        , maxReductions(0)
+        , maxMsecs(0)
+        , maxMemory(0)
+        , maxOutput(0) { }
+
+    // the tighter of each of our limits and other's
+    HofLimits tightened(const HofLimits& other) const;
+
+    int maxDepth;
+    qint64 maxReductions;
+    qint64 maxMsecs;
+    qint64 maxMemory;   // resident bytes of the whole process
+    qint64 maxOutput;   // characters printed by P
+};
+
+/**
+ * Everything a single evaluation needs that used to live in process wide
+ * singletons.  A context is owned by exactly one thread at a time and is
+ * handed down through eval() and the combinator apply functions, so any
+ * number of independent programs can run side by side in one process.
+ */
+class HofContext {
+public:
+    enum Status {
+        Running,
+        Finished,
+        DepthExceeded,
+        Cancelled,
+        ReductionsExceeded,
+        TimeExceeded,
+        MemoryExceeded,
+        OutputExceeded
+    };
+
+    static QString statusName(Status status);
+
+    // distinct process exit code for each way a program can stop
+    static int exitCode(Status status);
+
+    HofContext();
+    ~HofContext();
+
+    EvaluationCache* cache() const { return m_cache; }
+
+    // use a cache shared with other contexts, or our own private one if 0
+    void setCache(EvaluationCache* cache) { m_cache = cache ? cache : m_privateCache; }
+    Verbose* verbose() const { return m_verbose; }
+    Random* random() const { return m_random; }
+
+    // sweeps the cache at checkpoints once its budget is set
+    Collector* collector() const { return m_collector; }
+    void setCollectorBudget(qint64 budget);
+
+    QTextStream* output() const { return m_output; }
+    void setOutput(QTextStream* stream) { m_output = stream; }
+
+    HofLimits limits() const { return m_limits; }
+    void setLimits(const HofLimits& limits);
+
+    // hands pure thunks to this speculator for parallel reduction if set
+    Speculator* speculator() const { return m_speculator; }
+    void setSpeculator(Speculator* speculator) { m_speculator = speculator; }
+
+    // another thread can interrupt the evaluation by setting this flag
+    void setInterrupt(const QAtomicInt* flag) { m_interrupt = flag; }
+
+    // evaluation running inside a fiber yields to its scheduler every slice reductions
+    void setFiber(Fiber* fiber, qint64 slice);
+
+    // checks the limits and yields to the fiber's scheduler when due
+    void checkpoint();
+
+    // how many of the size characters P wants to print fit under the output
+    // limit, stops the evaluation if they do not all fit
+    int reserveOutput(int size);
+
+    Status status() const { return m_status; }
+    bool isStopped() const { return m_status != Running || (m_interrupt && m_interrupt->load()); }
+    void stop(Status status);
+    void reset();
+
+    int evaluationDepth;
+
+    // applications evaluated since the last reset
+    qint64 reductions;
+
+    // eval() calls checkpoint() once reductions gets here
+    qint64 nextCheckpoint;
+
+    // characters printed since the last reset
+    qint64 outputSize;
+
+    // prints, random choices and native calls ever made, a result computed
+    // while this changed is neither cached nor remembered by its thunk
+    qint64 effects;
+
+    // wall clock time since the last reset
+    qint64 elapsed() const { return m_timer.elapsed(); }
+
+private:
+    Q_DISABLE_COPY(HofContext)
+    EvaluationCache* m_privateCache;
+    EvaluationCache* m_cache;
+    Verbose* m_verbose;
+    Random* m_random;
+    Collector* m_collector;
+    QTextStream* m_output;
+    Speculator* m_speculator;
+    const QAtomicInt* m_interrupt;
+    void scheduleCheckpoint();
+
+    Fiber* m_fiber;
+    qint64 m_slice;
+    qint64 m_nextYield;
+    QElapsedTimer m_timer;
+    HofLimits m_limits;
+    Status m_status;
+};
+
+#endif // context_h
@@ -0,0 +1,120 @@
+#include "ffi.h"
+
+#include "combinators.h"
+
+// the combinators and the characters the lexers give a meaning
+static const char s_reserved[] = "AIKPRS$@#\"";
+
+ForeignFunctions::ForeignFunctions()
+    : m_bound(0)
+{
+}
+
+ForeignFunctions::~ForeignFunctions()
+{
+    m_functions.clear();
+    qDeleteAll(m_libraries);
+}
+
+bool ForeignFunctions::load(const QString& fileName, QString* error)
+{
+    QScopedPointer<QLibrary> library(new QLibrary(fileName));
+    if (!library->load()) {
+        if (error)
+            *error = library->errorString();
+        return false;
+    }
+
+    hof_ffi_register_function registerFunctions = reinterpret_cast<hof_ffi_register_function>(library->resolve(HOF_FFI_REGISTER));
+    const hof_ffi_definition* definitions = registerFunctions ? registerFunctions(HOF_FFI_VERSION) : 0;
+    if (!definitions) {
+        if (error)
+            *error = QString("%1 does not register functions for version %2").arg(fileName).arg(HOF_FFI_VERSION);
+        return false;
+    }
+
+    // nothing is bound unless the whole table is valid
+    QHash<QChar, QSharedPointer<const ForeignFunction> > functions;
+    for (const hof_ffi_definition* definition = definitions; definition->name; ++definition) {
+        QString name = QString::fromUtf8(definition->name);
+        QByteArray signature(definition->signature ? definition->signature : "");
+        bool isValid = name.length() == 1 && !QString(s_reserved).contains(name.at(0))
+            && !signature.isEmpty() && definition->function;
+        for (int a = 0; a < signature.size() && isValid; ++a)
+            isValid = signature.at(a) == HOF_FFI_INTEGER || signature.at(a) == HOF_FFI_BYTES || signature.at(a) == HOF_FFI_TERM;
+        if (!isValid || functions.contains(name.at(0)) || m_functions.contains(name.at(0))) {
+            if (error)
+                *error = QString("%1 defines an invalid or duplicate function '%2' (%3)").arg(fileName).arg(name).arg(QString(signature));
+            return false;
+        }
+
+        ForeignFunction* function = new ForeignFunction;
+        function->name = name.at(0);
+        function->signature = signature;
+        function->function = definition->function;
+        function->userData = definition->user_data;
+        functions.insert(function->name, QSharedPointer<const ForeignFunction>(function));
+    }
+
+    m_functions.unite(functions);
+    m_libraries.append(library.take());
+    return true;
+}
+
+QStringList ForeignFunctions::names() const
+{
+    QStringList names;
+    foreach (const QSharedPointer<const ForeignFunction>& function, m_functions)
+        names.append(QString(function->name) + ":" + QString(function->signature));
+    names.sort();
+    return names;
+}
+
+QList<CombinatorPtr> ForeignFunctions::bind(const QList<CombinatorPtr>& terms)
+{
+    m_bound = 0;
+    QList<CombinatorPtr> bound;
+    foreach (const CombinatorPtr& term, terms)
+        bound.append(bind(term));
+    return bound;
+}
+
+// the function a variable names, otherwise the term itself
+CombinatorPtr ForeignFunctions::function(const CombinatorPtr& term)
+{
+    if (term->type() != Combinator::var_)
+        return term;
+    QSharedPointer<const ForeignFunction> function = m_functions.value(static_cast<const Var*>(term.data())->ch);
+    if (!function)
+        return term;
+    ++m_bound;
+    return CombinatorPtr(new Foreign(function));
+}
+
+CombinatorPtr ForeignFunctions::bind(const CombinatorPtr& term)
+{
+    if (m_functions.isEmpty() || !term)
+        return term;
+
+    // in place and without recursion, every shared application once
+    QVector<A*> stack;
+    QSet<const A*> visited;
+    if (term->type() == Combinator::a_)
+        stack.append(static_cast<A*>(term.data()));
+    while (!stack.isEmpty()) {
+        A* a = stack.takeLast();
+        if (visited.contains(a))
+            continue;
+        visited.insert(a);
+        CombinatorPtr* children[] = { &a->left, &a->right };
+        for (CombinatorPtr* child : children) {
+            if (child->isNull())
+                continue;
+            if ((*child)->type() == Combinator::a_)
+                stack.append(static_cast<A*>(child->data()));
+            else
+                *child = function(*child);
+        }
+    }
+    return function(term);
+}
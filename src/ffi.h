@@ -0,0 +1,44 @@
+#ifndef ffi_h
+#define ffi_h
+
+#include <QtCore>
+
+class Combinator;
+struct ForeignFunction;
+typedef QSharedPointer<Combinator> CombinatorPtr;
+
+/**
+ * Native functions loaded from shared libraries through the registration
+ * interface in hofffi.h.  Once loaded, binding a parsed program replaces
+ * every variable named after a function with that function, which then
+ * evaluates through eval() like the built in combinators.
+ *
+ * The libraries stay loaded for as long as this does, so it has to outlive
+ * every program bound with it.
+ */
+class ForeignFunctions {
+public:
+    ForeignFunctions();
+    ~ForeignFunctions();
+
+    bool load(const QString& fileName, QString* error = 0);
+
+    QList<CombinatorPtr> bind(const QList<CombinatorPtr>& terms);
+    CombinatorPtr bind(const CombinatorPtr& term);
+
+    int count() const { return m_functions.count(); }
+    QStringList names() const;
+
+    // variables replaced by the last bind
+    int bound() const { return m_bound; }
+
+private:
+    Q_DISABLE_COPY(ForeignFunctions)
+    CombinatorPtr function(const CombinatorPtr& term);
+
+    QList<QLibrary*> m_libraries;
+    QHash<QChar, QSharedPointer<const ForeignFunction> > m_functions;
+    int m_bound;
+};
+
+#endif // ffi_h
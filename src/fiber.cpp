@@ -0,0 +1,82 @@
+#include "fiber.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// what one level of eval, apply and the combinator between them take with
+// room to spare, the main thread's eight megabytes give the default limit
+// about as much
+static const size_t s_bytesPerLevel = 8 * 1024;
+
+// for the run() that starts evaluating and whatever it calls at depth zero
+static const size_t s_baseBytes = 64 * 1024;
+
+static size_t pageSize()
+{
+    static const size_t size = size_t(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+size_t Fiber::stackSize(int maxDepth)
+{
+    size_t bytes = s_baseBytes + size_t(qMax(0, maxDepth)) * s_bytesPerLevel;
+    return (bytes + pageSize() - 1) / pageSize() * pageSize();
+}
+
+Fiber::Fiber(int maxDepth)
+    : m_mapping(0)
+    , m_mappingSize(pageSize() + stackSize(maxDepth))
+    , m_started(false)
+    , m_finished(false)
+{
+    void* mapping = mmap(0, m_mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (mapping == MAP_FAILED)
+        qFatal("Fiber: could not map a stack of %zu bytes", m_mappingSize);
+    m_mapping = static_cast<char*>(mapping);
+
+    // stacks grow down, so the guard goes at the lowest address
+    mprotect(m_mapping, pageSize(), PROT_NONE);
+}
+
+Fiber::~Fiber()
+{
+    Q_ASSERT(!m_started || m_finished);
+    munmap(m_mapping, m_mappingSize);
+}
+
+void Fiber::trampoline(int high, int low)
+{
+    // makecontext only passes ints so the pointer comes in two halves
+    quintptr pointer = (quintptr(quint32(high)) << 16 << 16) | quintptr(quint32(low));
+    Fiber* fiber = reinterpret_cast<Fiber*>(pointer);
+    fiber->run();
+    fiber->m_finished = true;
+    swapcontext(&fiber->m_context, &fiber->m_caller);
+}
+
+bool Fiber::resume()
+{
+    if (m_finished)
+        return false;
+
+    if (!m_started) {
+        m_started = true;
+        getcontext(&m_context);
+        m_context.uc_stack.ss_sp = m_mapping + pageSize();
+        m_context.uc_stack.ss_size = m_mappingSize - pageSize();
+        m_context.uc_link = 0;
+
+        quintptr pointer = reinterpret_cast<quintptr>(this);
+        makecontext(&m_context, reinterpret_cast<void (*)()>(&Fiber::trampoline), 2,
+                    int(quint64(pointer) >> 32), int(quint32(pointer)));
+    }
+
+    swapcontext(&m_caller, &m_context);
+    return !m_finished;
+}
+
+void Fiber::yield()
+{
+    Q_ASSERT(m_started && !m_finished);
+    swapcontext(&m_context, &m_caller);
+}
@@ -0,0 +1,52 @@
+#ifndef fiber_h
+#define fiber_h
+
+#include <QtCore>
+
+#include <ucontext.h>
+
+/**
+ * A stackful coroutine.  eval() recurses through the combinators so a
+ * stackless coroutine would have to turn the whole interpreter inside out;
+ * a fiber instead gives each evaluation a stack of its own that can be
+ * suspended at any depth with yield() and picked up again with resume().
+ *
+ * A fiber is only ever resumed from the thread that first resumed it.
+ *
+ * The stack is sized for evaluation nested as deep as the depth limit and
+ * mapped rather than allocated, so only the pages a fiber really reaches
+ * take memory, with an inaccessible guard page below it so running off the
+ * end faults right away instead of writing over whatever lies beneath.
+ */
+class Fiber {
+public:
+    explicit Fiber(int maxDepth);
+    virtual ~Fiber();
+
+    // bytes of stack for evaluation nested maxDepth deep, in whole pages
+    static size_t stackSize(int maxDepth);
+
+    // runs until the fiber yields or returns, false once it has returned
+    bool resume();
+
+    // hands control back to whoever resumed us
+    void yield();
+
+    bool isFinished() const { return m_finished; }
+
+protected:
+    virtual void run() = 0;
+
+private:
+    Q_DISABLE_COPY(Fiber)
+    static void trampoline(int high, int low);
+
+    ucontext_t m_context;
+    ucontext_t m_caller;
+    char* m_mapping;    // the guard page, then the stack
+    size_t m_mappingSize;
+    bool m_started;
+    bool m_finished;
+};
+
+#endif // fiber_h
@@ -0,0 +1,60 @@
+#include "fixpoints.h"
+
+#include "combinators.h"
+
+static const char* const s_definitions[] = {
+    // S(K(SII))(S(S(KS)K)(K(SII)))
+    "AASAKAASIIAASAASAKSKAKAASII",
+    // λf.(λx.f (x x)) (λx.f (x x)) as the lambda translator writes it
+    "AASAASAASAKSKAKAASIIAASAASAKSKAKAASII",
+    // SSK(S(K(SS(S(SSK))))K)
+    "AAASSKAASAKAASSASAASSKK"
+};
+
+// the most top level terms a definition is ever written as
+static const int s_maximumTerms = 4;
+
+static CombinatorPtr application(const CombinatorPtr& left, const CombinatorPtr& right)
+{
+    A* a = new A;
+    a->left = left;
+    a->right = right;
+    a->isComplete = true;
+    return CombinatorPtr(a);
+}
+
+Fixpoints::Fixpoints()
+    : Recognizer(s_definitions, sizeof(s_definitions) / sizeof(s_definitions[0]))
+    , m_count(0)
+{
+}
+
+QList<CombinatorPtr> Fixpoints::recognize(const QList<CombinatorPtr>& terms)
+{
+    QList<CombinatorPtr> recognized = Recognizer::recognize(terms);
+
+    // the terms are applied one after another, so only the first few can
+    // spell a fixpoint combinator between them
+    CombinatorPtr prefix = recognized.value(0);
+    qint64 length = prefix ? prefix->toString().length() : 0;
+    for (int n = 2; n <= s_maximumTerms && n <= recognized.count(); ++n) {
+        if (recognized.at(n - 2)->type() == Combinator::p_)
+            break;
+        length += 1 + recognized.at(n - 1)->toString().length();
+        prefix = application(prefix, recognized.at(n - 1));
+        CombinatorPtr fix = match(prefix, length);
+        if (fix != prefix) {
+            recognized.erase(recognized.begin(), recognized.begin() + n);
+            recognized.prepend(fix);
+            break;
+        }
+    }
+    return recognized;
+}
+
+CombinatorPtr Fixpoints::replace(const CombinatorPtr& term, int definition)
+{
+    Q_UNUSED(definition);
+    ++m_count;
+    return CombinatorPtr(new Fix(term));
+}
@@ -0,0 +1,34 @@
+#ifndef fixpoints_h
+#define fixpoints_h
+
+#include "recognizer.h"
+
+/**
+ * Finds the standard fixpoint combinators in a parsed program, the Y and Y1
+ * encodings and what the lambda translator makes of
+ * λf.(λx.f (x x)) (λx.f (x x)), and replaces them with Fix nodes.  A program
+ * that starts with the combinator spread over its first terms, as Y(API) is
+ * written, has them replaced too.
+ *
+ * Fix prints as the definition applied to its function, otherwise programs
+ * behave the same.  Like every Recognizer the arguments given directly to P
+ * are left as they were written.
+ */
+class Fixpoints : public Recognizer {
+public:
+    Fixpoints();
+
+    QList<CombinatorPtr> recognize(const QList<CombinatorPtr>& terms);
+    using Recognizer::recognize;
+
+    int recognized() const { return m_count; }
+    void clear() { m_count = 0; }
+
+protected:
+    CombinatorPtr replace(const CombinatorPtr& term, int definition);
+
+private:
+    int m_count;
+};
+
+#endif // fixpoints_h
@@ -3,34 +3,185 @@
 #include "cache.h"
 #include "combinators.h"
 #include "colors.h"
+#include "lexer.h"
 #include "verbose.h"
 
-void cppInterpreter(const QString& string)
+// a program already in UTF-16, whitespace between terms is skipped
+class Utf16Program {
+public:
+    Utf16Program(const QString& string, bool sharing)
+        : m_string(string)
+        , m_position(0)
+        , m_sharing(sharing)
+        , m_type(Lexer::None)
+        , m_reference(-1) { }
+
+    QString toString() const { return m_string; }
+    bool isEmpty() const { return m_string.isEmpty(); }
+
+    bool atEnd()
+    {
+        while (m_position < m_string.length() && m_string.at(m_position).isSpace())
+            ++m_position;
+        return m_position >= m_string.length();
+    }
+
+    QChar next()
+    {
+        QChar ch = m_string.at(m_position++);
+        m_type = Lexer::Symbol;
+        if (m_sharing && ch == '$')
+            m_type = Lexer::Share;
+        else if (m_sharing && ch == '@')
+            m_type = Lexer::Reference;
+        if (m_type == Lexer::Reference)
+            m_reference = readReference();
+        return ch;
+    }
+
+    // Symbol, or Share or Reference with sharing on
+    Lexer::Type type() const { return m_type; }
+
+    // the node the last @ refers to, or -1 for a plain @
+    int reference() const { return m_reference; }
+
+private:
+    // the same @n; the lexer reads
+    int readReference()
+    {
+        int end = m_position;
+        int n = 0;
+        while (end < m_string.length() && end - m_position < 9) {
+            ushort digit = m_string.at(end).unicode();
+            if (digit < '0' || digit > '9')
+                break;
+            n = n * 10 + (digit - '0');
+            ++end;
+        }
+        if (end == m_position || end == m_string.length() || m_string.at(end) != ';')
+            return -1;
+        m_position = end + 1;
+        return n;
+    }
+
+    const QString& m_string;
+    int m_position;
+    bool m_sharing;
+    Lexer::Type m_type;
+    int m_reference;
+};
+
+// a UTF-8 program lexed in place
+class Utf8Program {
+public:
+    Utf8Program(const char* data, int length, bool sharing)
+        : m_lexer(data, length)
+        , m_type(Lexer::None)
+        , m_reference(-1) { m_lexer.setSharing(sharing); }
+
+    QString toString() const { return m_lexer.toString(); }
+    bool isEmpty() const { return m_lexer.isEmpty(); }
+    bool atEnd() { return m_lexer.atEnd(); }
+
+    QChar next()
+    {
+        Lexer::Token token = m_lexer.next();
+        m_type = Lexer::Type(token.type);
+        switch (token.type) {
+        case Lexer::Share: return QChar('$');
+        case Lexer::Reference:
+            m_reference = m_lexer.number(token);
+            return QChar('@');
+        default:
+            m_reference = -1;
+            return m_lexer.character(token);
+        }
+    }
+
+    Lexer::Type type() const { return m_type; }
+    int reference() const { return m_reference; }
+
+private:
+    Lexer m_lexer;
+    Lexer::Type m_type;
+    int m_reference;
+};
+
+// a reference to a node that is unknown or still unfinished is a plain @
+static CombinatorPtr sharedNode(const QList<CombinatorPtr>& shared, int n)
 {
-    Verbose::instance()->generateProgramString("hof: " + string);
-    Verbose::instance()->generateProgramString("begin");
+    if (n >= 0 && n < shared.count()) {
+        const CombinatorPtr& node = shared.at(n);
+        if (node->type() != Combinator::a_ || static_cast<A*>(node.data())->isWellFormed())
+            return node;
+    }
+    return CombinatorPtr(new Var('@'));
+}
 
-    if (string.isEmpty()) {
-        Verbose::instance()->generateProgramString("end");
+static void finish(HofContext* context, CombinatorPtr evaluate, const CombinatorPtr& application)
+{
+    while (!evaluate.isNull() && !context->isStopped()) {
+        if (Fix::isKnot(evaluate)) {
+            evaluate = static_cast<Fix*>(evaluate.data())->unroll(context, evaluate);
+            continue;
+        }
+        if (evaluate->type() != Combinator::a_)
+            break;
+        A* a = static_cast<A*>(evaluate.data());
+        if (!a->isWellFormed()) { break; }
+            evaluate = a->apply(context);
+    }
+
+    Verbose* verbose = context->verbose();
+    verbose->generateInputString(application);
+    verbose->generateReturnString(evaluate);
+    verbose->generateProgramEnd();
+}
+
+template <typename Program>
+static void interpret(HofContext* context, Program program)
+{
+    Verbose* verbose = context->verbose();
+    if (verbose->isVerbose())
+        verbose->generateProgramString("hof: " + program.toString());
+    verbose->generateProgramString("begin");
+
+    if (program.isEmpty()) {
+        verbose->generateProgramString("end");
         return;
     }
 
     CombinatorPtr evaluate;
     CombinatorPtr application;
-    for (int x = 0; x < string.length(); x++) {
+    QList<CombinatorPtr> shared;
+    int shares = 0;
+    while (!context->isStopped() && !program.atEnd()) {
         CombinatorPtr term;
-        QChar ch = string.at(x);
-        switch (ch.unicode()) {
-        case 'I': term = i(); break;
-        case 'K': term = k(); break;
-        case 'S': term = s(); break;
-        case 'P': term = p(); break;
-        case 'R': term = r(); break;
-        case 'A': term = CombinatorPtr(new A); break;
-        default: term = CombinatorPtr(new Var(ch)); break;
+        QChar ch = program.next();
+        if (program.type() == Lexer::Share) {
+            ++shares;
+            continue;
         }
 
-        if (application.isNull() && term->type() == Combinator::a_) {
+        if (program.type() == Lexer::Reference) {
+            term = sharedNode(shared, program.reference());
+        } else {
+            switch (ch.unicode()) {
+            case 'I': term = i(); break;
+            case 'K': term = k(); break;
+            case 'S': term = s(); break;
+            case 'P': term = p(); break;
+            case 'R': term = r(); break;
+            case 'A': term = CombinatorPtr(new A); break;
+            default: term = CombinatorPtr(new Var(ch)); break;
+            }
+        }
+
+        // an application is shared as soon as it starts, it is filled in place
+        for (; shares; --shares)
+            shared.append(term);
+
+        if (application.isNull() && ch == 'A') {
             application = term;
             continue;
         }
@@ -51,30 +202,63 @@ void cppInterpreter(const QString& string)
             continue;
         }
 
-        evaluate = eval(evaluate, term);
+        evaluate = eval(context, evaluate, term);
     }
 
-    while (!evaluate.isNull() && evaluate->type() == Combinator::a_) {
-        A* a = static_cast<A*>(evaluate.data());
-        if (!a->isWellFormed()) { break; }
-            evaluate = a->apply();
+    finish(context, evaluate, application);
+}
+
+// evaluates terms that were parsed ahead of time, one after another
+static void interpret(HofContext* context, const QList<CombinatorPtr>& terms)
+{
+    context->verbose()->generateProgramString("begin");
+
+    CombinatorPtr evaluate;
+    foreach (const CombinatorPtr& term, terms) {
+        if (context->isStopped())
+            break;
+        evaluate = evaluate.isNull() ? term : eval(context, evaluate, term);
     }
 
-    Verbose::instance()->generateInputString(application);
-    Verbose::instance()->generateReturnString(evaluate);
-    Verbose::instance()->generateProgramEnd();
+    finish(context, evaluate, CombinatorPtr());
 }
 
 Hof::Hof(QTextStream* outputStream)
+    : m_context(new HofContext)
+    , m_sharing(false)
 {
-    static_cast<P*>(p().data())->setStream(outputStream);
+    m_context->setOutput(outputStream);
 }
 
 Hof::~Hof()
-{ }
+{
+    delete m_context;
+}
 
-void Hof::run(const QString& string)
+HofContext::Status Hof::run(const QString& string)
 {
-    cppInterpreter(string);
+    m_context->reset();
+    interpret(m_context, Utf16Program(string, m_sharing));
+    if (!m_context->isStopped())
+        m_context->stop(HofContext::Finished);
+    return m_context->status();
 }
 
+HofContext::Status Hof::run(const char* data, int length)
+{
+    m_context->reset();
+    interpret(m_context, Utf8Program(data, length, m_sharing));
+    if (!m_context->isStopped())
+        m_context->stop(HofContext::Finished);
+    return m_context->status();
+}
+
+
+HofContext::Status Hof::run(const QList<CombinatorPtr>& terms)
+{
+    m_context->reset();
+    interpret(m_context, terms);
+    if (!m_context->isStopped())
+        m_context->stop(HofContext::Finished);
+    return m_context->status();
+}
@@ -3,12 +3,41 @@
 
 #include <QtCore>
 
+#include "context.h"
+
+class Combinator;
+typedef QSharedPointer<Combinator> CombinatorPtr;
+
+/**
+ * An embeddable Hof engine.  Each instance owns its own HofContext so any
+ * number of engines can run independent programs concurrently as long as a
+ * single engine is only driven from one thread at a time.
+ */
 class Hof {
 public:
     Hof(QTextStream* outputStream);
     ~Hof();
 
-    void run(const QString& string);
+    HofContext* context() const { return m_context; }
+
+    // off by default, when $ and @ are plain symbols rather than the shared
+    // nodes and references of a program written with --share
+    bool sharing() const { return m_sharing; }
+    void setSharing(bool sharing) { m_sharing = sharing; }
+
+    HofContext::Status run(const QString& string);
+
+    // runs a UTF-8 program in place without converting it to a QString,
+    // whitespace between terms is ignored
+    HofContext::Status run(const char* data, int length);
+
+    // runs terms parsed ahead of time, see Parser
+    HofContext::Status run(const QList<CombinatorPtr>& terms);
+
+private:
+    Q_DISABLE_COPY(Hof)
+    HofContext* m_context;
+    bool m_sharing;
 };
 
 #endif // hof_h
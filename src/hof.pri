@@ -1,20 +1,64 @@
 DEPENDPATH += $$PWD
 INCLUDEPATH += $$PWD
 
-HEADERS += $$PWD/cache.h \
+HEADERS += $$PWD/batch.h \
+           $$PWD/cache.h \
+           $$PWD/collector.h \
            $$PWD/colors.h \
            $$PWD/combinators.h \
+           $$PWD/context.h \
+           $$PWD/ffi.h \
+           $$PWD/fiber.h \
+           $$PWD/fixpoints.h \
            $$PWD/verbose.h \
            $$PWD/hof.h \
+           $$PWD/hofffi.h \
+           $$PWD/interactionnet.h \
            $$PWD/lambda.h \
-           $$PWD/ski.h
+           $$PWD/lambdamachine.h \
+           $$PWD/lexer.h \
+           $$PWD/numerals.h \
+           $$PWD/optimizer.h \
+           $$PWD/parser.h \
+           $$PWD/partial.h \
+           $$PWD/random.h \
+           $$PWD/recognizer.h \
+           $$PWD/sampler.h \
+           $$PWD/scheduler.h \
+           $$PWD/server.h \
+           $$PWD/sharing.h \
+           $$PWD/ski.h \
+           $$PWD/speculate.h \
+           $$PWD/statichof.h \
+           $$PWD/threadpool.h
 
-SOURCES += $$PWD/cache.cpp \
+SOURCES += $$PWD/batch.cpp \
+           $$PWD/cache.cpp \
+           $$PWD/collector.cpp \
            $$PWD/colors.cpp \
            $$PWD/combinators.cpp \
+           $$PWD/context.cpp \
+           $$PWD/ffi.cpp \
+           $$PWD/fiber.cpp \
+           $$PWD/fixpoints.cpp \
            $$PWD/verbose.cpp \
            $$PWD/hof.cpp \
+           $$PWD/interactionnet.cpp \
            $$PWD/lambda.cpp \
-           $$PWD/ski.cpp
+           $$PWD/lambdamachine.cpp \
+           $$PWD/lexer.cpp \
+           $$PWD/numerals.cpp \
+           $$PWD/optimizer.cpp \
+           $$PWD/parser.cpp \
+           $$PWD/partial.cpp \
+           $$PWD/random.cpp \
+           $$PWD/recognizer.cpp \
+           $$PWD/sampler.cpp \
+           $$PWD/scheduler.cpp \
+           $$PWD/server.cpp \
+           $$PWD/sharing.cpp \
+           $$PWD/ski.cpp \
+           $$PWD/speculate.cpp \
+           $$PWD/threadpool.cpp
 
 QMAKE_CXXFLAGS +=
@@ -0,0 +1,71 @@
+#ifndef hofffi_h
+#define hofffi_h
+
+/*
+ * The registration interface for native functions called from Hof programs
+ * with --ffi.  Like libhof.h nothing here depends on Qt or C++.
+ *
+ * A library exports hof_ffi_register(), which returns a table of the
+ * functions it defines.  Each function is named by a single character,
+ * which is then a primitive wherever it appears in a hof program or as a
+ * free variable of a lambda program, and takes one argument for each
+ * character of its signature:
+ *
+ *   'i'  strict, the argument is evaluated to a natural number, a Church
+ *        numeral or an integer literal
+ *   'b'  strict, the argument is evaluated to a byte string literal
+ *   't'  lazy, the argument is passed unevaluated and can only be returned
+ */
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#  define HOF_FFI_EXPORT __declspec(dllexport)
+#else
+#  define HOF_FFI_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HOF_FFI_VERSION 1
+
+typedef enum {
+    HOF_FFI_INTEGER = 'i',
+    HOF_FFI_BYTES = 'b',
+    HOF_FFI_TERM = 't'
+} hof_ffi_type;
+
+typedef struct {
+    hof_ffi_type type;
+    long long integer;      /* an integer, or for a term the index of its argument */
+    const char* bytes;
+    size_t length;
+} hof_ffi_value;
+
+/*
+ * Returns 0 and sets result on success.  Argument bytes are valid during the
+ * call and result bytes until the function is called again, hof copies them
+ * as soon as it returns.  A negative integer, a term index out of range or
+ * a non zero return leaves the application as it was written.
+ */
+typedef int (*hof_ffi_function)(const hof_ffi_value* arguments, hof_ffi_value* result, void* user_data);
+
+typedef struct {
+    const char* name;       /* one UTF-8 character, none of A I K P R S $ @ # " */
+    const char* signature;
+    hof_ffi_function function;
+    void* user_data;
+} hof_ffi_definition;
+
+/* the table ends with a null name, or is 0 when version is not supported */
+typedef const hof_ffi_definition* (*hof_ffi_register_function)(int version);
+
+#define HOF_FFI_REGISTER "hof_ffi_register"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* hofffi_h */
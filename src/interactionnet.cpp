@@ -0,0 +1,631 @@
+#include "interactionnet.h"
+
+#include "lambda.h"
+#include "lambdamachine.h"
+#include "threadpool.h"
+
+// rounds with fewer active pairs are rewritten on the calling thread
+static const int s_parallelPairs = 4096;
+static const int s_chunk = 1024;
+
+// bound variables are read back with a name for each depth
+static const ushort s_names = 0xE000;
+
+struct InteractionNet::Scope {
+    Scope(int l = -1) : lambda(l) { }
+    int lambda;
+    QVector<int> uses;  // ports wired to the variable once it is bound
+};
+
+/** A run of active pairs rewritten, or joined, on one thread. */
+class InteractionNet::Round : public QRunnable {
+public:
+    Round(InteractionNet* net, bool isJoin, int begin, int end, const int* offsets, const int* allocated)
+        : m_net(net)
+        , m_isJoin(isJoin)
+        , m_begin(begin)
+        , m_end(end)
+        , m_offsets(offsets)
+        , m_allocated(allocated)
+    {
+        setAutoDelete(false);
+    }
+
+    void run() override
+    {
+        for (int pair = m_begin; pair < m_end; ++pair) {
+            if (m_isJoin)
+                m_net->join(pair, &active);
+            else
+                m_net->rewrite(pair, m_allocated + m_offsets[pair], &stats);
+        }
+    }
+
+    Stats stats;
+    QVector<QPair<int, int> > active;
+
+private:
+    InteractionNet* m_net;
+    bool m_isJoin;
+    int m_begin;
+    int m_end;
+    const int* m_offsets;
+    const int* m_allocated;
+};
+
+static bool isBinary(int kind)
+{
+    return kind >= 3;
+}
+
+InteractionNet::InteractionNet(HofContext* context, int threads)
+    : m_context(context)
+    , m_pool(threads > 1 ? new WorkStealingPool(threads) : 0)
+    , m_root(-1)
+    , m_labels(0)
+    , m_live(0)
+{
+}
+
+InteractionNet::~InteractionNet()
+{
+    delete m_pool;
+}
+
+// the nodes of a pair are passed with the lower kind first
+InteractionNet::Rule InteractionNet::rule(const Node& a, const Node& b)
+{
+    Q_ASSERT(a.kind <= b.kind);
+    if (a.kind == Root)
+        return None;
+    if (a.kind == Eraser)
+        return Erase;
+    if (a.kind == Symbol)
+        return b.kind == Application ? Return : b.kind == Duplicator ? Copy : None;
+    if (b.kind != Duplicator)
+        return a.kind == Lambda && b.kind == Application ? Annihilate : None;
+    return a.kind != Duplicator || a.label != b.label ? Commute : Annihilate;
+}
+
+int InteractionNet::created(Rule rule, const Node& b)
+{
+    switch (rule) {
+    case Erase: return isBinary(b.kind) ? 2 : 0;
+    case Copy: return 2;
+    case Commute: return 4;
+    default: return 0;
+    }
+}
+
+int InteractionNet::node(int kind, int label)
+{
+    int n;
+    if (m_free.isEmpty()) {
+        n = m_nodes.count();
+        m_nodes.append(Node());
+    } else {
+        n = m_free.takeLast();
+    }
+    Node& node = m_nodes[n];
+    node.kind = kind;
+    node.label = label;
+    node.ports[0] = node.ports[1] = node.ports[2] = -1;
+    m_stats.nodes = qMax(m_stats.nodes, ++m_live);
+    return n;
+}
+
+void InteractionNet::link(int a, int b)
+{
+    m_nodes[a / 3].ports[a % 3] = b;
+    m_nodes[b / 3].ports[b % 3] = a;
+    if (a % 3 || b % 3)
+        return;
+
+    int x = a / 3;
+    int y = b / 3;
+    if (m_nodes.at(x).kind > m_nodes.at(y).kind)
+        qSwap(x, y);
+    if (rule(m_nodes.at(x), m_nodes.at(y)) != None)
+        m_active.append(qMakePair(x, y));
+}
+
+bool InteractionNet::load(const LambdaCode& code, int root, QString* error)
+{
+    m_nodes.clear();
+    m_free.clear();
+    m_active.clear();
+    m_labels = 0;
+    m_live = 0;
+    m_stats = Stats();
+
+    m_root = node(Root);
+    return root >= 0 && compile(code, root, error);
+}
+
+// a term to wire to a port, or with lambda set the abstraction whose body is
+// done so its variable can be bound
+struct CompileTask {
+    CompileTask(const LambdaCode* c = 0, int t = -1, int d = -1, int l = -1)
+        : code(c), term(t), destination(d), lambda(l) { }
+    const LambdaCode* code;
+    int term;
+    int destination;
+    int lambda;
+};
+
+// wires the term to the root without recursion, however deep it is
+bool InteractionNet::compile(const LambdaCode& code, int root, QString* error)
+{
+    // the combinators are compiled as the closed abstractions they stand for
+    LambdaCode combinators;
+    int i = combinators.abstraction('x', combinators.variable(0, 'x'));
+    int k = combinators.abstraction('x', combinators.abstraction('y', combinators.variable(1, 'x')));
+    int xz = combinators.application(combinators.variable(2, 'x'), combinators.variable(0, 'z'));
+    int yz = combinators.application(combinators.variable(1, 'y'), combinators.variable(0, 'z'));
+    int s = combinators.abstraction('x', combinators.abstraction('y', combinators.abstraction('z', combinators.application(xz, yz))));
+
+    QVector<Scope> scopes;
+    QVector<CompileTask> tasks;
+    tasks.append(CompileTask(&code, root, m_root * 3));
+    while (!tasks.isEmpty()) {
+        CompileTask task = tasks.takeLast();
+        if (task.lambda >= 0) {
+            Scope scope = scopes.takeLast();
+            bind(&scope, task.lambda * 3 + 1);
+            continue;
+        }
+
+        const LambdaCode::Node& n = task.code->at(task.term);
+        switch (n.kind) {
+        case LambdaCode::Variable:
+            scopes[scopes.count() - 1 - n.index].uses.append(task.destination);
+            break;
+        case LambdaCode::Free:
+            link(node(Symbol, n.name.unicode()) * 3, task.destination);
+            break;
+        case LambdaCode::Abstraction:
+            {
+                int lambda = node(Lambda);
+                link(lambda * 3, task.destination);
+                scopes.append(Scope(lambda));
+                tasks.append(CompileTask(0, -1, -1, lambda));
+                tasks.append(CompileTask(task.code, n.left, lambda * 3 + 2));
+                break;
+            }
+        case LambdaCode::Application:
+            {
+                // the function first, so the uses of a variable keep their order
+                int application = node(Application);
+                link(application * 3 + 2, task.destination);
+                tasks.append(CompileTask(task.code, n.right, application * 3 + 1));
+                tasks.append(CompileTask(task.code, n.left, application * 3));
+                break;
+            }
+        case LambdaCode::Primitive:
+            {
+                // closed, so its variables never reach the scopes around it
+                int combinator = n.index == 'I' ? i : n.index == 'K' ? k : n.index == 'S' ? s : -1;
+                if (combinator < 0) {
+                    if (error)
+                        *error = QString("%1 has no meaning in an interaction net").arg(n.name);
+                    return false;
+                }
+                tasks.append(CompileTask(&combinators, combinator, task.destination));
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+// wires the uses of a variable to it through duplicators with a fresh label
+void InteractionNet::bind(Scope* scope, int variable)
+{
+    if (scope->uses.isEmpty()) {
+        link(variable, node(Eraser) * 3);
+        return;
+    }
+
+    int label = ++m_labels;
+    int source = variable;
+    for (int i = 0; i < scope->uses.count() - 1; ++i) {
+        int duplicator = node(Duplicator, label);
+        link(source, duplicator * 3);
+        link(duplicator * 3 + 1, scope->uses.at(i));
+        source = duplicator * 3 + 2;
+    }
+    link(source, scope->uses.last());
+}
+
+HofContext::Status InteractionNet::reduce()
+{
+    m_context->reset();
+    while (!m_active.isEmpty() && !m_context->isStopped()) {
+        // every pair gets its new nodes up front so the rewrites are independent
+        int pairs = m_active.count();
+        QVector<int> offsets(pairs + 1);
+        offsets[0] = 0;
+        for (int i = 0; i < pairs; ++i) {
+            const Node& a = m_nodes.at(m_active.at(i).first);
+            const Node& b = m_nodes.at(m_active.at(i).second);
+            offsets[i + 1] = offsets.at(i) + created(rule(a, b), b);
+        }
+        QVector<int> allocated(offsets.last());
+        for (int i = 0; i < allocated.count(); ++i)
+            allocated[i] = node(Eraser);
+
+        m_dying.resize(m_nodes.count());
+        m_replacement.resize(m_nodes.count() * 3);
+        m_bridge.resize(m_nodes.count() * 3);
+        for (int i = 0; i < pairs; ++i) {
+            m_dying[m_active.at(i).first] = true;
+            m_dying[m_active.at(i).second] = true;
+        }
+
+        // rewrite every pair, then join the wires between them
+        QList<Round*> rounds;
+        int chunk = m_pool && pairs >= s_parallelPairs ? qMax(s_chunk, pairs / (4 * m_pool->threadCount())) : pairs;
+        for (int isJoin = 0; isJoin < 2; ++isJoin) {
+            qDeleteAll(rounds);
+            rounds.clear();
+            for (int begin = 0; begin < pairs; begin += chunk)
+                rounds.append(new Round(this, isJoin, begin, qMin(pairs, begin + chunk), offsets.constData(), allocated.constData()));
+            if (rounds.count() == 1) {
+                rounds.first()->run();
+            } else {
+                foreach (Round* round, rounds)
+                    m_pool->start(round);
+                m_pool->waitForDone();
+            }
+            if (!isJoin) {
+                foreach (Round* round, rounds) {
+                    m_stats.annihilations += round->stats.annihilations;
+                    m_stats.commutations += round->stats.commutations;
+                    m_stats.erasures += round->stats.erasures;
+                }
+            }
+        }
+
+        for (int i = 0; i < pairs; ++i) {
+            int nodes[2] = { m_active.at(i).first, m_active.at(i).second };
+            for (int j = 0; j < 2; ++j) {
+                m_dying[nodes[j]] = false;
+                m_free.append(nodes[j]);
+            }
+        }
+        m_live -= 2 * pairs;
+
+        m_active.clear();
+        foreach (Round* round, rounds)
+            m_active += round->active;
+        qDeleteAll(rounds);
+
+        ++m_stats.rounds;
+        m_stats.interactions += pairs;
+        m_context->reductions += pairs;
+        if (m_context->reductions >= m_context->nextCheckpoint)
+            m_context->checkpoint();
+    }
+
+    if (!m_context->isStopped())
+        m_context->stop(HofContext::Finished);
+    return m_context->status();
+}
+
+// builds the new nodes of a pair and records what stands in for its ports,
+// touching nothing outside the pair but the nodes allocated to it
+void InteractionNet::rewrite(int pair, const int* allocated, Stats* stats)
+{
+    int a = m_active.at(pair).first;
+    int b = m_active.at(pair).second;
+    Node* nodes = m_nodes.data();
+    int* replacement = m_replacement.data();
+    int* bridge = m_bridge.data();
+    for (int slot = 1; slot < 3; ++slot) {
+        replacement[a * 3 + slot] = replacement[b * 3 + slot] = -1;
+        bridge[a * 3 + slot] = bridge[b * 3 + slot] = -1;
+    }
+
+    const Node& x = nodes[a];
+    const Node& y = nodes[b];
+    switch (rule(x, y)) {
+    case None:
+        Q_ASSERT(false);
+        break;
+    case Annihilate:
+        for (int slot = 1; slot < 3; ++slot) {
+            bridge[a * 3 + slot] = b * 3 + slot;
+            bridge[b * 3 + slot] = a * 3 + slot;
+        }
+        ++stats->annihilations;
+        break;
+    case Return:
+        bridge[b * 3 + 1] = b * 3 + 2;
+        bridge[b * 3 + 2] = b * 3 + 1;
+        ++stats->annihilations;
+        break;
+    case Erase:
+    case Copy:
+        for (int slot = 1; slot < 3 && isBinary(y.kind); ++slot) {
+            Node& copy = nodes[allocated[slot - 1]];
+            copy.kind = x.kind;
+            copy.label = x.label;
+            copy.ports[0] = copy.ports[1] = copy.ports[2] = -1;
+            replacement[b * 3 + slot] = allocated[slot - 1] * 3;
+        }
+        if (x.kind == Eraser)
+            ++stats->erasures;
+        else
+            ++stats->commutations;
+        break;
+    case Commute:
+        {
+            // copies of each node take the place of the other's ports
+            const int xs[2] = { allocated[0], allocated[1] };
+            const int ys[2] = { allocated[2], allocated[3] };
+            for (int i = 0; i < 2; ++i) {
+                nodes[xs[i]].kind = x.kind;
+                nodes[xs[i]].label = x.label;
+                nodes[xs[i]].ports[0] = -1;
+                nodes[ys[i]].kind = y.kind;
+                nodes[ys[i]].label = y.label;
+                nodes[ys[i]].ports[0] = -1;
+                replacement[b * 3 + 1 + i] = xs[i] * 3;
+                replacement[a * 3 + 1 + i] = ys[i] * 3;
+            }
+            for (int i = 0; i < 2; ++i) {
+                for (int j = 0; j < 2; ++j) {
+                    nodes[ys[i]].ports[1 + j] = xs[j] * 3 + 1 + i;
+                    nodes[xs[j]].ports[1 + i] = ys[i] * 3 + 1 + j;
+                }
+            }
+            ++stats->commutations;
+            break;
+        }
+    }
+}
+
+// where a wire leaving a dying port ends up, past annihilated pairs
+int InteractionNet::outward(int port) const
+{
+    int next = m_nodes.at(port / 3).ports[port % 3];
+    return isDying(next) ? inward(next) : next;
+}
+
+// where a wire entering a dying port ends up
+int InteractionNet::inward(int port) const
+{
+    forever {
+        int replacement = m_replacement.at(port);
+        if (replacement >= 0)
+            return replacement;
+        int through = m_bridge.at(port);
+        int next = m_nodes.at(through / 3).ports[through % 3];
+        if (!isDying(next))
+            return next;
+        port = next;
+    }
+}
+
+// rewires both ends of each wire that met the pair, every port is written
+// by exactly one pair since dying ports are only ever read
+void InteractionNet::join(int pair, QVector<QPair<int, int> >* active)
+{
+    Node* nodes = m_nodes.data();
+    const int ends[2] = { m_active.at(pair).first, m_active.at(pair).second };
+    for (int e = 0; e < 2; ++e) {
+        if (!isBinary(nodes[ends[e]].kind))
+            continue;
+        for (int slot = 1; slot < 3; ++slot) {
+            int port = ends[e] * 3 + slot;
+            int from[2] = { -1, -1 };
+            int to[2] = { -1, -1 };
+            int replacement = m_replacement.at(port);
+            if (replacement >= 0) {
+                from[0] = replacement;
+                to[0] = outward(port);
+            }
+            int outside = nodes[ends[e]].ports[slot];
+            if (!isDying(outside)) {
+                from[1] = outside;
+                to[1] = inward(port);
+            }
+
+            for (int i = 0; i < 2; ++i) {
+                if (from[i] < 0)
+                    continue;
+                nodes[from[i] / 3].ports[from[i] % 3] = to[i];
+                if (from[i] % 3 || to[i] % 3 || from[i] > to[i])
+                    continue;
+                int x = from[i] / 3;
+                int y = to[i] / 3;
+                if (nodes[x].kind > nodes[y].kind)
+                    qSwap(x, y);
+                if (rule(nodes[x], nodes[y]) != None)
+                    active->append(qMakePair(x, y));
+            }
+        }
+    }
+}
+
+QString InteractionNet::toLambda(bool* ok) const
+{
+    bool readable = true;
+    QString lambda = m_root < 0 ? QString() : readBack(m_nodes.at(m_root).ports[0], &readable);
+    if (ok)
+        *ok = readable;
+    return lambda;
+}
+
+QString InteractionNet::toHof(bool* ok) const
+{
+    bool readable = true;
+    QString lambda = toLambda(&readable);
+    bool translated = true;
+    QString hof = Lambda::fromLambda(lambda, &translated);
+    if (ok)
+        *ok = readable && translated;
+    return translated ? hof : QString();
+}
+
+// a step of reading back: follow a wire, write a character, or undo what
+// entering a lambda or a duplicator did once everything under it is read
+struct ReadBackStep {
+    enum Kind { Follow, Write, Unbind, PopFan, PushFan };
+    ReadBackStep(Kind k = Follow, int p = 0, QChar c = QChar())
+        : kind(k), port(p), ch(c) { }
+    Kind kind;
+    int port;       // or the label of a fan, with the copy in ch
+    QChar ch;
+};
+
+// follows the wire into port, each duplicator entered from a copy remembers
+// which so the matching one entered from its principal port leaves by it;
+// without recursion, writing the term left to right as it goes
+QString InteractionNet::readBack(int port, bool* ok) const
+{
+    // a term that reads back never has more copies entered and not yet left
+    // than the net has duplicators, a net whose duplications overlap can go
+    // round them forever
+    int duplicators = 0;
+    foreach (const Node& node, m_nodes)
+        duplicators += node.kind == Duplicator;
+
+    QString text;
+    QHash<int, QVector<int> > fans;
+    QVector<int> binders;
+    int entered = 0;
+    QVector<ReadBackStep> steps;
+    steps.append(ReadBackStep(ReadBackStep::Follow, port));
+    while (!steps.isEmpty()) {
+        ReadBackStep step = steps.takeLast();
+        switch (step.kind) {
+        case ReadBackStep::Write:
+            text.append(step.ch);
+            continue;
+        case ReadBackStep::Unbind:
+            binders.removeLast();
+            continue;
+        case ReadBackStep::PopFan:
+            fans[step.port].removeLast();
+            --entered;
+            continue;
+        case ReadBackStep::PushFan:
+            fans[step.port].append(step.ch.unicode());
+            ++entered;
+            continue;
+        case ReadBackStep::Follow:
+            break;
+        }
+
+        int n = step.port / 3;
+        int slot = step.port % 3;
+        const Node& node = m_nodes.at(n);
+        switch (node.kind) {
+        case Symbol:
+            text.append(QChar(ushort(node.label)));
+            continue;
+        case Lambda:
+            if (slot == 0) {
+                QChar name(ushort(s_names + binders.count()));
+                binders.append(n);
+                text.append("(" + QString(QChar(0x03BB)) + name + ".");
+                steps.append(ReadBackStep(ReadBackStep::Write, 0, ')'));
+                steps.append(ReadBackStep(ReadBackStep::Unbind));
+                steps.append(ReadBackStep(ReadBackStep::Follow, node.ports[2]));
+                continue;
+            }
+            if (slot == 1 && binders.lastIndexOf(n) >= 0) {
+                text.append(QChar(ushort(s_names + binders.lastIndexOf(n))));
+                continue;
+            }
+            break;
+        case Application:
+            if (slot == 2) {
+                text.append('(');
+                steps.append(ReadBackStep(ReadBackStep::Write, 0, ')'));
+                steps.append(ReadBackStep(ReadBackStep::Follow, node.ports[1]));
+                steps.append(ReadBackStep(ReadBackStep::Write, 0, ' '));
+                steps.append(ReadBackStep(ReadBackStep::Follow, node.ports[0]));
+                continue;
+            }
+            break;
+        case Duplicator:
+            if (slot && entered < duplicators) {
+                fans[node.label].append(slot);
+                ++entered;
+                steps.append(ReadBackStep(ReadBackStep::PopFan, node.label));
+                steps.append(ReadBackStep(ReadBackStep::Follow, node.ports[0]));
+                continue;
+            }
+            if (!slot && !fans[node.label].isEmpty()) {
+                int copy = fans[node.label].takeLast();
+                --entered;
+                steps.append(ReadBackStep(ReadBackStep::PushFan, node.label, QChar(ushort(copy))));
+                steps.append(ReadBackStep(ReadBackStep::Follow, node.ports[copy]));
+                continue;
+            }
+            break;
+        }
+
+        // a stuck or malformed part of the net, or one that can not be read
+        text.append('?');
+        if (ok)
+            *ok = false;
+    }
+    return text;
+}
+
+qint64 InteractionNet::numeral() const
+{
+    if (m_root < 0)
+        return -1;
+
+    // passes through duplicators like readBack, without recursion
+    struct Walk {
+        static int through(const QVector<Node>& nodes, int port, QHash<int, QVector<int> >* fans)
+        {
+            while (port >= 0 && nodes.at(port / 3).kind == Duplicator) {
+                const Node& node = nodes.at(port / 3);
+                QVector<int>& stack = (*fans)[node.label];
+                if (port % 3) {
+                    stack.append(port % 3);
+                    port = node.ports[0];
+                } else if (stack.isEmpty()) {
+                    return -1;
+                } else {
+                    port = node.ports[stack.takeLast()];
+                }
+            }
+            return port;
+        }
+    };
+
+    QHash<int, QVector<int> > fans;
+    int binders[2];
+    int port = m_nodes.at(m_root).ports[0];
+    for (int i = 0; i < 2; ++i) {
+        port = Walk::through(m_nodes, port, &fans);
+        if (port < 0 || port % 3 || m_nodes.at(port / 3).kind != Lambda)
+            return -1;
+        binders[i] = port / 3;
+        port = m_nodes.at(binders[i]).ports[2];
+    }
+
+    for (qint64 n = 0; ; ++n) {
+        port = Walk::through(m_nodes, port, &fans);
+        if (port < 0)
+            return -1;
+        const Node& node = m_nodes.at(port / 3);
+        if (node.kind == Lambda && port % 3 == 1)
+            return port / 3 == binders[1] ? n : -1;
+        if (node.kind != Application || port % 3 != 2)
+            return -1;
+
+        QHash<int, QVector<int> > copy = fans;
+        int function = Walk::through(m_nodes, node.ports[0], &copy);
+        if (function != binders[0] * 3 + 1)
+            return -1;
+        port = node.ports[1];
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef interactionnet_h
+#define interactionnet_h
+
+#include <QtCore>
+
+#include "context.h"
+
+class LambdaCode;
+class WorkStealingPool;
+
+/**
+ * An experimental engine that compiles a lambda or SKI term into an
+ * interaction net and reduces it to normal form by Lamping's abstract
+ * algorithm, so work done under a shared abstraction is never repeated.
+ *
+ * Abstractions and applications are binary nodes, each variable used more
+ * than once is copied by a tree of duplicators labelled for its binder, and
+ * an unused one is erased.  Duplicators with the same label annihilate and
+ * otherwise commute, there are no brackets or croissants, so terms whose
+ * duplications overlap, such as self application, may not read back: the
+ * read back then passes more duplicators than the net has and gives up.
+ * Church numeral arithmetic reduces and reads back correctly.
+ *
+ * The active pairs of a round never share a node, so they are rewritten
+ * side by side across the threads and the wires between them are joined
+ * afterwards, also in parallel, following the annihilated pairs in between.
+ */
+class InteractionNet {
+public:
+    struct Stats {
+        Stats() : interactions(0), annihilations(0), commutations(0), erasures(0), rounds(0), nodes(0) { }
+        qint64 interactions;
+        qint64 annihilations;   // beta reductions and matching duplicators
+        qint64 commutations;    // copies made by duplicators
+        qint64 erasures;
+        qint64 rounds;          // sets of active pairs rewritten together
+        int nodes;              // largest net
+    };
+
+    InteractionNet(HofContext* context, int threads = 1);
+    ~InteractionNet();
+
+    // P and R have no meaning in a net and fail to load
+    bool load(const LambdaCode& code, int root, QString* error = 0);
+
+    HofContext::Status reduce();
+
+    // the net read back as a term, once reduced it is the normal form; ok is
+    // false when part of it could not be read back, which shows as ?
+    QString toLambda(bool* ok = 0) const;
+    QString toHof(bool* ok = 0) const;
+
+    // n for the Church numeral \f.\x.f (f ... x), otherwise -1
+    qint64 numeral() const;
+
+    Stats stats() const { return m_stats; }
+
+private:
+    enum Kind {
+        Root,
+        Eraser,
+        Symbol,         // a free variable, the label is its name
+        Lambda,         // 1 is the variable and 2 the body
+        Application,    // 1 is the argument and 2 the result
+        Duplicator      // 1 and 2 are the copies
+    };
+
+    enum Rule {
+        None,
+        Annihilate,
+        Commute,
+        Erase,
+        Copy,           // a symbol through a duplicator
+        Return          // a symbol applied returns its argument
+    };
+
+    struct Node {
+        int kind;
+        int label;
+        int ports[3];   // the port each of its ports is wired to
+    };
+
+    struct Scope;
+    class Round;
+    friend class Round;
+    Q_DISABLE_COPY(InteractionNet)
+
+    static Rule rule(const Node& a, const Node& b);
+    static int created(Rule rule, const Node& b);
+
+    int node(int kind, int label = 0);
+    void link(int a, int b);
+    bool compile(const LambdaCode& code, int root, QString* error);
+    void bind(Scope* scope, int variable);
+
+    void rewrite(int pair, const int* allocated, Stats* stats);
+    void join(int pair, QVector<QPair<int, int> >* active);
+    int outward(int port) const;
+    int inward(int port) const;
+    bool isDying(int port) const { return m_dying.at(port / 3); }
+
+    QString readBack(int port, bool* ok) const;
+
+    HofContext* m_context;
+    WorkStealingPool* m_pool;
+    QVector<Node> m_nodes;
+    QVector<int> m_free;
+    QVector<QPair<int, int> > m_active;
+    QVector<char> m_dying;
+    QVector<int> m_replacement;     // the new port standing in for a dying one
+    QVector<int> m_bridge;          // or the dying port it is wired through to
+    int m_root;
+    int m_labels;
+    int m_live;
+    Stats m_stats;
+};
+
+#endif // interactionnet_h
@@ -1,51 +1,13 @@
 #include "lambda.h"
+#include "lambdamachine.h"
+#include "lexer.h"
 #include "ski.h"
 #include "verbose.h"
 
 #define LAMBDA 0x03BB
 #define DOT 0x002E
 
-class Token {
-public:
-    enum Type {
-        None,
-        Lambda,
-        Dot,
-        Variable,
-        LParen,
-        RParen,
-        Sub
-    };
-
-    static QString typeToString(Type type)
-    {
-        switch (type) {
-        case None: return QStringLiteral("None");
-        case Lambda: return QStringLiteral("Lambda");
-        case Dot: return QStringLiteral("Dot");
-        case Variable: return QStringLiteral("Variable");
-        case LParen: return QStringLiteral("LParen");
-        case RParen: return QStringLiteral("RParen");
-        case Sub: return QStringLiteral("Sub");
-        default: return QString();
-        }
-    }
-
-    Token() : m_type(None) { }
-    Token(Type t, const QString s) : m_type(t), m_token(s) { }
-
-    Type type() const { return m_type; }
-    QString token() const { return m_token; }
-    QString toString() const
-    {
-        QString r = typeToString(m_type);
-        return r + ": '" + (m_token.isEmpty() ? QString("\\0") : m_token) + "'";
-    }
-
-private:
-    Type m_type;
-    QString m_token;
-};
+typedef Lexer::Token Token;
 
 struct LambdaTerm {
     enum Type { Variable, Abstraction, Application, Ski, Sub };
@@ -56,6 +18,9 @@ struct LambdaTerm {
     // Implemented with the transformation rules found here:
     // https://en.wikipedia.org/wiki/Combinatory_logic#Completeness_of_the_S-K_basis
     virtual LambdaTerm* toSki() = 0;
+
+    // compiles the term for the LambdaMachine with the names bound around it
+    virtual int toCode(LambdaCode* code, QStringList* scope) const = 0;
 };
 
 struct Substitution : LambdaTerm {
@@ -64,6 +29,7 @@ struct Substitution : LambdaTerm {
     virtual Type type() const { return Sub; }
     virtual QString toString() const  { return "{" + sub + "}"; }
     virtual LambdaTerm* toSki() { return this; }
+    virtual int toCode(LambdaCode* code, QStringList*) const { return code->hof(sub); }
 };
 
 struct LambdaCombinator : LambdaTerm {
@@ -72,16 +38,17 @@ struct LambdaCombinator : LambdaTerm {
     virtual Type type() const { return Ski; }
     virtual QString toString() const  { return ski; }
     virtual LambdaTerm* toSki() { return this; }
+    virtual int toCode(LambdaCode* code, QStringList*) const { return code->hof(ski); }
 };
 
 struct LambdaVariable : LambdaTerm {
-    Token token;
+    QString name;
 
     virtual Type type() const { return Variable; }
 
     virtual QString toString() const
     {
-        return token.token();
+        return name;
     }
 
     virtual LambdaTerm* toSki()
@@ -89,6 +56,14 @@ struct LambdaVariable : LambdaTerm {
         // rule #1
         return this;
     }
+
+    virtual int toCode(LambdaCode* code, QStringList* scope) const
+    {
+        int index = scope->lastIndexOf(name);
+        if (index < 0)
+            return code->free(name.at(0));
+        return code->variable(scope->count() - 1 - index, name.at(0));
+    }
 };
 
 struct LambdaApplication : LambdaTerm {
@@ -123,6 +98,13 @@ struct LambdaApplication : LambdaTerm {
         right = right->toSki();
         return this;
     }
+
+    virtual int toCode(LambdaCode* code, QStringList* scope) const
+    {
+        int l = left->toCode(code, scope);
+        int r = right->toCode(code, scope);
+        return l < 0 || r < 0 ? -1 : code->application(l, r);
+    }
 };
 
 struct LambdaAbstraction : LambdaTerm {
@@ -155,6 +137,14 @@ struct LambdaAbstraction : LambdaTerm {
         return QString(LAMBDA) + variable->toString() + QString(DOT) + body->toString();
     }
 
+    virtual int toCode(LambdaCode* code, QStringList* scope) const
+    {
+        scope->append(variable->name);
+        int b = body->toCode(code, scope);
+        scope->removeLast();
+        return b < 0 ? -1 : code->abstraction(variable->name.at(0), b);
+    }
+
     virtual LambdaTerm* toSki()
     {
         // η-reduction
@@ -190,7 +180,7 @@ struct LambdaAbstraction : LambdaTerm {
 
             LambdaAbstraction* leftA = new LambdaAbstraction;
             leftA->variable = new LambdaVariable;
-            leftA->variable->token = variable->token;
+            leftA->variable->name = variable->name;
             leftA->body = a->left;
 
             LambdaApplication* leftApp = new LambdaApplication;
@@ -199,7 +189,7 @@ struct LambdaAbstraction : LambdaTerm {
 
             LambdaAbstraction* rightA = new LambdaAbstraction;
             rightA->variable = new LambdaVariable;
-            rightA->variable->token = variable->token;
+            rightA->variable->name = variable->name;
             rightA->body = a->right;
 
             a->left = leftApp;
@@ -214,8 +204,9 @@ struct LambdaAbstraction : LambdaTerm {
 
 class LambdaParser {
 public:
-    LambdaParser(const QList<Token>& tokens)
-        : m_tokens(tokens)
+    LambdaParser(const Lexer& lexer)
+        : m_lexer(lexer)
+        , m_tokens(Lexer::tokenize(lexer.data(), lexer.length(), Lexer::LambdaSyntax))
         , m_index(-1) { }
     ~LambdaParser() { qDeleteAll(m_terms); }
 
@@ -227,7 +218,7 @@ private:
     Token current() const;
     Token advance(int i);
     Token look(int i) const;
-    bool expect(Token tok, Token::Type type);
+    bool expect(Token tok, Lexer::Type type);
 
     LambdaTerm* parseLambdaTermOrApplication();
     LambdaTerm* parseLambdaTerm();
@@ -235,14 +226,22 @@ private:
     LambdaAbstraction* parseLambdaAbstraction();
     LambdaApplication* parseLambdaApplication();
 
-    void error(Token::Type type = Token::None);
+    void error(Lexer::Type type = Lexer::None);
 
     QStringList m_errors;
     QList<LambdaTerm*> m_terms;
-    QList<Token> m_tokens;
+    Lexer m_lexer;
+    Lexer::Tokens m_tokens;
     int m_index;
 };
 
+static QString withoutWhitespace(const QString& string)
+{
+    QString program = string.simplified();
+    program.replace(" ", "");
+    return program;
+}
+
 QString makeSubstitutions(const QString& string)
 {
     QStringList programLines;
@@ -278,54 +277,36 @@ QString makeSubstitutions(const QString& string)
     return programLines.join("\n");
 }
 
-QString Lambda::fromLambda(const QString& string, bool* ok)
+QString Lambda::fromLambda(const QString& string, bool* ok, Verbose* verbose)
 {
-    // Remove all whitespace
-    QString program = makeSubstitutions(string);
-    program = program.simplified();
-    program.replace("\n", "");
-    program.replace(" ", "");
+    QByteArray utf8 = string.toUtf8();
+    return fromLambda(utf8.constData(), utf8.size(), ok, verbose);
+}
 
-    bool isSub = false;
-    QString sub = QString();
-
-    Verbose::instance()->generateProgramString("lambda: " + program);
-
-    // Lexer
-    QList<Token> tokens;
-    for (int x = 0; x < program.length(); x++) {
-        QChar ch = program.at(x);
-        Token::Type t;
-        switch (ch.unicode()) {
-        case LAMBDA: t = Token::Lambda; break;
-        case DOT: t = Token::Dot; break;
-        case '(': t = Token::LParen; break;
-        case ')': t = Token::RParen; break;
-        case '{': isSub = true; continue;
-        case '}':
-          {
-              tokens.append(Token(Token::Sub, sub));
-              isSub = false;
-              sub = QString();
-              continue;
-          }
-        default: t = Token::Variable; break;
-        };
-
-        if (isSub)
-            sub.append(ch);
-        else
-            tokens.append(Token(t, ch));
+QString Lambda::fromLambda(const char* data, int length, bool* ok, Verbose* verbose)
+{
+    // Definitions are rare enough to be worth a round trip through QString
+    QByteArray substituted;
+    if (memchr(data, '=', size_t(length))) {
+        substituted = makeSubstitutions(QString::fromUtf8(data, length)).toUtf8();
+        data = substituted.constData();
+        length = substituted.size();
     }
 
-    LambdaParser parser(tokens);
+    // Whitespace is skipped by the lexer
+    Lexer lexer(data, length, Lexer::LambdaSyntax);
+
+    if (verbose && verbose->isVerbose())
+        verbose->generateProgramString("lambda: " + withoutWhitespace(lexer.toString()));
+
+    LambdaParser parser(lexer);
     parser.parse();
 
     QStringList errors = parser.errors();
     if (ok)
         *ok = errors.isEmpty();
     if (!errors.isEmpty()) {
-        QString error = "Found errors while parsing: " + program + "\n";
+        QString error = "Found errors while parsing: " + withoutWhitespace(lexer.toString()) + "\n";
         return error + errors.join("\n");
     }
 
@@ -337,11 +318,48 @@ QString Lambda::fromLambda(const QString& string, bool* ok)
         ski.append(term->toSki()->toString());
     }
 
-    Verbose::instance()->generateProgramString("parsed: " + parsed);
+    if (verbose)
+        verbose->generateProgramString("parsed: " + parsed);
 
-    ski = ski.simplified();
-    ski.replace(" ", "");
-    return Ski::fromSki(ski, ok);
+    QByteArray utf8 = ski.toUtf8();
+    return Ski::fromSki(utf8.constData(), utf8.size(), ok, verbose);
+}
+
+int Lambda::toCode(const char* data, int length, LambdaCode* code, QString* error)
+{
+    QByteArray substituted;
+    if (memchr(data, '=', size_t(length))) {
+        substituted = makeSubstitutions(QString::fromUtf8(data, length)).toUtf8();
+        data = substituted.constData();
+        length = substituted.size();
+    }
+
+    Lexer lexer(data, length, Lexer::LambdaSyntax);
+    LambdaParser parser(lexer);
+    parser.parse();
+
+    QStringList errors = parser.errors();
+    if (!errors.isEmpty()) {
+        if (error)
+            *error = "Found errors while parsing: " + withoutWhitespace(lexer.toString()) + "\n" + errors.join("\n");
+        return -1;
+    }
+
+    // the terms are applied to each other like the terms of a hof program
+    int root = -1;
+    foreach (LambdaTerm* term, parser.terms()) {
+        QStringList scope;
+        int compiled = term->toCode(code, &scope);
+        if (compiled < 0) {
+            if (error)
+                *error = "Found unfinished hof in: " + term->toString();
+            return -1;
+        }
+        root = root < 0 ? compiled : code->application(root, compiled);
+    }
+    if (root < 0 && error)
+        *error = "Found no terms in: " + withoutWhitespace(lexer.toString());
+    return root;
 }
 
 void LambdaParser::parse()
@@ -359,7 +377,7 @@ void LambdaParser::parse()
 
 Token LambdaParser::current() const
 {
-    if (m_index >= m_tokens.count())
+    if (m_index < 0 || m_index >= m_tokens.count())
         return Token();
     return m_tokens.at(m_index);
 }
@@ -378,9 +396,9 @@ Token LambdaParser::look(int i) const
     return m_tokens.at(index);
 }
 
-bool LambdaParser::expect(Token token, Token::Type type)
+bool LambdaParser::expect(Token token, Lexer::Type type)
 {
-    if (token.type() == type)
+    if (token.type == type)
         return true;
 
     error(type);
@@ -394,9 +412,9 @@ LambdaTerm* LambdaParser::parseLambdaTermOrApplication()
         return 0;
 
     Token ahead = look(1);
-    while (ahead.type() == Token::Variable ||
-           ahead.type() == Token::Lambda ||
-           ahead.type() == Token::LParen) {
+    while (ahead.type == Lexer::Symbol ||
+           ahead.type == Lexer::Lambda ||
+           ahead.type == Lexer::LParen) {
 
         advance(1);
         LambdaTerm* right = parseLambdaTerm();
@@ -414,21 +432,24 @@ LambdaTerm* LambdaParser::parseLambdaTermOrApplication()
 
 LambdaTerm* LambdaParser::parseLambdaTerm()
 {
-    switch (current().type()) {
-    case Token::Variable: return parseLambdaVariable();
-    case Token::Lambda: return parseLambdaAbstraction();
-    case Token::LParen:
+    switch (current().type) {
+    case Lexer::Symbol: return parseLambdaVariable();
+    case Lexer::Lambda: return parseLambdaAbstraction();
+    case Lexer::LParen:
         {
             advance(1);
             LambdaTerm* term = parseLambdaTermOrApplication();
             Token token = advance(1);
-            if (!expect(token, Token::RParen)) {
+            if (!expect(token, Lexer::RParen)) {
                 delete term;
                 return 0;
             }
             return term;
         }
-    case Token::Sub: return new Substitution(current().token());
+    case Lexer::Sub: return new Substitution(m_lexer.text(current()));
+    case Lexer::Overflow:
+        m_errors.append(QString("Substitution longer than %1 bytes at index: %2").arg(int(Lexer::MaximumLength)).arg(m_index));
+        break;
     default: error(); break;
     }
 
@@ -438,11 +459,11 @@ LambdaTerm* LambdaParser::parseLambdaTerm()
 LambdaVariable* LambdaParser::parseLambdaVariable()
 {
     Token token = current();
-    if (!expect(token, Token::Variable))
+    if (!expect(token, Lexer::Symbol))
         return 0;
 
     LambdaVariable* v = new LambdaVariable;
-    v->token = token;
+    v->name = m_lexer.text(token);
     return v;
 }
 
@@ -455,7 +476,7 @@ LambdaAbstraction* LambdaParser::parseLambdaAbstraction()
         return 0;
 
     Token dot = advance(1);
-    if (!expect(dot, Token::Dot))
+    if (!expect(dot, Lexer::Dot))
         return 0;
 
     advance(1);
@@ -469,16 +490,16 @@ LambdaAbstraction* LambdaParser::parseLambdaAbstraction()
     return a;
 }
 
-void LambdaParser::error(Token::Type expected)
+void LambdaParser::error(Lexer::Type expected)
 {
-    if (expected != Token::None) {
+    if (expected != Lexer::None) {
         m_errors.append(QString("Expected: {%1}, found: {%2} at index: %3")
-                      .arg(Token::typeToString(expected))
-                      .arg(current().toString())
+                      .arg(Lexer::typeToString(expected))
+                      .arg(m_lexer.toString(current()))
                       .arg(m_index));
     } else {
         m_errors.append(QString("Unexpected token: {%1} at index: %2")
-                        .arg(current().toString())
+                        .arg(m_lexer.toString(current()))
                         .arg(m_index));
     }
 }
@@ -3,6 +3,9 @@
 
 #include <QtCore>
 
+class LambdaCode;
+class Verbose;
+
 class Lambda {
 public:
     /**
@@ -27,7 +30,14 @@ public:
      * Variables are restricted to single characters. Parenthesis is not
      * strictly required for lambda application.  Whitespace is ignored.
      */
-    static QString fromLambda(const QString& lambda, bool* ok = 0);
+    static QString fromLambda(const QString& lambda, bool* ok = 0, Verbose* verbose = 0);
+
+    // lexes a UTF-8 program in place, 'λ' is its two byte sequence
+    static QString fromLambda(const char* data, int length, bool* ok = 0, Verbose* verbose = 0);
+
+    // compiles a UTF-8 program for the LambdaMachine instead of translating
+    // it, returns the root of the program in code or -1 with an error
+    static int toCode(const char* data, int length, LambdaCode* code, QString* error = 0);
 };
 
 #endif // lambda_h
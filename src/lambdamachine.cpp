@@ -0,0 +1,433 @@
+#include "lambdamachine.h"
+
+#include "combinators.h"
+#include "lambda.h"
+#include "parser.h"
+#include "random.h"
+
+struct LambdaMachine::Thunk {
+    enum State {
+        Suspended,      // code in an environment
+        Applied,        // function applied to argument, made by S
+        Closure,        // an abstraction in its environment
+        Partial         // a combinator or symbol short of arguments
+    };
+
+    Thunk(State s) : state(s), code(-1), symbol(0) { }
+
+    bool isValue() const { return state == Closure || state == Partial; }
+
+    void become(const Thunk& value)
+    {
+        state = value.state;
+        code = value.code;
+        environment = value.environment;
+        symbol = value.symbol;
+        name = value.name;
+        arguments = value.arguments;
+        function.clear();
+        argument.clear();
+    }
+
+    State state;
+    int code;
+    EnvironmentPtr environment;
+    ThunkPtr function;
+    ThunkPtr argument;
+    int symbol;                     // the combinator, or zero for a symbol
+    QChar name;
+    QVector<ThunkPtr> arguments;
+};
+
+struct LambdaMachine::Environment {
+    Environment(const ThunkPtr& t, const EnvironmentPtr& n) : thunk(t), next(n) { }
+    ThunkPtr thunk;
+    EnvironmentPtr next;
+};
+
+// a symbol takes one argument and returns it, just like hof's Var
+static int arity(int symbol)
+{
+    switch (symbol) {
+    case 'K': return 2;
+    case 'S': return 3;
+    case 'R': return 2;
+    default: return 1;
+    }
+}
+
+int LambdaCode::append(Kind kind, int index, QChar name, int left, int right)
+{
+    Node node;
+    node.kind = kind;
+    node.index = index;
+    node.name = name;
+    node.left = left;
+    node.right = right;
+    m_nodes.append(node);
+    return m_nodes.count() - 1;
+}
+
+int LambdaCode::hof(const QString& text)
+{
+    QByteArray utf8 = text.toUtf8();
+    Parser parser(1);
+    QList<CombinatorPtr> terms = parser.parse(utf8.constData(), utf8.size());
+    if (parser.stats().incomplete || terms.isEmpty())
+        return -1;
+
+    int root = -1;
+    foreach (const CombinatorPtr& term, terms) {
+        // post order without recursion, shared nodes are compiled again
+        QVector<QPair<const Combinator*, bool> > stack;
+        QVector<int> nodes;
+        stack.append(qMakePair<const Combinator*, bool>(term.data(), false));
+        while (!stack.isEmpty()) {
+            QPair<const Combinator*, bool> frame = stack.takeLast();
+            const Combinator* t = frame.first;
+            if (t->type() == Combinator::a_ && !frame.second) {
+                const A* a = static_cast<const A*>(t);
+                stack.append(qMakePair(t, true));
+                stack.append(qMakePair<const Combinator*, bool>(a->right.data(), false));
+                stack.append(qMakePair<const Combinator*, bool>(a->left.data(), false));
+            } else if (t->type() == Combinator::a_) {
+                int right = nodes.takeLast();
+                int left = nodes.takeLast();
+                nodes.append(application(left, right));
+            } else if (t->type() == Combinator::var_) {
+                nodes.append(free(static_cast<const Var*>(t)->ch));
+            } else {
+                nodes.append(primitive(t->toString().at(0).toLatin1()));
+            }
+        }
+        root = root < 0 ? nodes.last() : application(root, nodes.last());
+    }
+    return root;
+}
+
+LambdaMachine::LambdaMachine(HofContext* context)
+    : m_context(context)
+    , m_main(-1)
+{
+}
+
+LambdaMachine::~LambdaMachine()
+{
+}
+
+bool LambdaMachine::load(const char* data, int length, const QByteArray& input, QString* error)
+{
+    m_code = LambdaCode();
+    m_main = Lambda::toCode(data, length, &m_code, error);
+    if (m_main < 0)
+        return false;
+
+    if (!input.trimmed().isEmpty()) {
+        int applied = m_code.hof(QString::fromUtf8(input));
+        if (applied < 0) {
+            if (error)
+                *error = "Found errors while parsing input: " + QString::fromUtf8(input);
+            return false;
+        }
+        m_main = m_code.application(m_main, applied);
+    }
+
+    // symbols and combinators without arguments are shared by every use
+    m_constants.fill(ThunkPtr(), m_code.count());
+    for (int code = 0; code < m_code.count(); ++code) {
+        const LambdaCode::Node& node = m_code.at(code);
+        if (node.kind != LambdaCode::Free && node.kind != LambdaCode::Primitive)
+            continue;
+        ThunkPtr constant(new Thunk(Thunk::Partial));
+        constant->symbol = node.kind == LambdaCode::Primitive ? node.index : 0;
+        constant->name = node.name;
+        m_constants[code] = constant;
+    }
+    return true;
+}
+
+HofContext::Status LambdaMachine::run()
+{
+    m_context->reset();
+    m_stats = Stats();
+    if (m_main >= 0)
+        force(suspend(m_main, EnvironmentPtr()));
+    m_stack.clear();
+    if (!m_context->isStopped())
+        m_context->stop(HofContext::Finished);
+    return m_context->status();
+}
+
+// counts a reduction against the limits
+bool LambdaMachine::reduce()
+{
+    if (++m_context->reductions >= m_context->nextCheckpoint)
+        m_context->checkpoint();
+    return !m_context->isStopped();
+}
+
+LambdaMachine::ThunkPtr LambdaMachine::lookup(EnvironmentPtr environment, int index) const
+{
+    for (; index > 0; --index)
+        environment = environment->next;
+    return environment->thunk;
+}
+
+LambdaMachine::ThunkPtr LambdaMachine::suspend(int code, const EnvironmentPtr& environment)
+{
+    const LambdaCode::Node& node = m_code.at(code);
+    if (node.kind == LambdaCode::Variable)
+        return lookup(environment, node.index);
+    if (!m_constants.at(code).isNull())
+        return m_constants.at(code);
+
+    ++m_stats.thunks;
+    ThunkPtr thunk(new Thunk(Thunk::Suspended));
+    thunk->code = code;
+    thunk->environment = environment;
+    return thunk;
+}
+
+void LambdaMachine::enter(const ThunkPtr& thunk, Control* control)
+{
+    ThunkPtr t = thunk;
+    while (t->state == Thunk::Applied) {
+        m_stack.append(Frame(t, true));
+        m_stack.append(Frame(t->argument));
+        t = t->function;
+    }
+
+    if (t->isValue()) {
+        control->code = -1;
+        control->value = t;
+        return;
+    }
+
+    m_stack.append(Frame(t, true));
+    control->code = t->code;
+    control->environment = t->environment;
+    control->value.clear();
+}
+
+// evaluates the thunk to weak head normal form and updates it in place
+void LambdaMachine::force(const ThunkPtr& thunk)
+{
+    int base = m_stack.count();
+    Control control;
+    enter(thunk, &control);
+
+    while (!m_context->isStopped()) {
+        if (control.code < 0) {
+            if (!apply(&control, base))
+                break;
+            continue;
+        }
+
+        const LambdaCode::Node& node = m_code.at(control.code);
+        switch (node.kind) {
+        case LambdaCode::Variable:
+            enter(lookup(control.environment, node.index), &control);
+            break;
+        case LambdaCode::Free:
+        case LambdaCode::Primitive:
+            control.value = m_constants.at(control.code);
+            control.code = -1;
+            break;
+        case LambdaCode::Abstraction:
+            if (m_stack.count() > base && !m_stack.last().update) {
+                // the argument is bound without building the closure
+                control.environment = EnvironmentPtr(new Environment(m_stack.takeLast().thunk, control.environment));
+                control.code = node.left;
+                ++m_stats.betas;
+                reduce();
+            } else {
+                ThunkPtr closure(new Thunk(Thunk::Closure));
+                closure->code = control.code;
+                closure->environment = control.environment;
+                control.value = closure;
+                control.code = -1;
+            }
+            break;
+        case LambdaCode::Application:
+            m_stack.append(Frame(suspend(node.right, control.environment)));
+            control.code = node.left;
+            break;
+        }
+    }
+
+    m_stack.resize(base);
+}
+
+// returns the value in control to the stack, false once nothing is left
+bool LambdaMachine::apply(Control* control, int base)
+{
+    if (m_stack.count() == base)
+        return false;
+
+    ThunkPtr value = control->value;
+    if (m_stack.last().update) {
+        m_stack.takeLast().thunk->become(*value);
+        ++m_stats.updates;
+        return true;
+    }
+
+    if (value->state == Thunk::Closure) {
+        control->environment = EnvironmentPtr(new Environment(m_stack.takeLast().thunk, value->environment));
+        control->code = m_code.at(value->code).left;
+        control->value.clear();
+        ++m_stats.betas;
+        return reduce();
+    }
+
+    // a combinator takes what arguments there are up to the next update
+    int needed = arity(value->symbol) - value->arguments.count();
+    int available = 0;
+    while (available < needed && m_stack.count() - available > base && !m_stack.at(m_stack.count() - 1 - available).update)
+        ++available;
+
+    QVector<ThunkPtr> arguments = value->arguments;
+    for (int i = 0; i < available; ++i)
+        arguments.append(m_stack.takeLast().thunk);
+
+    if (available < needed) {
+        ThunkPtr partial(new Thunk(Thunk::Partial));
+        partial->symbol = value->symbol;
+        partial->name = value->name;
+        partial->arguments = arguments;
+        control->value = partial;
+        return true;
+    }
+
+    ++m_stats.primitives;
+    return reduce() && fire(control, value->symbol, arguments);
+}
+
+bool LambdaMachine::fire(Control* control, int symbol, const QVector<ThunkPtr>& arguments)
+{
+    switch (symbol) {
+    case 'S':
+        {
+            ThunkPtr yz(new Thunk(Thunk::Applied));
+            yz->function = arguments.at(1);
+            yz->argument = arguments.at(2);
+            ++m_stats.thunks;
+            m_stack.append(Frame(yz));
+            m_stack.append(Frame(arguments.at(2)));
+            enter(arguments.at(0), control);
+            return true;
+        }
+    case 'P':
+        {
+            force(arguments.at(0));
+            if (m_context->isStopped())
+                return false;
+
+            QTextStream* stream = m_context->output();
+            if (stream) {
+                QString string = print(arguments.at(0));
+                string.truncate(m_context->reserveOutput(string.length()));
+                *stream << string;
+                stream->flush();
+            }
+            enter(arguments.at(0), control);
+            return true;
+        }
+    case 'R':
+        enter(m_context->random()->boolean() ? arguments.at(0) : arguments.at(1), control);
+        return true;
+    default:
+        // I, K and symbols all return their first argument
+        enter(arguments.at(0), control);
+        return true;
+    }
+}
+
+QString LambdaMachine::print(const ThunkPtr& thunk)
+{
+    // like a hof Capture, followed by its arguments
+    if (thunk->state == Thunk::Partial) {
+        QString string(thunk->name);
+        foreach (const ThunkPtr& argument, thunk->arguments)
+            string.append(print(argument));
+        return string;
+    }
+
+    bool ok = true;
+    QString hof = Lambda::fromLambda(lambdaText(thunk), &ok);
+    return ok ? hof : QString();
+}
+
+QString LambdaMachine::lambdaText(const ThunkPtr& thunk) const
+{
+    QStringList bound;
+    switch (thunk->state) {
+    case Thunk::Suspended:
+    case Thunk::Closure:
+        return lambdaText(thunk->code, thunk->environment, &bound);
+    case Thunk::Applied:
+        return "(" + lambdaText(thunk->function) + " " + lambdaText(thunk->argument) + ")";
+    case Thunk::Partial:
+        {
+            QString text = thunk->symbol ? "{" + QString(thunk->name) + "}" : QString(thunk->name);
+            foreach (const ThunkPtr& argument, thunk->arguments)
+                text = "(" + text + " " + lambdaText(argument) + ")";
+            return text;
+        }
+    }
+    return QString();
+}
+
+// a name for a binder that appears nowhere in its body, or a null QChar
+static QChar freshName(const QString& body)
+{
+    for (ushort ch = 'a'; ch <= 'z'; ++ch) {
+        if (!body.contains(QChar(ch)))
+            return QChar(ch);
+    }
+    for (ushort ch = 0x03B1; ch <= 0x03C9; ++ch) {
+        if (ch != 0x03BB && !body.contains(QChar(ch)))
+            return QChar(ch);
+    }
+    return QChar();
+}
+
+// the values in the environment are closed so they are pasted in as they
+// are, but the names free in them can clash with a binder around them, as
+// the a of (λx.λa.x) a does; bound variables are written as a placeholder
+// for their depth until their binder has a name that appears nowhere else
+// in its body
+QString LambdaMachine::lambdaText(int code, const EnvironmentPtr& environment, QStringList* bound) const
+{
+    const LambdaCode::Node& node = m_code.at(code);
+    switch (node.kind) {
+    case LambdaCode::Variable:
+        if (node.index < bound->count())
+            return bound->at(node.index);
+        return lambdaText(lookup(environment, node.index - bound->count()));
+    case LambdaCode::Free:
+        return QString(node.name);
+    case LambdaCode::Primitive:
+        return "{" + QString(node.name) + "}";
+    case LambdaCode::Abstraction:
+        {
+            // two characters from the private use area, unique to the depth
+            int depth = bound->count();
+            QString placeholder = QString(QChar(ushort(0xE000 + depth / 0x1900))) + QChar(ushort(0xE000 + depth % 0x1900));
+            bound->prepend(placeholder);
+            QString body = lambdaText(node.left, environment, bound);
+            bound->removeFirst();
+
+            QChar name = node.name;
+            if (body.contains(name)) {
+                QChar fresh = freshName(body);
+                if (!fresh.isNull())
+                    name = fresh;
+            }
+            body.replace(placeholder, QString(name));
+            return "(" + QString(QChar(0x03BB)) + name + "." + body + ")";
+        }
+    case LambdaCode::Application:
+        return "(" + lambdaText(node.left, environment, bound) + " " + lambdaText(node.right, environment, bound) + ")";
+    }
+    return QString();
+}
@@ -0,0 +1,130 @@
+#ifndef lambdamachine_h
+#define lambdamachine_h
+
+#include <QtCore>
+
+#include "context.h"
+
+/**
+ * A lambda program compiled for the LambdaMachine.  Nodes live in one
+ * vector and refer to each other by index, variables are de Bruijn indices
+ * and the hof of {substitutions} and of the input is embedded as the
+ * combinators it names.
+ */
+class LambdaCode {
+public:
+    enum Kind {
+        Variable,       // index counts the abstractions in between
+        Free,           // a symbol, which like a hof Var returns its argument
+        Abstraction,    // left is the body
+        Application,
+        Primitive       // index is one of 'I', 'K', 'S', 'P' or 'R'
+    };
+
+    struct Node {
+        Kind kind;
+        int index;
+        QChar name;
+        int left;
+        int right;
+    };
+
+    int count() const { return m_nodes.count(); }
+    const Node& at(int node) const { return m_nodes.at(node); }
+
+    int variable(int index, QChar name) { return append(Variable, index, name); }
+    int free(QChar name) { return append(Free, 0, name); }
+    int abstraction(QChar name, int body) { return append(Abstraction, 0, name, body); }
+    int application(int left, int right) { return append(Application, 0, QChar(), left, right); }
+    int primitive(char symbol) { return append(Primitive, symbol, QChar(symbol)); }
+
+    // the terms of a hof program applied to each other, -1 if there are
+    // none or the last is unfinished
+    int hof(const QString& text);
+
+private:
+    int append(Kind kind, int index, QChar name, int left = -1, int right = -1);
+
+    QVector<Node> m_nodes;
+};
+
+/**
+ * A second engine for lambda programs that skips bracket abstraction and
+ * runs the lambda terms themselves on a call by need Krivine machine.
+ * Closures share their environments, every argument is a thunk that is
+ * updated with its value the first time it is forced, and P and R are
+ * primitives alongside S, K and I so programs mixing in hof behave the same.
+ *
+ * P prints symbols and combinators just as the hof engine does.  Any other
+ * value is printed as the Hof its lambda term translates to, which can
+ * differ from the partly reduced term the hof engine would print.
+ *
+ * Only what a closure binds is shared, there is no cache of applications,
+ * so where the hof engine answers the same application again from memory,
+ * as it does all through church numerals, the machine reduces it again and
+ * counts several times the reductions.
+ */
+class LambdaMachine {
+public:
+    struct Stats {
+        Stats() : betas(0), primitives(0), thunks(0), updates(0) { }
+        qint64 betas;       // abstractions applied
+        qint64 primitives;  // combinators and symbols applied
+        qint64 thunks;      // suspended arguments
+        qint64 updates;     // thunks overwritten with their value
+    };
+
+    LambdaMachine(HofContext* context);
+    ~LambdaMachine();
+
+    // compiles a lambda program with hof terms, such as --input, applied to it
+    bool load(const char* data, int length, const QByteArray& input = QByteArray(), QString* error = 0);
+
+    HofContext::Status run();
+
+    Stats stats() const { return m_stats; }
+
+private:
+    struct Thunk;
+    struct Environment;
+    typedef QSharedPointer<Thunk> ThunkPtr;
+    typedef QSharedPointer<Environment> EnvironmentPtr;
+
+    // the stack holds arguments and thunks waiting for their value
+    struct Frame {
+        Frame(const ThunkPtr& t = ThunkPtr(), bool u = false) : thunk(t), update(u) { }
+        ThunkPtr thunk;
+        bool update;
+    };
+
+    // either code to run in an environment or a value to return
+    struct Control {
+        Control() : code(-1) { }
+        int code;
+        EnvironmentPtr environment;
+        ThunkPtr value;
+    };
+
+    Q_DISABLE_COPY(LambdaMachine)
+
+    void force(const ThunkPtr& thunk);
+    void enter(const ThunkPtr& thunk, Control* control);
+    bool apply(Control* control, int base);
+    bool fire(Control* control, int symbol, const QVector<ThunkPtr>& arguments);
+    ThunkPtr suspend(int code, const EnvironmentPtr& environment);
+    ThunkPtr lookup(EnvironmentPtr environment, int index) const;
+    bool reduce();
+
+    QString print(const ThunkPtr& thunk);
+    QString lambdaText(const ThunkPtr& thunk) const;
+    QString lambdaText(int code, const EnvironmentPtr& environment, QStringList* bound) const;
+
+    HofContext* m_context;
+    LambdaCode m_code;
+    QVector<ThunkPtr> m_constants;
+    QVector<Frame> m_stack;
+    int m_main;
+    Stats m_stats;
+};
+
+#endif // lambdamachine_h
@@ -0,0 +1,142 @@
+#include "lexer.h"
+
+Lexer::Tokens Lexer::tokenize(const char* data, int length, Syntax syntax, bool sharing)
+{
+    Lexer lexer(data, length, syntax);
+    lexer.setSharing(sharing);
+    // a token is eight bytes, so reserving one per byte of input would take
+    // eight times the input up front even where most of it is whitespace
+    Tokens tokens;
+    while (!lexer.atEnd()) {
+        Token token = lexer.next();
+        if (token.type != None)
+            tokens.append(token);
+    }
+    tokens.squeeze();
+    return tokens;
+}
+
+QString Lexer::typeToString(Type type)
+{
+    switch (type) {
+    case None: return QStringLiteral("None");
+    case Symbol: return QStringLiteral("Variable");
+    case Lambda: return QStringLiteral("Lambda");
+    case Dot: return QStringLiteral("Dot");
+    case LParen: return QStringLiteral("LParen");
+    case RParen: return QStringLiteral("RParen");
+    case Sub: return QStringLiteral("Sub");
+    case Share: return QStringLiteral("Share");
+    case Reference: return QStringLiteral("Reference");
+    case Integer: return QStringLiteral("Integer");
+    case String: return QStringLiteral("String");
+    case Primitive: return QStringLiteral("Primitive");
+    case Overflow: return QStringLiteral("Overflow");
+    default: return QString();
+    }
+}
+
+QString Lexer::toString(const Token& token) const
+{
+    QString r = typeToString(Type(token.type));
+    return r + ": '" + (token.length ? text(token) : QString("\\0")) + "'";
+}
+
+Lexer::Token Lexer::punctuation(uchar ch, int offset)
+{
+    ++m_position;
+    switch (ch) {
+    case '(': return Token(LParen, offset, 1);
+    case ')': return Token(RParen, offset, 1);
+    case '.': return Token(Dot, offset, 1);
+    case '}': return Token(Sub, offset, 0); // a stray close is an empty substitution
+    case '{':
+        {
+            const char* close = static_cast<const char*>(memchr(m_position, '}', m_end - m_position));
+            if (!close) {
+                // unterminated substitutions are dropped
+                m_position = m_end;
+                return Token();
+            }
+            // rather than a length cut down to fit
+            Token token = close - m_position > MaximumLength ? Token(Overflow, offset, 0)
+                                                             : Token(Sub, offset + 1, int(close - m_position));
+            m_position = close + 1;
+            return token;
+        }
+    default:
+        Q_ASSERT(false);
+        return Token();
+    }
+}
+
+Lexer::Token Lexer::sharing(uchar ch, int offset)
+{
+    ++m_position;
+    if (ch == '$')
+        return Token(Share, offset, 1);
+
+    // anything but @ and up to nine digits closed by ; is a plain @
+    const char* digits = m_position;
+    while (digits < m_end && digits - m_position < 9 && *digits >= '0' && *digits <= '9')
+        ++digits;
+    if (digits == m_position || digits == m_end || *digits != ';')
+        return Token(Symbol, offset, 1);
+
+    Token token(Reference, offset + 1, int(digits - m_position));
+    m_position = digits + 1;
+    return token;
+}
+
+Lexer::Token Lexer::literal(uchar ch, int offset)
+{
+    ++m_position;
+    if (ch == '"') {
+        // an unterminated string is a plain "
+        const char* close = m_position;
+        while (close < m_end && *close != '"')
+            close += *close == '\\' ? 2 : 1;
+        if (close >= m_end)
+            return Token(Symbol, offset, 1);
+        Token token = close - m_position > MaximumLength ? Token(Overflow, offset, 0)
+                                                         : Token(String, offset + 1, int(close - m_position));
+        m_position = close + 1;
+        return token;
+    }
+
+    // up to eighteen digits, which always fit, or one operator, closed by ;
+    const char* end = m_position;
+    Type type = Integer;
+    while (end < m_end && end - m_position < 18 && *end >= '0' && *end <= '9')
+        ++end;
+    if (end == m_position && end < m_end && strchr("+-*/%=<", *end) && *end) {
+        type = Primitive;
+        ++end;
+    }
+    if (end == m_position || end == m_end || *end != ';')
+        return Token(Symbol, offset, 1);
+
+    Token token(type, offset + 1, int(end - m_position));
+    m_position = end + 1;
+    return token;
+}
+
+QByteArray Lexer::bytes(const Token& token) const
+{
+    QByteArray bytes;
+    bytes.reserve(int(token.length));
+    const char* end = m_begin + token.offset + token.length;
+    for (const char* ch = m_begin + token.offset; ch < end; ++ch) {
+        if (*ch == '\\' && ch + 1 < end)
+            ++ch;
+        bytes.append(*ch);
+    }
+    return bytes;
+}
+
+QChar Lexer::decode(const Token& token) const
+{
+    // only variables are ever outside of ascii
+    QString ch = text(token);
+    return ch.isEmpty() ? QChar(QChar::ReplacementCharacter) : ch.at(0);
+}
@@ -0,0 +1,163 @@
+#ifndef lexer_h
+#define lexer_h
+
+#include <QtCore>
+
+/**
+ * A byte oriented lexer over a UTF-8 span shared by the hof, ski and lambda
+ * front ends.  Whitespace is skipped while lexing and tokens are compact
+ * offsets into the span, so nothing is allocated per token and the source is
+ * never converted to UTF-16.
+ */
+class Lexer {
+public:
+    enum Syntax {
+        HofSyntax,      // every character is a symbol
+        SkiSyntax,      // adds parenthesis and {substitutions}
+        LambdaSyntax,   // adds 'λ' and '.' on top of ski
+        LiteralSyntax   // hof with #n; integers, "byte strings" and #op; primitives
+    };
+
+    enum Type {
+        None,
+        Symbol,
+        Lambda,
+        Dot,
+        LParen,
+        RParen,
+        Sub,
+        Share,          // $, the next term is the next shared node, with sharing on
+        Reference,      // @n; with the digits of n as its text, with sharing on
+        Integer,        // #n; with the digits of n as its text
+        String,         // "..." with the bytes between the quotes, still escaped, as its text
+        Primitive,      // #op; with the operator as its text
+        Overflow        // a substitution or string longer than MaximumLength, with no text
+    };
+
+    // the longest text the length field of a token holds
+    enum { MaximumLength = (1 << 28) - 1 };
+
+    // eight bytes, the text of a token is data() + offset
+    struct Token {
+        Token() : offset(0), type(None), length(0) { }
+        Token(Type t, int o, int l) : offset(quint32(o)), type(t), length(quint32(l)) { }
+        quint32 offset;
+        quint32 type : 4;
+        quint32 length : 28;
+    };
+    typedef QVector<Token> Tokens;
+
+    Lexer(const char* data, int length, Syntax syntax = HofSyntax)
+        : m_begin(data)
+        , m_position(data)
+        , m_end(data + length)
+        , m_syntax(syntax)
+        , m_sharing(false) { }
+
+    const char* data() const { return m_begin; }
+    int length() const { return int(m_end - m_begin); }
+    bool isEmpty() const { return m_begin == m_end; }
+
+    // off by default, when $ and @ are plain symbols in hof and literal syntax
+    bool sharing() const { return m_sharing; }
+    void setSharing(bool sharing) { m_sharing = sharing; }
+
+    bool atEnd()
+    {
+        while (m_position < m_end && isSpace(*m_position))
+            ++m_position;
+        return m_position >= m_end;
+    }
+
+    Token next()
+    {
+        if (atEnd())
+            return Token();
+
+        int offset = int(m_position - m_begin);
+        uchar lead = uchar(*m_position);
+        if (m_sharing && (m_syntax == HofSyntax || m_syntax == LiteralSyntax) && (lead == '$' || lead == '@'))
+            return sharing(lead, offset);
+        if (m_syntax == LiteralSyntax && (lead == '#' || lead == '"'))
+            return literal(lead, offset);
+        if (m_syntax == HofSyntax || m_syntax == LiteralSyntax || lead >= 0x80 || !isPunctuation(lead)) {
+            int length = symbolLength(lead);
+            Type type = Symbol;
+            // 'λ' is U+03BB, two bytes in UTF-8
+            if (m_syntax == LambdaSyntax && length == 2 && lead == 0xce && uchar(m_position[1]) == 0xbb)
+                type = Lambda;
+            m_position += length;
+            return Token(type, offset, length);
+        }
+        return punctuation(lead, offset);
+    }
+
+    QChar character(const Token& token) const
+    {
+        if (token.length == 1)
+            return QChar(m_begin[token.offset]);
+        return decode(token);
+    }
+
+    QString text(const Token& token) const
+    {
+        return QString::fromUtf8(m_begin + token.offset, int(token.length));
+    }
+
+    // the node a Reference refers to
+    int number(const Token& token) const
+    {
+        int n = 0;
+        for (quint32 i = 0; i < token.length; ++i)
+            n = n * 10 + (m_begin[token.offset + i] - '0');
+        return n;
+    }
+
+    // the value of an Integer
+    qint64 integer(const Token& token) const
+    {
+        qint64 n = 0;
+        for (quint32 i = 0; i < token.length; ++i)
+            n = n * 10 + (m_begin[token.offset + i] - '0');
+        return n;
+    }
+
+    // the bytes of a String, a backslash escapes the byte after it
+    QByteArray bytes(const Token& token) const;
+
+    QString toString() const { return QString::fromUtf8(m_begin, length()); }
+    QString toString(const Token& token) const;
+
+    static Tokens tokenize(const char* data, int length, Syntax syntax = HofSyntax, bool sharing = false);
+    static QString typeToString(Type type);
+
+private:
+    static bool isSpace(char ch)
+    {
+        return ch == ' ' || (ch >= '\t' && ch <= '\r');
+    }
+
+    bool isPunctuation(uchar ch) const
+    {
+        return ch == '(' || ch == ')' || ch == '{' || ch == '}' || (ch == '.' && m_syntax == LambdaSyntax);
+    }
+
+    int symbolLength(uchar lead) const
+    {
+        int length = lead >= 0xf0 ? 4 : lead >= 0xe0 ? 3 : lead >= 0xc0 ? 2 : 1;
+        return qMin(length, int(m_end - m_position));
+    }
+
+    Token punctuation(uchar ch, int offset);
+    Token sharing(uchar ch, int offset);
+    Token literal(uchar ch, int offset);
+    QChar decode(const Token& token) const;
+
+    const char* m_begin;
+    const char* m_position;
+    const char* m_end;
+    Syntax m_syntax;
+    bool m_sharing;
+};
+
+#endif // lexer_h
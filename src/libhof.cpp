@@ -0,0 +1,146 @@
+#include "libhof.h"
+
+#include "hof.h"
+
+#include <limits>
+
+Q_STATIC_ASSERT(int(HOF_RUNNING) == int(HofContext::Running));
+Q_STATIC_ASSERT(int(HOF_FINISHED) == int(HofContext::Finished));
+Q_STATIC_ASSERT(int(HOF_DEPTH_EXCEEDED) == int(HofContext::DepthExceeded));
+Q_STATIC_ASSERT(int(HOF_CANCELLED) == int(HofContext::Cancelled));
+Q_STATIC_ASSERT(int(HOF_REDUCTIONS_EXCEEDED) == int(HofContext::ReductionsExceeded));
+Q_STATIC_ASSERT(int(HOF_TIME_EXCEEDED) == int(HofContext::TimeExceeded));
+Q_STATIC_ASSERT(int(HOF_MEMORY_EXCEEDED) == int(HofContext::MemoryExceeded));
+Q_STATIC_ASSERT(int(HOF_OUTPUT_EXCEEDED) == int(HofContext::OutputExceeded));
+
+/**
+ * Hands everything P prints straight to the embedder's callback.
+ */
+class CallbackDevice : public QIODevice {
+public:
+    CallbackDevice()
+        : callback(0)
+        , userData(0)
+    {
+        open(QIODevice::WriteOnly);
+    }
+
+    hof_output_callback callback;
+    void* userData;
+
+protected:
+    qint64 readData(char* data, qint64 maxSize)
+    {
+        Q_UNUSED(data);
+        Q_UNUSED(maxSize);
+        return -1;
+    }
+
+    qint64 writeData(const char* data, qint64 size)
+    {
+        if (callback && size)
+            callback(data, size_t(size), userData);
+        return size;
+    }
+};
+
+struct hof_context {
+    hof_context()
+        : stream(&device)
+        , hof(&stream)
+        , program(0)
+        , length(0)
+    {
+        stream.setCodec("UTF-8");
+    }
+
+    CallbackDevice device;
+    QTextStream stream;
+    Hof hof;
+    const char* program;
+    int length;
+};
+
+int hof_api_version(void)
+{
+    return HOF_API_VERSION;
+}
+
+hof_context* hof_context_create(void)
+{
+    return new hof_context;
+}
+
+void hof_context_destroy(hof_context* context)
+{
+    delete context;
+}
+
+void hof_limits_init(hof_limits* limits)
+{
+    HofLimits defaults;
+    limits->max_depth = defaults.maxDepth;
+    limits->max_reductions = defaults.maxReductions;
+    limits->max_msecs = defaults.maxMsecs;
+    limits->max_memory = defaults.maxMemory;
+    limits->max_output = defaults.maxOutput;
+}
+
+void hof_context_set_limits(hof_context* context, const hof_limits* limits)
+{
+    HofLimits l;
+    l.maxDepth = limits->max_depth;
+    l.maxReductions = limits->max_reductions;
+    l.maxMsecs = limits->max_msecs;
+    l.maxMemory = limits->max_memory;
+    l.maxOutput = limits->max_output;
+    context->hof.context()->setLimits(l);
+}
+
+void hof_context_set_output(hof_context* context, hof_output_callback callback, void* user_data)
+{
+    context->stream.flush();
+    context->device.callback = callback;
+    context->device.userData = user_data;
+}
+
+int hof_context_load(hof_context* context, const char* program, size_t length)
+{
+    if (length > size_t(std::numeric_limits<int>::max()))
+        return -1;
+    context->program = program;
+    context->length = int(length);
+    return 0;
+}
+
+hof_status hof_context_run(hof_context* context)
+{
+    HofContext::Status status = context->hof.run(context->program, context->length);
+    context->stream.flush();
+    return hof_status(status);
+}
+
+long long hof_context_reductions(const hof_context* context)
+{
+    return context->hof.context()->reductions;
+}
+
+const char* hof_status_name(hof_status status)
+{
+    switch (status) {
+    case HOF_RUNNING:             return "running";
+    case HOF_FINISHED:            return "finished";
+    case HOF_DEPTH_EXCEEDED:      return "depth-exceeded";
+    case HOF_CANCELLED:           return "cancelled";
+    case HOF_REDUCTIONS_EXCEEDED: return "reductions-exceeded";
+    case HOF_TIME_EXCEEDED:       return "time-exceeded";
+    case HOF_MEMORY_EXCEEDED:     return "memory-exceeded";
+    case HOF_OUTPUT_EXCEEDED:     return "output-exceeded";
+    default:                      return "unknown";
+    }
+}
+
+int hof_status_exit_code(hof_status status)
+{
+    return HofContext::exitCode(HofContext::Status(status));
+}
@@ -0,0 +1,88 @@
+#ifndef libhof_h
+#define libhof_h
+
+/*
+ * The stable C interface of libhof.  Nothing here depends on Qt or C++ so
+ * it can be used from C and through any foreign function interface.
+ *
+ * A context runs one program at a time and must only be used from one
+ * thread at a time; any number of contexts can run concurrently.
+ */
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#  if defined(HOF_BUILD_LIBRARY)
+#    define HOF_EXPORT __declspec(dllexport)
+#  else
+#    define HOF_EXPORT __declspec(dllimport)
+#  endif
+#else
+#  define HOF_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HOF_API_VERSION 2
+
+typedef struct hof_context hof_context;
+
+typedef enum {
+    HOF_RUNNING = 0,
+    HOF_FINISHED = 1,
+    HOF_DEPTH_EXCEEDED = 2,
+    HOF_CANCELLED = 3,
+    HOF_REDUCTIONS_EXCEEDED = 4,
+    HOF_TIME_EXCEEDED = 5,
+    HOF_MEMORY_EXCEEDED = 6,
+    HOF_OUTPUT_EXCEEDED = 7
+} hof_status;
+
+/* zero means no limit for everything but the depth */
+typedef struct {
+    int max_depth;
+    long long max_reductions;
+    long long max_msecs;
+    long long max_memory;
+    long long max_output;
+} hof_limits;
+
+/* receives P output as UTF-8, data is only valid during the call */
+typedef void (*hof_output_callback)(const char* data, size_t length, void* user_data);
+
+HOF_EXPORT int hof_api_version(void);
+
+HOF_EXPORT hof_context* hof_context_create(void);
+HOF_EXPORT void hof_context_destroy(hof_context* context);
+
+/* the default limits */
+HOF_EXPORT void hof_limits_init(hof_limits* limits);
+HOF_EXPORT void hof_context_set_limits(hof_context* context, const hof_limits* limits);
+
+HOF_EXPORT void hof_context_set_output(hof_context* context, hof_output_callback callback, void* user_data);
+
+/*
+ * Loads a UTF-8 Hof program.  The buffer is not copied and must stay
+ * valid and unchanged until the last hof_context_run() using it returns.
+ * Returns 0, or -1 for a program longer than INT_MAX bytes, in which case
+ * the context keeps the program it had.
+ */
+HOF_EXPORT int hof_context_load(hof_context* context, const char* program, size_t length);
+
+HOF_EXPORT hof_status hof_context_run(hof_context* context);
+
+/* applications evaluated by the last run */
+HOF_EXPORT long long hof_context_reductions(const hof_context* context);
+
+HOF_EXPORT const char* hof_status_name(hof_status status);
+
+/* the exit code the hof executable uses for a status */
+HOF_EXPORT int hof_status_exit_code(hof_status status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* libhof_h */
@@ -0,0 +1,21 @@
+include($$PWD/../hof.pri)
+
+TEMPLATE = lib
+TARGET = hof
+DESTDIR = $$OUTPUT_DIR/lib
+VERSION = 0.1.0
+
+# qmake CONFIG+=hof_static builds a static library instead
+hof_static:CONFIG += staticlib
+
+DEFINES += HOF_BUILD_LIBRARY
+QMAKE_CXXFLAGS += -fvisibility=hidden
+
+DEPENDPATH += .
+INCLUDEPATH += .
+
+HEADERS += libhof.h
+
+SOURCES += libhof.cpp
+
+include($$PWD/hof.pri)
@@ -1,10 +1,114 @@
 #include <QtCore>
 
+#include <random>
+
+#include "batch.h"
+#include "cache.h"
+#include "collector.h"
+#include "ffi.h"
+#include "fixpoints.h"
 #include "hof.h"
+#include "interactionnet.h"
 #include "lambda.h"
+#include "lambdamachine.h"
+#include "lexer.h"
+#include "numerals.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "partial.h"
+#include "random.h"
+#include "sampler.h"
+#include "server.h"
+#include "sharing.h"
 #include "ski.h"
+#include "speculate.h"
 #include "verbose.h"
 
+// programs at least this large are parsed on all threads before running
+static const int s_parallelParse = 16 << 20;
+
+static void reportNet(const InteractionNet& net)
+{
+    InteractionNet::Stats stats = net.stats();
+    QTextStream summary(stderr);
+    summary << "net: " << stats.interactions << " interactions (" << stats.annihilations << " annihilations, "
+            << stats.commutations << " commutations, " << stats.erasures << " erasures) in " << stats.rounds
+            << " rounds, " << stats.nodes << " nodes at most\n";
+}
+
+static void reportRewrites(const Optimizer& optimizer)
+{
+    QTextStream summary(stderr);
+    summary << "optimize: " << optimizer.fired() << " rewrites";
+    if (optimizer.fired())
+        summary << " (" << optimizer.report() << ")";
+    summary << "\n";
+}
+
+static void reportPartial(const PartialEvaluator& partial)
+{
+    PartialEvaluator::Stats stats = partial.stats();
+    QTextStream summary(stderr);
+    summary << "partial: " << stats.normalized << " of " << stats.candidates << " closed subterms normalized, "
+            << stats.symbolsBefore << " -> " << stats.symbolsAfter << " symbols, " << stats.normal << " already normal, "
+            << stats.exhausted << " out of fuel, " << stats.expanded << " would grow\n";
+}
+
+static void reportNumerals(const Numerals& numerals)
+{
+    Numerals::Stats stats = numerals.stats();
+    QTextStream summary(stderr);
+    summary << "numerals: " << stats.successors << " INC, " << stats.predecessors << " DEC, " << stats.tests
+            << " ISZERO recognized\n";
+}
+
+static void reportFixpoints(const Fixpoints& fixpoints)
+{
+    QTextStream summary(stderr);
+    summary << "fixpoints: " << fixpoints.recognized() << " recognized\n";
+}
+
+static void reportForeign(const ForeignFunctions& functions)
+{
+    QTextStream summary(stderr);
+    summary << "ffi: " << functions.count() << " functions (" << functions.names().join(", ") << "), "
+            << functions.bound() << " bound\n";
+}
+
+static void reportSharing(const Sharing& sharing)
+{
+    Sharing::Stats stats = sharing.stats();
+    QTextStream summary(stderr);
+    summary << "share: " << stats.nodes << " distinct subterms, " << stats.shared << " shared, "
+            << stats.references << " references, " << stats.sizeBefore << " -> " << stats.sizeAfter << " characters, parsed in "
+            << stats.parseNsecsBefore / 1000000.0 << " -> " << stats.parseNsecsAfter / 1000000.0 << " ms\n";
+}
+
+static void reportCollector(const Collector& collector)
+{
+    Collector::Stats stats = collector.stats();
+    QTextStream summary(stderr);
+    summary << "gc: " << stats.collections << " collections, " << stats.swept << " cache entries swept, "
+            << stats.live << " nodes live after the last, " << stats.peak << " at most, paused "
+            << stats.pauseNsecs / 1000000.0 << " ms (" << stats.maxPauseNsecs / 1000000.0 << " ms longest)\n";
+}
+
+// a byte count with an optional K, M or G suffix
+static qint64 parseSize(const QString& string)
+{
+    QString size = string.trimmed().toUpper();
+    qint64 multiplier = 1;
+    if (size.endsWith("K"))
+        multiplier = Q_INT64_C(1) << 10;
+    else if (size.endsWith("M"))
+        multiplier = Q_INT64_C(1) << 20;
+    else if (size.endsWith("G"))
+        multiplier = Q_INT64_C(1) << 30;
+    if (multiplier != 1)
+        size.chop(1);
+    return size.toLongLong() * multiplier;
+}
+
 int main(int argc, char** argv)
 {
     QCoreApplication app(argc, argv);
@@ -31,8 +135,160 @@ int main(int argc, char** argv)
     QCommandLineOption translateOption("translate", "Translate from (ski|lambda) to Hof.", "translate");
     parser.addOption(translateOption);
 
+    QCommandLineOption engineOption("engine", "Run lambda programs translated to hof, the default, directly on the lambda machine, or reduce a pure program to normal form as an interaction net.", "hof|lambda|net");
+    parser.addOption(engineOption);
+
+    QCommandLineOption optimizeOption("optimize", "Rewrite the program with static peephole optimizations before running or printing it.");
+    parser.addOption(optimizeOption);
+
+    QCommandLineOption partialOption("partial-evaluate", "Normalize the closed pure subterms of the program ahead of time, before running or printing it.");
+    parser.addOption(partialOption);
+
+    QCommandLineOption numeralsOption("numerals", "Run Church numerals as native integers, with INC, DEC and ISZERO recognized. Numerals print as #n;.");
+    parser.addOption(numeralsOption);
+
+    QCommandLineOption fixpointsOption("fixpoints", "Recognize the Y and Y1 fixpoint combinators and unroll recursion in one application.");
+    parser.addOption(fixpointsOption);
+
+    QCommandLineOption literalsOption("literals", "Read #n; as an integer, \"...\" as a byte string and #+; #-; #*; #/; #%; #=; #<; as strict primitives on them.");
+    parser.addOption(literalsOption);
+
+    QCommandLineOption ffiOption("ffi", "Load the native functions a shared library registers, see hofffi.h. Can be given more than once.", "library");
+    parser.addOption(ffiOption);
+
+    QCommandLineOption shareOption("share", "Write repeated subterms of a translated program once and refer back to them, and read $ and @n; in any program as shared nodes and references to them.");
+    parser.addOption(shareOption);
+
+    QCommandLineOption batchOption("batch", "Run every job in a file of jobs, one per line, or - for stdin. Exits with an error if any job fails, not with options that configure a single run.", "batch");
+    parser.addOption(batchOption);
+
+    QCommandLineOption threadsOption("threads", "Number of worker threads used by batch mode, the server, sampling or parallel reduction.", "threads");
+    parser.addOption(threadsOption);
+
+    QCommandLineOption unorderedOption("unordered", "Write batch results as jobs complete instead of in submission order.");
+    parser.addOption(unorderedOption);
+
+    QCommandLineOption sharedCacheOption("shared-cache", "Share one concurrent evaluation cache between batch workers.");
+    parser.addOption(sharedCacheOption);
+
+    QCommandLineOption timeSliceOption("time-slice", "Interleave batch jobs, switching between them every n reductions. Server requests are always interleaved, every 10000 reductions unless this is given.", "n");
+    parser.addOption(timeSliceOption);
+
+    QCommandLineOption parallelOption("parallel", "Speculatively reduce pure subterms on idle cores, not with --verbose.");
+    parser.addOption(parallelOption);
+
+    QCommandLineOption samplesOption("samples", "Run the program this many times and print a histogram of the outputs.", "samples");
+    parser.addOption(samplesOption);
+
+    QCommandLineOption seedOption("seed", "Seed the random combinator so runs are reproducible.", "seed");
+    parser.addOption(seedOption);
+
+    QCommandLineOption serveOption("serve", "Serve requests on a Unix domain socket at this path.", "socket");
+    parser.addOption(serveOption);
+
+    QCommandLineOption preloadOption("preload", "Lambda definitions the server makes available to every lambda request.", "file");
+    parser.addOption(preloadOption);
+
+    QCommandLineOption maxDepthOption("max-depth", "Stop when evaluation nests deeper than this.", "depth");
+    parser.addOption(maxDepthOption);
+
+    QCommandLineOption maxReductionsOption("max-reductions", "Stop after this many reductions.", "n");
+    parser.addOption(maxReductionsOption);
+
+    QCommandLineOption maxTimeOption("max-time", "Stop after this many milliseconds.", "msecs");
+    parser.addOption(maxTimeOption);
+
+    QCommandLineOption maxMemoryOption("max-memory", "Stop once the process uses this much memory, with an optional K, M or G suffix.", "bytes");
+    parser.addOption(maxMemoryOption);
+
+    QCommandLineOption maxOutputOption("max-output", "Stop once this many characters have been printed.", "characters");
+    parser.addOption(maxOutputOption);
+
+    QCommandLineOption gcBudgetOption("gc-budget", "Sweep the evaluation cache whenever live nodes and cached results exceed this many, 0 never does.", "nodes", "100000");
+    parser.addOption(gcBudgetOption);
+
+    QCommandLineOption gcStatsOption("gc-stats", "Report what the collector did.");
+    parser.addOption(gcStatsOption);
+
     parser.process(*QCoreApplication::instance());
 
+    HofLimits limits;
+    if (parser.isSet(maxDepthOption))
+        limits.maxDepth = parser.value(maxDepthOption).toInt();
+    limits.maxReductions = parser.value(maxReductionsOption).toLongLong();
+    limits.maxMsecs = parser.value(maxTimeOption).toLongLong();
+    limits.maxMemory = parseSize(parser.value(maxMemoryOption));
+    limits.maxOutput = parser.value(maxOutputOption).toLongLong();
+
+    if (parser.isSet(serveOption)) {
+        int threads = parser.isSet(threadsOption) ? parser.value(threadsOption).toInt() : QThread::idealThreadCount();
+        qint64 slice = parser.value(timeSliceOption).toLongLong();
+        Server server(parser.value(serveOption), threads, slice > 0 ? slice : 10000);
+        server.setLimits(limits);
+        server.setCollectorBudget(parser.value(gcBudgetOption).toLongLong());
+        foreach (const QString& fileName, parser.values(preloadOption)) {
+            QFile file(fileName);
+            if (!file.open(QIODevice::ReadOnly)) {
+                qDebug() << "Error: could not open file for reading: " << fileName;
+                exit(-1);
+            }
+            server.preload(QString::fromUtf8(file.readAll()));
+        }
+
+        if (!server.listen()) {
+            qDebug() << "Error: could not listen on" << server.path() << ":" << server.errorString();
+            exit(-1);
+        }
+        server.exec();
+        return EXIT_SUCCESS;
+    }
+
+    if (parser.isSet(batchOption)) {
+        // each job carries its own program, input and translation, the
+        // options that change how a single run reads or executes its
+        // program have no counterpart in a job and are not dropped silently
+        QList<QCommandLineOption> perRunOptions;
+        perRunOptions << fileOption << programOption << inputOption << verboseOption << translateOption
+                      << engineOption << optimizeOption << partialOption << numeralsOption << fixpointsOption
+                      << literalsOption << ffiOption << shareOption << parallelOption << samplesOption << seedOption;
+        foreach (const QCommandLineOption& option, perRunOptions) {
+            if (parser.isSet(option))
+                parser.showHelp(-1);
+        }
+
+        QString fileName = parser.value(batchOption);
+        QFile file(fileName);
+        bool opened = fileName == "-" ? file.open(stdin, QIODevice::ReadOnly) : file.open(QIODevice::ReadOnly);
+        if (!opened) {
+            qDebug() << "Error: could not open file for reading: " << fileName;
+            exit(-1);
+        }
+
+        int threads = parser.isSet(threadsOption) ? parser.value(threadsOption).toInt() : QThread::idealThreadCount();
+        QTextStream results(stdout);
+        Batch batch(&results, threads, parser.isSet(unorderedOption) ? Batch::CompletionOrder : Batch::SubmissionOrder);
+        batch.setSharedCache(parser.isSet(sharedCacheOption));
+        batch.setLimits(limits);
+        batch.setTimeSlice(parser.value(timeSliceOption).toLongLong());
+        batch.addJobs(file.readAll());
+
+        QElapsedTimer timer;
+        timer.start();
+        int failed = batch.run();
+        qint64 nsecs = qMax(qint64(1), timer.nsecsElapsed());
+
+        QTextStream summary(stderr);
+        summary << "batch: " << batch.jobCount() << " jobs, " << failed << " failed, "
+                << nsecs / 1000000.0 << " ms, " << batch.jobCount() * 1e9 / nsecs << " jobs/sec\n";
+
+        if (EvaluationCache* cache = batch.sharedCache()) {
+            EvaluationCache::Stats stats = cache->stats();
+            summary << "cache: " << stats.size << " entries, " << stats.hitRate() * 100 << "% hit rate, "
+                    << stats.contended << " of " << stats.locks << " lock acquisitions contended\n";
+        }
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
     bool isFile = parser.isSet(fileOption);
     bool isProgram = parser.isSet(programOption);
     bool isInput = parser.isSet(inputOption);
@@ -40,11 +296,32 @@ int main(int argc, char** argv)
     bool isTranslate = parser.isSet(translateOption);
     bool isSki = parser.value(translateOption) == "ski";
     bool isLambda = parser.value(translateOption) == "lambda";
+    bool isParallel = parser.isSet(parallelOption);
+    bool isOptimize = parser.isSet(optimizeOption);
+    bool isPartial = parser.isSet(partialOption);
+    bool isNumerals = parser.isSet(numeralsOption);
+    bool isFixpoints = parser.isSet(fixpointsOption);
+    bool isLiterals = parser.isSet(literalsOption);
+    bool isForeign = parser.isSet(ffiOption);
+    bool isShare = parser.isSet(shareOption);
+    QString engine = parser.value(engineOption);
+    bool isLambdaEngine = engine == "lambda";
+    bool isNetEngine = engine == "net";
+    bool isSeeded = parser.isSet(seedOption);
+    int threads = parser.isSet(threadsOption) ? parser.value(threadsOption).toInt() : QThread::idealThreadCount();
 
     if ((isFile && isProgram) || (!isFile && !isProgram))
         parser.showHelp(-1);
+    if (!engine.isEmpty() && engine != "hof" && engine != "lambda" && engine != "net")
+        parser.showHelp(-1);
+    if ((isLambdaEngine || isNetEngine) && (isTranslate || isOptimize || isPartial || isNumerals || isFixpoints || isLiterals || isForeign || isShare || parser.isSet(samplesOption)))
+        parser.showHelp(-1);
+    // verbose output follows a single thread of evaluation
+    if (isParallel && isVerbose)
+        parser.showHelp(-1);
 
-    QString program;
+    // programs stay UTF-8 all the way to the interpreter
+    QByteArray source;
 
     if (isFile) {
         QString fileName = parser.value(fileOption);
@@ -60,48 +337,224 @@ int main(int argc, char** argv)
         }
 
         QFileInfo info(file);
-        program = file.readAll();
+        source = file.readAll();
         isSki = info.suffix() == "ski";
         isLambda = info.suffix() == "lambda";
     } else if (isProgram) {
-        program = parser.value(programOption);
+        source = parser.value(programOption).toUtf8();
     }
 
+    // loaded before anything runs, and unloaded after
+    ForeignFunctions foreign;
+    foreach (const QString& library, parser.values(ffiOption)) {
+        QString error;
+        if (!foreign.load(library, &error)) {
+            printf("%s\n", qPrintable(error));
+            return -1;
+        }
+    }
+
+    QScopedPointer<Speculator> speculator(isParallel ? new Speculator(threads, limits) : 0);
+
+    QTextStream stream(stdout);
+    Hof hof(&stream);
+    hof.setSharing(isShare);
+    hof.context()->setLimits(limits);
+    if (speculator) {
+        hof.context()->setCache(speculator->cache());
+        hof.context()->setSpeculator(speculator.data());
+    }
+    if (isSeeded)
+        hof.context()->random()->seed(parser.value(seedOption).toULongLong());
+    hof.context()->setCollectorBudget(parser.value(gcBudgetOption).toLongLong());
+
     QTextStream verboseStream(stderr);
-    Verbose::instance()->setStream(isVerbose ? &verboseStream : 0);
+    Verbose* verbose = hof.context()->verbose();
+    verbose->setStream(isVerbose ? &verboseStream : 0);
+
+    if (isLambdaEngine && !isLambda)
+        parser.showHelp(-1);
 
     bool ok = true;
+    QString program;
     if (isSki)
-        program = Ski::fromSki(program, &ok);
-    else if (isLambda)
-        program = Lambda::fromLambda(program, &ok);
+        program = Ski::fromSki(source.constData(), source.size(), &ok, verbose);
+    else if (isLambda && !isLambdaEngine && !isNetEngine)
+        program = Lambda::fromLambda(source.constData(), source.size(), &ok, verbose);
 
     if (!ok) {
         printf("%s\n", qPrintable(program));
         return -1;
     }
 
+    PartialEvaluator partial;
+    Optimizer optimizer;
+    Sharing sharing;
     if (isTranslate) {
         if (!isSki && !isLambda)
             parser.showHelp(-1);
+        if (isPartial) {
+            program = partial.evaluate(program);
+            reportPartial(partial);
+        }
+        if (isOptimize) {
+            program = optimizer.optimize(program);
+            reportRewrites(optimizer);
+        }
+        if (isShare) {
+            program = sharing.share(program);
+            reportSharing(sharing);
+        }
         printf("%s\n", qPrintable(program));
         return EXIT_SUCCESS;
     }
 
-    // Remove all whitespace
-    program = program.simplified();
-    program.replace(" ", "");
+    if (isShare && (isSki || isLambda)) {
+        program = sharing.share(program);
+        reportSharing(sharing);
+    }
+
+    // Whitespace is skipped by the interpreter as it lexes
+    if (isSki || (isLambda && !isLambdaEngine && !isNetEngine))
+        source = program.toUtf8();
+    if (isInput && !isLambdaEngine && !isNetEngine)
+        source.append(parser.value(inputOption).toUtf8());
+
+    if (parser.isSet(samplesOption)) {
+        int samples = parser.value(samplesOption).toInt();
+        quint64 seed = parser.value(seedOption).toULongLong();
+        if (!isSeeded) {
+            std::random_device rd;
+            seed = (quint64(rd()) << 32) | rd();
+        }
+
+        Sampler sampler(threads);
+        sampler.setSeed(seed);
+        sampler.setLimits(limits);
+        sampler.setSharing(isShare);
+
+        QElapsedTimer timer;
+        timer.start();
+        int failed = sampler.run(QString::fromUtf8(source), samples);
+        qint64 nsecs = qMax(qint64(1), timer.nsecsElapsed());
+
+        QTextStream histogram(stdout);
+        foreach (const Sampler::Bucket& bucket, sampler.histogram()) {
+            histogram << bucket.count << "\t" << qreal(bucket.count) / qMax(1, samples) << "\t"
+                      << bucket.output << "\n";
+        }
+        histogram.flush();
+
+        QTextStream summary(stderr);
+        summary << "samples: " << samples << " with seed " << seed << ", " << failed << " failed, "
+                << nsecs / 1000000.0 << " ms, " << samples * 1e9 / nsecs << " samples/sec\n";
+        return EXIT_SUCCESS;
+    }
+
+    HofContext::Status status;
+    if (isLambdaEngine) {
+        LambdaMachine machine(hof.context());
+        QString error;
+        if (!machine.load(source.constData(), source.size(), parser.value(inputOption).toUtf8(), &error)) {
+            printf("%s\n", qPrintable(error));
+            return -1;
+        }
+        source.clear();
+        status = machine.run();
+    } else if (isNetEngine) {
+        // lambda programs keep their abstractions, anything else is hof
+        LambdaCode code;
+        QString error;
+        int root = isLambda ? Lambda::toCode(source.constData(), source.size(), &code, &error)
+                            : code.hof(QString::fromUtf8(source));
+        int input = isInput ? code.hof(parser.value(inputOption)) : root;
+        if (root >= 0 && isInput)
+            root = input < 0 ? input : code.application(root, input);
+        InteractionNet net(hof.context(), threads);
+        if (root < 0 || !net.load(code, root, &error)) {
+            printf("%s\n", qPrintable(error.isEmpty() ? QString("Found errors while parsing") : error));
+            return -1;
+        }
+        source.clear();
+        status = net.reduce();
+        reportNet(net);
+        if (status == HofContext::Finished) {
+            bool ok = true;
+            QString normal = net.toHof(&ok);
+            if (!ok) {
+                QTextStream(stderr) << "net: the normal form can not be read back, the term's duplications overlap\n";
+                return -1;
+            }
+            stream << normal;
+        }
+    } else if (isOptimize || isPartial || isNumerals || isFixpoints || isLiterals || isForeign || (!isVerbose && threads > 1 && source.size() >= s_parallelParse)) {
+        Parser prefixParser(threads);
+        prefixParser.setLiterals(isLiterals);
+        prefixParser.setSharing(isShare);
+        QList<CombinatorPtr> terms = prefixParser.parse(source.constData(), source.size());
+        source.clear();
+        if (prefixParser.stats().overflow) {
+            printf("Error: a string is longer than %d bytes\n", int(Lexer::MaximumLength));
+            return -1;
+        }
+        if (isForeign) {
+            terms = foreign.bind(terms);
+            reportForeign(foreign);
+        }
+        if (isPartial) {
+            terms = partial.evaluate(terms);
+            reportPartial(partial);
+        }
+        if (isNumerals) {
+            // before the optimizer takes the definitions apart
+            Numerals numerals;
+            terms = numerals.recognize(terms);
+            reportNumerals(numerals);
+        }
+        if (isFixpoints) {
+            Fixpoints fixpoints;
+            terms = fixpoints.recognize(terms);
+            reportFixpoints(fixpoints);
+        }
+        if (isOptimize) {
+            terms = optimizer.optimize(terms);
+            reportRewrites(optimizer);
+        }
+        status = hof.run(terms);
+    } else {
+        status = hof.run(source.constData(), source.size());
+    }
 
-    if (isInput)
-        program.append(parser.value(inputOption));
+    if (speculator) {
+        speculator->cancelAll();
+        Speculator::Stats stats = speculator->stats();
+        QTextStream summary(stderr);
+        summary << "parallel: " << stats.sparked << " sparked, " << stats.converted << " converted, "
+                << stats.fizzled << " fizzled, " << stats.completed - stats.converted << " unused, "
+                << stats.discarded << " discarded, " << stats.failed << " failed\n";
+    }
 
-    // Remove all whitespace from input too
-    program = program.simplified();
-    program.replace(" ", "");
+    if (parser.isSet(gcStatsOption))
+        reportCollector(*hof.context()->collector());
+
+    if (status == HofContext::DepthExceeded) {
+        qDebug() << "Hof program has exceed maximum stack depth!";
+        return HofContext::exitCode(status);
+    }
+
+    if (status != HofContext::Finished) {
+        // whatever was printed before the limit hit is still worth having
+        stream << "\n";
+        stream.flush();
+
+        HofContext* context = hof.context();
+        QTextStream summary(stderr);
+        summary << "stopped: " << HofContext::statusName(status) << " after " << context->reductions
+                << " reductions, " << context->elapsed() << " ms, " << context->outputSize
+                << " characters printed\n";
+        return HofContext::exitCode(status);
+    }
 
-    QTextStream stream(stdout);
-    Hof hof(&stream);
-    hof.run(program);
     if (!isVerbose) {
         stream << "\n";
         stream.flush();
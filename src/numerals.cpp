@@ -0,0 +1,32 @@
+#include "numerals.h"
+
+#include "combinators.h"
+
+static const char* const s_definitions[] = {
+    "ASAASAKSK",
+    "AASAASAKSAASAKASAKSAASAASAKSAASAKASAKSAASAKASAKKAASAASAKSKAKAASAKASAKASIAASAKASAKKAASAKASIKAKAKKAKAKAKI",
+    "AASAASIAKAKAKIAKK"
+};
+
+// what each of the definitions is
+static const Arithmetic::Operation s_operations[] = {
+    Arithmetic::Successor,
+    Arithmetic::Predecessor,
+    Arithmetic::IsZero
+};
+
+Numerals::Numerals()
+    : Recognizer(s_definitions, sizeof(s_definitions) / sizeof(s_definitions[0]))
+{
+}
+
+CombinatorPtr Numerals::replace(const CombinatorPtr& term, int definition)
+{
+    Arithmetic::Operation operation = s_operations[definition];
+    switch (operation) {
+    case Arithmetic::Successor: ++m_stats.successors; break;
+    case Arithmetic::Predecessor: ++m_stats.predecessors; break;
+    case Arithmetic::IsZero: ++m_stats.tests; break;
+    }
+    return CombinatorPtr(new Arithmetic(operation, term));
+}
@@ -0,0 +1,39 @@
+#ifndef numerals_h
+#define numerals_h
+
+#include "recognizer.h"
+
+/**
+ * Finds the standard INC, DEC and ISZERO combinators in a parsed program
+ * and replaces them with Arithmetic nodes, which work on Church numerals as
+ * native integers.  The numerals themselves need no recognizing: I and KI
+ * are one and zero, and every numeral INC, DEC or another numeral makes
+ * from them at runtime is a Numeral.
+ *
+ * A numeral printed by P prints as #n; rather than as the combinators it
+ * would have been, otherwise programs behave the same.  Like every
+ * Recognizer the arguments given directly to P are left as they were
+ * written.
+ */
+class Numerals : public Recognizer {
+public:
+    struct Stats {
+        Stats() : successors(0), predecessors(0), tests(0) { }
+        int successors;
+        int predecessors;
+        int tests;
+    };
+
+    Numerals();
+
+    Stats stats() const { return m_stats; }
+    void clear() { m_stats = Stats(); }
+
+protected:
+    CombinatorPtr replace(const CombinatorPtr& term, int definition);
+
+private:
+    Stats m_stats;
+};
+
+#endif // numerals_h
@@ -0,0 +1,263 @@
+#include "optimizer.h"
+
+#include "combinators.h"
+#include "parser.h"
+
+static bool isApplicationOf(const CombinatorPtr& term, Combinator::Type type)
+{
+    if (term->type() != Combinator::a_)
+        return false;
+    const A* a = static_cast<const A*>(term.data());
+    return a->isFull() && !a->isThunk && a->left->type() == type;
+}
+
+static CombinatorPtr argumentOf(const CombinatorPtr& term)
+{
+    return static_cast<const A*>(term.data())->right;
+}
+
+static CombinatorPtr capture(const CombinatorPtr& callback, const CombinatorPtr& x, const CombinatorPtr& y)
+{
+    return CombinatorPtr(new Capture(callback, x, y));
+}
+
+Optimizer::Optimizer()
+    : m_combinators(true)
+{
+    clear();
+}
+
+void Optimizer::clear()
+{
+    for (int rule = 0; rule < RuleCount; ++rule)
+        m_fired[rule] = 0;
+}
+
+int Optimizer::fired() const
+{
+    int total = 0;
+    for (int rule = 0; rule < RuleCount; ++rule)
+        total += m_fired[rule];
+    return total;
+}
+
+QString Optimizer::ruleToString(Rule rule)
+{
+    switch (rule) {
+    case SkxToI: return QStringLiteral("SKx -> I");
+    case SkpKqToKpq: return QStringLiteral("S(Kp)(Kq) -> K(pq)");
+    case SkpIToP: return QStringLiteral("S(Kp)I -> p");
+    case SkxyToBxy: return QStringLiteral("S(Kx)y -> Bxy");
+    case SxKyToCxy: return QStringLiteral("Sx(Ky) -> Cxy");
+    case IxToX: return QStringLiteral("Ix -> x");
+    case KxyToX: return QStringLiteral("Kxy -> x");
+    default: return QString();
+    }
+}
+
+QString Optimizer::report() const
+{
+    QStringList fired;
+    for (int rule = 0; rule < RuleCount; ++rule) {
+        if (m_fired[rule])
+            fired.append(QString("%1: %2").arg(ruleToString(Rule(rule))).arg(m_fired[rule]));
+    }
+    return fired.join(", ");
+}
+
+QSet<const Combinator*> Optimizer::printable(const QList<CombinatorPtr>& terms)
+{
+    QSet<const Combinator*> printable;
+    QSet<const Combinator*> visited;
+    QVector<const Combinator*> stack;
+    foreach (const CombinatorPtr& term, terms)
+        stack.append(term.data());
+
+    bool hasPrint = false;
+    while (!stack.isEmpty() && !hasPrint) {
+        const Combinator* c = stack.takeLast();
+        hasPrint = c->type() == Combinator::p_;
+        if (c->type() != Combinator::a_ || visited.contains(c))
+            continue;
+        visited.insert(c);
+        const A* a = static_cast<const A*>(c);
+        if (a->left)
+            stack.append(a->left.data());
+        if (a->right)
+            stack.append(a->right.data());
+    }
+    if (!hasPrint)
+        return printable;
+
+    // every term after the first is an argument of the ones before it, and
+    // everything inside an argument prints along with it
+    QSet<const Combinator*> evaluated;
+    QVector<QPair<const Combinator*, bool> > frames;
+    for (int i = terms.count() - 1; i >= 0; --i)
+        frames.append(qMakePair(terms.at(i).data(), i > 0));
+    while (!frames.isEmpty()) {
+        QPair<const Combinator*, bool> frame = frames.takeLast();
+        if (frame.first->type() != Combinator::a_ || printable.contains(frame.first))
+            continue;
+        if (frame.second)
+            printable.insert(frame.first);
+        else if (evaluated.contains(frame.first))
+            continue;
+        else
+            evaluated.insert(frame.first);
+
+        const A* a = static_cast<const A*>(frame.first);
+        if (a->left)
+            frames.append(qMakePair(a->left.data(), frame.second));
+        if (a->right)
+            frames.append(qMakePair(a->right.data(), true));
+    }
+    return printable;
+}
+
+QList<CombinatorPtr> Optimizer::optimize(const QList<CombinatorPtr>& terms)
+{
+    m_printable = printable(terms);
+    QList<CombinatorPtr> optimized;
+    foreach (const CombinatorPtr& term, terms)
+        optimized.append(rewriteAll(term));
+    m_rewritten.clear();
+    m_printable.clear();
+    return optimized;
+}
+
+CombinatorPtr Optimizer::optimize(const CombinatorPtr& term)
+{
+    m_printable = printable(QList<CombinatorPtr>() << term);
+    CombinatorPtr optimized = rewriteAll(term);
+    m_rewritten.clear();
+    m_printable.clear();
+    return optimized;
+}
+
+CombinatorPtr Optimizer::rewriteAll(const CombinatorPtr& term)
+{
+    // post order without recursion so deep programs can not exhaust the stack
+    struct Frame {
+        Frame(const CombinatorPtr& t = CombinatorPtr(), bool v = false) : term(t), visited(v) { }
+        CombinatorPtr term;
+        bool visited;
+    };
+    QVector<Frame> stack;
+    QVector<CombinatorPtr> results;
+
+    stack.append(Frame(term));
+    while (!stack.isEmpty()) {
+        Frame frame = stack.takeLast();
+        A* a = frame.term->type() == Combinator::a_ ? static_cast<A*>(frame.term.data()) : 0;
+        if (!a || !a->isFull() || a->isThunk || a->left->type() == Combinator::p_ || m_printable.contains(a)) {
+            results.append(frame.term);
+        } else if (m_rewritten.contains(a)) {
+            // a shared subterm is rewritten once
+            results.append(m_rewritten.value(a).second);
+        } else if (!frame.visited) {
+            stack.append(Frame(frame.term, true));
+            stack.append(Frame(a->right));
+            stack.append(Frame(a->left));
+        } else {
+            a->right = results.takeLast();
+            a->left = results.takeLast();
+            results.append(rewrite(frame.term));
+            m_rewritten.insert(a, qMakePair(frame.term, results.last()));
+        }
+    }
+
+    Q_ASSERT(results.count() == 1);
+    return results.last();
+}
+
+QString Optimizer::optimize(const QString& hof)
+{
+    QByteArray utf8 = hof.toUtf8();
+    Parser parser(1);
+    QList<CombinatorPtr> terms = parser.parse(utf8.constData(), utf8.size());
+    if (parser.stats().incomplete)
+        return hof;
+
+    m_combinators = false;
+    terms = optimize(terms);
+    m_combinators = true;
+
+    QString optimized;
+    foreach (const CombinatorPtr& term, terms)
+        optimized.append(term->toString());
+    return optimized;
+}
+
+CombinatorPtr Optimizer::application(const CombinatorPtr& left, const CombinatorPtr& right)
+{
+    A* a = new A;
+    a->left = left;
+    a->right = right;
+    return rewrite(CombinatorPtr(a));
+}
+
+// the children of term are already optimized
+CombinatorPtr Optimizer::rewrite(const CombinatorPtr& term)
+{
+    if (term->type() != Combinator::a_)
+        return term;
+
+    const A* a = static_cast<const A*>(term.data());
+    if (!a->isFull() || a->isThunk)
+        return term;
+
+    if (a->left->type() == Combinator::i_) {
+        ++m_fired[IxToX];
+        return a->right;
+    }
+
+    if (isApplicationOf(a->left, Combinator::k_)) {
+        ++m_fired[KxyToX];
+        return argumentOf(a->left);
+    }
+
+    if (!isApplicationOf(a->left, Combinator::s_))
+        return term;
+
+    /*
+     * The same optimizations S::apply makes at runtime, taken from the
+     * paper, "Another Algorithm for Bracket Abstraction" by D. A. Turner.
+     */
+    CombinatorPtr x = argumentOf(a->left);
+    CombinatorPtr y = a->right;
+
+    if (x->type() == Combinator::k_) {
+        ++m_fired[SkxToI];
+        return i();
+    }
+
+    if (isApplicationOf(x, Combinator::k_)) {
+        CombinatorPtr p = argumentOf(x);
+        if (isApplicationOf(y, Combinator::k_)) {
+            ++m_fired[SkpKqToKpq];
+            return application(k(), application(p, argumentOf(y)));
+        }
+
+        if (y->type() == Combinator::i_) {
+            ++m_fired[SkpIToP];
+            return p;
+        }
+
+#if OPTIMIZATIONS
+        if (m_combinators) {
+            ++m_fired[SkxyToBxy];
+            return capture(b(), p, y);
+        }
+#endif
+    }
+
+#if OPTIMIZATIONS
+    if (m_combinators && isApplicationOf(y, Combinator::k_)) {
+        ++m_fired[SxKyToCxy];
+        return capture(c(), x, argumentOf(y));
+    }
+#endif
+
+    return term;
+}
@@ -0,0 +1,75 @@
+#ifndef optimizer_h
+#define optimizer_h
+
+#include <QtCore>
+
+class Combinator;
+typedef QSharedPointer<Combinator> CombinatorPtr;
+
+/**
+ * A static peephole optimizer for parsed programs.  The rewrites S::apply
+ * tries at runtime every time an S captures its second argument, plus a
+ * few more, are applied bottom up over the whole term before evaluation.
+ * Every rule makes the term smaller so rewriting always reaches a fixpoint.
+ *
+ * Top level terms are optimized one by one and never merged, since the
+ * interpreter applies them to each other strictly in order.  B and C have
+ * no surface syntax so they are only introduced into terms, never into
+ * text.
+ *
+ * P prints the text of an unevaluated application, and any argument can
+ * be handed on to P, so in a program with a P in it only the applications
+ * that are evaluated where they are written are rewritten: the first term
+ * and the functions at its head, never an argument or a later term.  An
+ * optimized program prints exactly what the original does.
+ *
+ * Subterms shared with $ and @n; are rewritten once and stay shared.
+ */
+class Optimizer {
+public:
+    enum Rule {
+        SkxToI,         // SKx -> I
+        SkpKqToKpq,     // S(Kp)(Kq) -> K(pq)
+        SkpIToP,        // S(Kp)I -> p
+        SkxyToBxy,      // S(Kx)y -> Bxy
+        SxKyToCxy,      // Sx(Ky) -> Cxy
+        IxToX,          // Ix -> x
+        KxyToX,         // Kxy -> x
+        RuleCount
+    };
+
+    Optimizer();
+
+    // rewrites the applications of the terms in place
+    QList<CombinatorPtr> optimize(const QList<CombinatorPtr>& terms);
+    CombinatorPtr optimize(const CombinatorPtr& term);
+
+    // optimizes a hof program as text using the rules that only need S, K and I
+    QString optimize(const QString& hof);
+
+    // the applications P could be given unevaluated and so print as they
+    // are written, none if the terms have no P in them
+    static QSet<const Combinator*> printable(const QList<CombinatorPtr>& terms);
+
+    int fired(Rule rule) const { return m_fired[rule]; }
+    int fired() const;
+    void clear();
+
+    // the rules that fired, for example "Ix -> x: 3, Kxy -> x: 1"
+    QString report() const;
+    static QString ruleToString(Rule rule);
+
+private:
+    CombinatorPtr rewriteAll(const CombinatorPtr& term);
+    CombinatorPtr rewrite(const CombinatorPtr& term);
+    CombinatorPtr application(const CombinatorPtr& left, const CombinatorPtr& right);
+
+    bool m_combinators;
+    int m_fired[RuleCount];
+    QSet<const Combinator*> m_printable;
+
+    // each application holds on to itself as well so its address is not reused
+    QHash<const Combinator*, QPair<CombinatorPtr, CombinatorPtr> > m_rewritten;
+};
+
+#endif // optimizer_h
@@ -0,0 +1,416 @@
+#include "parser.h"
+
+#include "combinators.h"
+#include "lexer.h"
+#include "threadpool.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// marks a symbol outside of ascii, decoded into Chunk::wide
+#define WIDE '\x80'
+
+// marks a reference to a shared node, kept in Chunk::references
+#define REFERENCE '\x81'
+
+// marks a literal, built into Chunk::literals
+#define LITERAL '\x82'
+
+class ParserRunnable : public QRunnable {
+public:
+    ParserRunnable(Parser* parser, int phase, int chunk)
+        : m_parser(parser)
+        , m_phase(phase)
+        , m_chunk(chunk) { }
+
+    void run() { m_parser->runPhase(m_phase, m_chunk); }
+
+private:
+    Parser* m_parser;
+    int m_phase;
+    int m_chunk;
+};
+
+#if defined(__SSE2__)
+// inclusive scan of four 32 bit lanes carried on from the last lane of carry
+static inline void scanLanes(__m128i lanes, __m128i* carry, int* out)
+{
+    lanes = _mm_add_epi32(lanes, _mm_slli_si128(lanes, 4));
+    lanes = _mm_add_epi32(lanes, _mm_slli_si128(lanes, 8));
+    lanes = _mm_add_epi32(lanes, *carry);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), lanes);
+    *carry = _mm_shuffle_epi32(lanes, _MM_SHUFFLE(3, 3, 3, 3));
+}
+#endif
+
+// out[i] is depth plus the sum of (arity - 1) over symbols[0..i]
+static void prefixSum(const char* symbols, int count, int depth, int* out)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i applications = _mm_set1_epi8('A');
+    const __m128i twos = _mm_set1_epi8(2);
+    const __m128i ones = _mm_set1_epi8(1);
+    __m128i carry = _mm_set1_epi32(depth);
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(symbols + i));
+        __m128i weights = _mm_sub_epi8(_mm_and_si128(_mm_cmpeq_epi8(bytes, applications), twos), ones);
+
+        // sign extend sixteen bytes into four vectors of 32 bit lanes
+        __m128i sign = _mm_cmplt_epi8(weights, _mm_setzero_si128());
+        __m128i low = _mm_unpacklo_epi8(weights, sign);
+        __m128i high = _mm_unpackhi_epi8(weights, sign);
+        __m128i lowSign = _mm_srai_epi16(low, 15);
+        __m128i highSign = _mm_srai_epi16(high, 15);
+        scanLanes(_mm_unpacklo_epi16(low, lowSign), &carry, out + i);
+        scanLanes(_mm_unpackhi_epi16(low, lowSign), &carry, out + i + 4);
+        scanLanes(_mm_unpacklo_epi16(high, highSign), &carry, out + i + 8);
+        scanLanes(_mm_unpackhi_epi16(high, highSign), &carry, out + i + 12);
+    }
+    depth = _mm_cvtsi128_si32(carry);
+#endif
+    for (; i < count; ++i) {
+        depth += symbols[i] == 'A' ? 1 : -1;
+        out[i] = depth;
+    }
+}
+
+Parser::Parser(int threads)
+    : m_pool(threads > 1 ? new WorkStealingPool(threads) : 0)
+    , m_minimumChunk(1 << 16)
+    , m_literals(false)
+    , m_sharing(false)
+    , m_data(0)
+{
+}
+
+Parser::~Parser()
+{
+    delete m_pool;
+}
+
+QList<CombinatorPtr> Parser::parse(const char* data, int length)
+{
+    m_stats = Stats();
+    m_data = data;
+
+    // cut the input into chunks without splitting a UTF-8 sequence
+    int chunks = m_literals || !m_pool ? 1 : qBound(1, length / m_minimumChunk, m_pool->threadCount() * 4);
+    m_chunks.fill(Chunk(), chunks);
+    for (int c = 1; c < chunks; ++c) {
+        int begin = int(qint64(length) * c / chunks);
+        while (begin < length && (uchar(data[begin]) & 0xc0) == 0x80)
+            ++begin;
+        // nor a reference
+        int digits = begin;
+        while (digits > 0 && begin - digits < 10 && data[digits - 1] >= '0' && data[digits - 1] <= '9')
+            --digits;
+        if (m_sharing && digits > 0 && data[digits - 1] == '@')
+            begin = digits - 1;
+        m_chunks[c].begin = qMax(begin, m_chunks[c - 1].begin);
+        m_chunks[c - 1].end = m_chunks[c].begin;
+    }
+    m_chunks[chunks - 1].end = length;
+
+    QElapsedTimer timer;
+    timer.start();
+    runAll(Count);
+    foreach (const Chunk& chunk, m_chunks) {
+        if (chunk.overflow) {
+            m_stats.overflow = true;
+            return QList<CombinatorPtr>();
+        }
+    }
+
+    // the only sequential pass over the input is over the chunk totals
+    int symbols = 0;
+    int depth = 0;
+    for (int c = 0; c < chunks; ++c) {
+        Chunk& chunk = m_chunks[c];
+        chunk.first = symbols;
+        chunk.depth = depth;
+        symbols += chunk.symbols;
+        depth += 2 * chunk.applications - chunk.symbols;
+    }
+    m_symbols.resize(symbols);
+    m_depth.resize(symbols + 1);
+    m_depth[0] = 0;
+    m_stats.symbols = symbols;
+    m_stats.lexNsecs = timer.nsecsElapsed();
+
+    timer.restart();
+    runAll(Scan);
+    foreach (const Chunk& chunk, m_chunks) {
+        for (int i = 0; i < chunk.wide.count(); ++i)
+            m_wide.insert(chunk.wide.at(i).first, chunk.wide.at(i).second);
+    }
+    m_stats.scanNsecs = timer.nsecsElapsed();
+
+    timer.restart();
+    m_right.fill(-1, symbols);
+    runAll(Link);
+    runAll(Resolve);
+    share();
+
+    // top level terms start at the first occurrence of each depth 0, -1, ...
+    QList<int> roots;
+    int end = m_depth.at(symbols);
+    int chunk = 0;
+    for (int d = 0; chunk < chunks; --d) {
+        int root = -1;
+        while (chunk < chunks && (root = firstAt(chunk, d)) < 0)
+            ++chunk;
+        if (root < 0)
+            break;
+        if (end >= d) {
+            m_stats.incomplete = true;
+            break;
+        }
+        roots.append(root);
+    }
+    m_stats.linkNsecs = timer.nsecsElapsed();
+
+    timer.restart();
+    m_nodes.resize(symbols);
+    runAll(Build);
+    for (QHash<int, int>::const_iterator it = m_referenced.constBegin(); it != m_referenced.constEnd(); ++it)
+        m_nodes[it.key()] = it.value() < 0 ? CombinatorPtr(new Var('@')) : m_nodes.at(it.value());
+    runAll(Connect);
+
+    QList<CombinatorPtr> terms;
+    foreach (int root, roots)
+        terms.append(m_nodes.at(root));
+    m_stats.terms = terms.count();
+    m_stats.buildNsecs = timer.nsecsElapsed();
+
+    // the terms own the tree from here on
+    m_chunks.clear();
+    m_symbols.clear();
+    m_wide.clear();
+    m_depth.clear();
+    m_right.clear();
+    m_referenced.clear();
+    m_nodes.clear();
+    m_data = 0;
+    return terms;
+}
+
+void Parser::runAll(Phase phase)
+{
+    if (m_chunks.count() == 1) {
+        runPhase(phase, 0);
+        return;
+    }
+
+    for (int c = 0; c < m_chunks.count(); ++c)
+        m_pool->start(new ParserRunnable(this, phase, c));
+    m_pool->waitForDone();
+}
+
+void Parser::runPhase(int phase, int chunk)
+{
+    Chunk* c = m_chunks.data() + chunk;
+    switch (phase) {
+    case Count: count(c); break;
+    case Scan: scan(c); break;
+    case Link: link(c); break;
+    case Resolve: resolve(chunk); break;
+    case Build: build(c); break;
+    case Connect: connect(c); break;
+    default: Q_ASSERT(false); break;
+    }
+}
+
+void Parser::count(Chunk* chunk)
+{
+    Lexer lexer(m_data + chunk->begin, chunk->end - chunk->begin, m_literals ? Lexer::LiteralSyntax : Lexer::HofSyntax);
+    lexer.setSharing(m_sharing);
+    while (!lexer.atEnd()) {
+        Lexer::Token token = lexer.next();
+        if (token.type == Lexer::Share)
+            continue;
+        if (token.type == Lexer::Overflow)
+            chunk->overflow = true;
+        ++chunk->symbols;
+        if (token.type == Lexer::Symbol && lexer.data()[token.offset] == 'A')
+            ++chunk->applications;
+    }
+}
+
+static CombinatorPtr literal(const Lexer& lexer, const Lexer::Token& token)
+{
+    switch (token.type) {
+    case Lexer::Integer:
+        return CombinatorPtr(new Numeral(lexer.integer(token)));
+    case Lexer::String:
+        return CombinatorPtr(new ByteString(lexer.bytes(token)));
+    default:
+      {
+          Primitive::Operation operation = Primitive::Add;
+          bool ok = Primitive::fromSymbol(lexer.data()[token.offset], &operation);
+          Q_ASSERT(ok);
+          Q_UNUSED(ok);
+          return CombinatorPtr(new Primitive(operation));
+      }
+    }
+}
+
+void Parser::scan(Chunk* chunk)
+{
+    char* symbols = m_symbols.data() + chunk->first;
+    Lexer lexer(m_data + chunk->begin, chunk->end - chunk->begin, m_literals ? Lexer::LiteralSyntax : Lexer::HofSyntax);
+    lexer.setSharing(m_sharing);
+    for (int i = 0; !lexer.atEnd(); ++i) {
+        Lexer::Token token = lexer.next();
+        char ch = lexer.data()[token.offset];
+        if (token.type == Lexer::Share) {
+            // shares the symbol that comes next, which is not counted yet
+            chunk->shares.append(chunk->first + i);
+            --i;
+        } else if (token.type == Lexer::Reference) {
+            symbols[i] = REFERENCE;
+            chunk->references.append(qMakePair(chunk->first + i, lexer.number(token)));
+        } else if (token.type == Lexer::Integer || token.type == Lexer::String || token.type == Lexer::Primitive) {
+            symbols[i] = LITERAL;
+            chunk->literals.append(qMakePair(chunk->first + i, literal(lexer, token)));
+        } else if (token.length == 1 && uchar(ch) < 0x80) {
+            symbols[i] = ch;
+        } else {
+            symbols[i] = WIDE;
+            chunk->wide.append(qMakePair(chunk->first + i, lexer.character(token)));
+        }
+    }
+
+    // d[first] is written by the chunk before, or is zero
+    prefixSum(symbols, chunk->symbols, chunk->depth, m_depth.data() + chunk->first + 1);
+}
+
+void Parser::link(Chunk* chunk)
+{
+    if (!chunk->symbols)
+        return;
+
+    const int* depth = m_depth.constData();
+    const char* symbols = m_symbols.constData();
+    int* right = m_right.data();
+    int first = chunk->first;
+    int last = first + chunk->symbols - 1;
+
+    chunk->minimum = chunk->maximum = depth[first];
+    for (int i = first + 1; i <= last; ++i) {
+        chunk->minimum = qMin(chunk->minimum, depth[i]);
+        chunk->maximum = qMax(chunk->maximum, depth[i]);
+    }
+
+    // walking backwards, the next symbol at the same depth is the right child
+    chunk->firstAt.fill(-1, chunk->maximum - chunk->minimum + 1);
+    int* firstAt = chunk->firstAt.data() - chunk->minimum;
+    for (int i = last; i >= first; --i) {
+        int d = depth[i];
+        if (symbols[i] == 'A') {
+            right[i] = firstAt[d];
+            if (right[i] < 0)
+                chunk->unresolved.append(i);
+        }
+        firstAt[d] = i;
+    }
+}
+
+void Parser::resolve(int chunk)
+{
+    const QVector<int>& unresolved = m_chunks.at(chunk).unresolved;
+    int* right = m_right.data();
+    foreach (int i, unresolved) {
+        int d = m_depth.at(i);
+        for (int c = chunk + 1; c < m_chunks.count() && right[i] < 0; ++c)
+            right[i] = firstAt(c, d);
+    }
+}
+
+// the last symbol of the term at symbol, or -1 while it is unfinished
+int Parser::end(int symbol) const
+{
+    while (symbol >= 0 && m_symbols.at(symbol) == 'A')
+        symbol = m_right.at(symbol);
+    return symbol;
+}
+
+// references only ever point back at finished terms, which keeps the tree
+// acyclic, and are resolved in order so a shared reference is followed
+void Parser::share()
+{
+    QList<int> shares;
+    foreach (const Chunk& chunk, m_chunks)
+        shares += chunk.shares;
+    m_stats.shared = shares.count();
+
+    foreach (const Chunk& chunk, m_chunks) {
+        for (int r = 0; r < chunk.references.count(); ++r) {
+            int symbol = chunk.references.at(r).first;
+            int node = chunk.references.at(r).second;
+            int shared = node < shares.count() ? shares.at(node) : -1;
+            if (shared >= symbol || shared < 0 || end(shared) < 0 || end(shared) >= symbol) {
+                m_referenced.insert(symbol, -1);
+                continue;
+            }
+            if (m_symbols.at(shared) == REFERENCE)
+                shared = m_referenced.value(shared);
+            m_referenced.insert(symbol, shared);
+            if (shared >= 0)
+                ++m_stats.references;
+        }
+    }
+}
+
+int Parser::firstAt(int chunk, int depth) const
+{
+    const Chunk& c = m_chunks.at(chunk);
+    if (!c.symbols || depth < c.minimum || depth > c.maximum)
+        return -1;
+    return c.firstAt.at(depth - c.minimum);
+}
+
+void Parser::build(Chunk* chunk)
+{
+    const char* symbols = m_symbols.constData();
+    CombinatorPtr* nodes = m_nodes.data();
+    int end = chunk->first + chunk->symbols;
+    for (int i = chunk->first; i < end; ++i) {
+        switch (symbols[i]) {
+        case 'I': nodes[i] = ::i(); break;
+        case 'K': nodes[i] = ::k(); break;
+        case 'S': nodes[i] = ::s(); break;
+        case 'P': nodes[i] = ::p(); break;
+        case 'R': nodes[i] = ::r(); break;
+        case 'A': nodes[i] = CombinatorPtr(new A); break;
+        case WIDE: nodes[i] = CombinatorPtr(new Var(m_wide.value(i))); break;
+        case REFERENCE: break;
+        case LITERAL: break;
+        default: nodes[i] = CombinatorPtr(new Var(QChar(symbols[i]))); break;
+        }
+    }
+    for (int l = 0; l < chunk->literals.count(); ++l)
+        nodes[chunk->literals.at(l).first] = chunk->literals.at(l).second;
+}
+
+void Parser::connect(Chunk* chunk)
+{
+    const char* symbols = m_symbols.constData();
+    const int* right = m_right.constData();
+    CombinatorPtr* nodes = m_nodes.data();
+    int end = chunk->first + chunk->symbols;
+    for (int i = chunk->first; i < end; ++i) {
+        if (symbols[i] != 'A')
+            continue;
+
+        // an unfinished application is only ever part of the dropped tail
+        A* a = static_cast<A*>(nodes[i].data());
+        if (i + 1 < m_nodes.count())
+            a->left = nodes[i + 1];
+        if (right[i] >= 0)
+            a->right = nodes[right[i]];
+        // an unfinished application below this one is again only in the tail
+        a->isComplete = right[i] >= 0;
+    }
+}
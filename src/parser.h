@@ -0,0 +1,123 @@
+#ifndef parser_h
+#define parser_h
+
+#include <QtCore>
+
+class Combinator;
+class WorkStealingPool;
+typedef QSharedPointer<Combinator> CombinatorPtr;
+
+/**
+ * A data parallel parser for very large hof programs.  Every A has arity
+ * two and every other symbol is a leaf, so with d[i] the prefix sum of
+ * (arity - 1) over the symbols before i the tree falls out of the sums
+ * alone: the left child of the A at i is i + 1 and its right child is the
+ * first r > i with d[r] == d[i].  The top level terms start at the first
+ * occurrence of 0, -1, -2 and so on.
+ *
+ * The input is cut into chunks that are lexed, scanned with SSE2 and
+ * linked on a work stealing pool, with only a short sequential pass over
+ * the chunk totals in between, so parsing is bound by memory bandwidth
+ * rather than by chasing pointers down unfinished applications.
+ *
+ * With sharing on, a $ is not a symbol, it only marks the symbol after it as
+ * a shared node, and a reference @n; is a leaf that is resolved to node n
+ * once the tree is linked, so shared subterms stay shared.
+ *
+ * With literals on, #n; integers, "byte strings" and #op; primitives are
+ * leaves as well.  A string may hold anything, so the input is no longer cut
+ * into chunks and is parsed on one thread.
+ */
+class Parser {
+public:
+    struct Stats {
+        Stats() : symbols(0), terms(0), shared(0), references(0), incomplete(false), overflow(false), lexNsecs(0), scanNsecs(0), linkNsecs(0), buildNsecs(0) { }
+        int symbols;
+        int terms;
+        int shared;         // nodes marked with $
+        int references;     // resolved @n;
+        bool incomplete;    // the program ends in an unfinished application
+        bool overflow;      // a string is too long to lex, and nothing was parsed
+        qint64 lexNsecs;
+        qint64 scanNsecs;
+        qint64 linkNsecs;
+        qint64 buildNsecs;
+    };
+
+    // with one thread there is no pool and parsing runs on the caller, so a
+    // parser for a short string does not start and join a thread
+    Parser(int threads = QThread::idealThreadCount());
+    ~Parser();
+
+    // inputs smaller than this are not worth cutting up
+    int minimumChunk() const { return m_minimumChunk; }
+    void setMinimumChunk(int bytes) { m_minimumChunk = qMax(1, bytes); }
+
+    // off by default, when every # and " is a plain symbol
+    bool literals() const { return m_literals; }
+    void setLiterals(bool literals) { m_literals = literals; }
+
+    // off by default, when every $ and @ is a plain symbol
+    bool sharing() const { return m_sharing; }
+    void setSharing(bool sharing) { m_sharing = sharing; }
+
+    // returns the complete top level terms of a UTF-8 program in order, an
+    // unfinished application at the end is dropped just as the interpreter
+    // drops it, and a string too long to lex leaves no terms at all
+    QList<CombinatorPtr> parse(const char* data, int length);
+
+    Stats stats() const { return m_stats; }
+
+    // only called by the pool
+    void runPhase(int phase, int chunk);
+
+private:
+    struct Chunk {
+        Chunk() : begin(0), end(0), symbols(0), applications(0), overflow(false), first(0), depth(0), minimum(0), maximum(-1) { }
+        int begin;              // byte range of the input
+        int end;
+        int symbols;
+        int applications;
+        bool overflow;          // holds a token longer than the lexer can represent
+        int first;              // index of the first symbol
+        int depth;              // d at the first symbol
+        int minimum;            // range of d over the symbols of the chunk
+        int maximum;
+        QVector<int> firstAt;   // first symbol at each depth, indexed by depth - minimum
+        QVector<int> unresolved; // applications whose right child is in a later chunk
+        QList<QPair<int, QChar> > wide;
+        QList<int> shares;      // symbols marked with $
+        QList<QPair<int, int> > references; // symbol and node of each @n;
+        QList<QPair<int, CombinatorPtr> > literals;
+    };
+
+    enum Phase { Count, Scan, Link, Resolve, Build, Connect };
+    Q_DISABLE_COPY(Parser)
+
+    void runAll(Phase phase);
+    void count(Chunk* chunk);
+    void scan(Chunk* chunk);
+    void link(Chunk* chunk);
+    void resolve(int chunk);
+    void share();
+    int end(int symbol) const;
+    void build(Chunk* chunk);
+    void connect(Chunk* chunk);
+    int firstAt(int chunk, int depth) const;
+
+    WorkStealingPool* m_pool;
+    int m_minimumChunk;
+    bool m_literals;
+    bool m_sharing;
+    const char* m_data;
+    QVector<Chunk> m_chunks;
+    QByteArray m_symbols;
+    QHash<int, QChar> m_wide;
+    QVector<int> m_depth;
+    QVector<int> m_right;
+    QHash<int, int> m_referenced; // reference symbol to the symbol it shares
+    QVector<CombinatorPtr> m_nodes;
+    Stats m_stats;
+};
+
+#endif // parser_h
@@ -0,0 +1,148 @@
+#include "partial.h"
+
+#include "combinators.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "statichof.h"
+
+// room for the largest subterm and everything its reduction allocates
+class PartialEvaluator::Workspace : public StaticHof<16 * PartialEvaluator::s_maximumSize> { };
+
+static A* applicationOf(const CombinatorPtr& term)
+{
+    if (term->type() != Combinator::a_)
+        return 0;
+    A* a = static_cast<A*>(term.data());
+    return a->isFull() && !a->isThunk ? a : 0;
+}
+
+PartialEvaluator::PartialEvaluator(int fuel)
+    : m_fuel(fuel)
+    , m_workspace(new Workspace)
+{
+}
+
+PartialEvaluator::~PartialEvaluator()
+{
+    delete m_workspace;
+}
+
+QList<CombinatorPtr> PartialEvaluator::evaluate(const QList<CombinatorPtr>& terms)
+{
+    QList<CombinatorPtr> evaluated = terms;
+    m_printable = Optimizer::printable(terms);
+    for (int i = 0; i < evaluated.count(); ++i)
+        evaluate(&evaluated[i]);
+    m_printable.clear();
+    return evaluated;
+}
+
+QString PartialEvaluator::evaluate(const QString& hof)
+{
+    QByteArray utf8 = hof.toUtf8();
+    Parser parser(1);
+    QList<CombinatorPtr> terms = parser.parse(utf8.constData(), utf8.size());
+    if (parser.stats().incomplete)
+        return hof;
+
+    QString evaluated;
+    foreach (const CombinatorPtr& term, evaluate(terms))
+        evaluated.append(term->toString());
+    return evaluated;
+}
+
+void PartialEvaluator::evaluate(CombinatorPtr* term)
+{
+    // sizes of the closed pure applications, bottom up without recursion
+    m_sizes.clear();
+    QVector<QPair<CombinatorPtr, bool> > stack;
+    QVector<qint64> sizes;
+    stack.append(qMakePair(*term, false));
+    QSet<const Combinator*> sized;
+    while (!stack.isEmpty()) {
+        QPair<CombinatorPtr, bool> frame = stack.takeLast();
+        A* a = applicationOf(frame.first);
+        if (!a) {
+            Combinator::Type type = frame.first->type();
+            bool pure = type == Combinator::s_ || type == Combinator::k_ || type == Combinator::i_;
+            sizes.append(pure ? 1 : 0);
+        } else if (sized.contains(a)) {
+            // shared subterms are sized once
+            sizes.append(m_sizes.value(a));
+        } else if (!frame.second) {
+            stack.append(qMakePair(frame.first, true));
+            stack.append(qMakePair(a->right, false));
+            stack.append(qMakePair(a->left, false));
+        } else {
+            qint64 right = sizes.takeLast();
+            qint64 left = sizes.takeLast();
+            qint64 size = left && right ? qMin(left + right + 1, qint64(s_maximumSize) + 1) : 0;
+            if (size)
+                m_sizes.insert(a, size);
+            sized.insert(a);
+            sizes.append(size);
+        }
+    }
+
+    // then top down, trying the largest closed pure subterms first, with
+    // every shared subterm tried once and replaced alike wherever it is
+    // shared, holding on to the original so its address is not reused
+    QHash<const Combinator*, QPair<CombinatorPtr, CombinatorPtr> > visited;
+    QVector<CombinatorPtr*> pending;
+    pending.append(term);
+    while (!pending.isEmpty()) {
+        CombinatorPtr* slot = pending.takeLast();
+        A* a = applicationOf(*slot);
+        if (!a || a->left->type() == Combinator::p_ || m_printable.contains(a))
+            continue;
+        if (visited.contains(a)) {
+            *slot = visited.value(a).second;
+            continue;
+        }
+
+        CombinatorPtr original = *slot;
+        qint64 size = m_sizes.value(a);
+        if (size && size <= s_maximumSize && normalize(slot, int(size))) {
+            visited.insert(a, qMakePair(original, *slot));
+            continue;
+        }
+        visited.insert(a, qMakePair(original, original));
+
+        pending.append(&a->right);
+        pending.append(&a->left);
+    }
+    m_sizes.clear();
+}
+
+bool PartialEvaluator::normalize(CombinatorPtr* slot, int size)
+{
+    ++m_stats.candidates;
+
+    QByteArray text = (*slot)->toString().toLatin1();
+    m_workspace->clear();
+    m_workspace->parse(text.constData(), text.size());
+    m_workspace->normalize(m_fuel);
+    if (!m_workspace->isNormalized()) {
+        ++m_stats.exhausted;
+        return false;
+    }
+
+    CombinatorPtr normal = m_workspace->terms().first();
+    QString normalText = normal->toString();
+    if (normalText.length() > size) {
+        ++m_stats.expanded;
+        return false;
+    }
+
+    // the subterms of a normal form are normal too
+    if (normalText == QString::fromLatin1(text)) {
+        ++m_stats.normal;
+        return true;
+    }
+
+    ++m_stats.normalized;
+    m_stats.symbolsBefore += size;
+    m_stats.symbolsAfter += normalText.length();
+    *slot = normal;
+    return true;
+}
@@ -0,0 +1,66 @@
+#ifndef partial_h
+#define partial_h
+
+#include <QtCore>
+
+class Combinator;
+typedef QSharedPointer<Combinator> CombinatorPtr;
+
+/**
+ * Partial evaluation of the closed pure subterms of a program, those with
+ * nothing but S, K and I in them.  Each largest such subterm is reduced to
+ * its normal form ahead of time with the same reducer normalizeHof() uses
+ * at compile time, and replaced when the normal form is no larger.  A
+ * subterm that runs out of fuel or room, or that would grow, is left alone
+ * and its own subterms are tried instead, so the pass always terminates and
+ * never expands the program.
+ *
+ * Like the Optimizer it leaves every application P could print as it was
+ * written, see Optimizer::printable(), so the output is the same.  Sizes
+ * are counted in 64 bits and stop growing past s_maximumSize, so a subterm
+ * shared over and over, which prints exponentially long, is never taken
+ * for a small one.
+ */
+class PartialEvaluator {
+public:
+    struct Stats {
+        Stats() : candidates(0), normalized(0), normal(0), exhausted(0), expanded(0), symbolsBefore(0), symbolsAfter(0) { }
+        int candidates;     // closed pure subterms that were tried
+        int normalized;     // replaced by a smaller normal form
+        int normal;         // already in normal form
+        int exhausted;      // out of fuel or room
+        int expanded;       // the normal form is larger
+        int symbolsBefore;  // of the replaced subterms
+        int symbolsAfter;
+    };
+
+    PartialEvaluator(int fuel = 10000);
+    ~PartialEvaluator();
+
+    int fuel() const { return m_fuel; }
+    void setFuel(int fuel) { m_fuel = fuel; }
+
+    QList<CombinatorPtr> evaluate(const QList<CombinatorPtr>& terms);
+    QString evaluate(const QString& hof);
+
+    Stats stats() const { return m_stats; }
+    void clear() { m_stats = Stats(); }
+
+    // subterms larger than this are never normalized whole
+    static const int s_maximumSize = 2048;
+
+private:
+    class Workspace;
+    Q_DISABLE_COPY(PartialEvaluator)
+
+    void evaluate(CombinatorPtr* slot);
+    bool normalize(CombinatorPtr* slot, int size);
+
+    int m_fuel;
+    Workspace* m_workspace;
+    QHash<const Combinator*, qint64> m_sizes; // of closed pure applications
+    QSet<const Combinator*> m_printable;
+    Stats m_stats;
+};
+
+#endif // partial_h
@@ -0,0 +1,32 @@
+#include "random.h"
+
+#include <random>
+
+static const quint64 s_gamma = Q_UINT64_C(0x9e3779b97f4a7c15);
+
+static quint64 mix(quint64 z)
+{
+    z = (z ^ (z >> 30)) * Q_UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * Q_UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+}
+
+Random::Random()
+{
+    std::random_device rd;
+    seed((quint64(rd()) << 32) | rd());
+}
+
+Random::~Random()
+{ }
+
+void Random::seed(quint64 seed, quint64 stream)
+{
+    m_key = mix(mix(seed) + stream * s_gamma);
+    m_counter = 0;
+}
+
+bool Random::boolean()
+{
+    return mix(m_key + ++m_counter * s_gamma) >> 63;
+}
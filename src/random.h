@@ -0,0 +1,27 @@
+#ifndef random_h
+#define random_h
+
+#include <QtCore>
+
+/**
+ * A counter based generator in the style of SplitMix64.  Every draw is a
+ * hash of a key and a counter, so any number of independent streams can be
+ * derived from one seed without the streams sharing any state.
+ */
+class Random {
+public:
+    // seeded from std::random_device
+    Random();
+    ~Random();
+
+    // reproducible stream number stream of the given seed
+    void seed(quint64 seed, quint64 stream = 0);
+
+    bool boolean();
+
+private:
+    quint64 m_key;
+    quint64 m_counter;
+};
+
+#endif // random_h
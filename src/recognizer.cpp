@@ -0,0 +1,89 @@
+#include "recognizer.h"
+
+#include "combinators.h"
+
+Recognizer::Recognizer(const char* const* definitions, int count)
+    : m_definitions(definitions)
+    , m_count(count)
+{
+}
+
+Recognizer::~Recognizer()
+{
+}
+
+QList<CombinatorPtr> Recognizer::recognize(const QList<CombinatorPtr>& terms)
+{
+    QList<CombinatorPtr> recognized;
+    bool printed = false;
+    foreach (const CombinatorPtr& term, terms) {
+        recognized.append(printed ? term : recognizeAll(term));
+        printed = term->type() == Combinator::p_;
+    }
+    m_recognized.clear();
+    m_lengths.clear();
+    return recognized;
+}
+
+CombinatorPtr Recognizer::recognize(const CombinatorPtr& term)
+{
+    CombinatorPtr recognized = recognizeAll(term);
+    m_recognized.clear();
+    m_lengths.clear();
+    return recognized;
+}
+
+CombinatorPtr Recognizer::recognizeAll(const CombinatorPtr& term)
+{
+    struct Frame {
+        Frame(const CombinatorPtr& t = CombinatorPtr(), bool v = false) : term(t), visited(v) { }
+        CombinatorPtr term;
+        bool visited;
+    };
+    QVector<Frame> stack;
+    QVector<CombinatorPtr> results;
+    QVector<qint64> lengths;
+
+    stack.append(Frame(term));
+    while (!stack.isEmpty()) {
+        Frame frame = stack.takeLast();
+        A* a = frame.term->type() == Combinator::a_ ? static_cast<A*>(frame.term.data()) : 0;
+        if (!a || !a->isFull() || a->isThunk || a->left->type() == Combinator::p_) {
+            results.append(frame.term);
+            lengths.append(frame.term->toString().length());
+        } else if (m_recognized.contains(a)) {
+            // a shared subterm is recognized once
+            results.append(m_recognized.value(a).second);
+            lengths.append(m_lengths.value(a));
+        } else if (!frame.visited) {
+            stack.append(Frame(frame.term, true));
+            stack.append(Frame(a->right));
+            stack.append(Frame(a->left));
+        } else {
+            qint64 length = 1 + lengths.takeLast() + lengths.takeLast();
+            a->right = results.takeLast();
+            a->left = results.takeLast();
+            results.append(match(frame.term, length));
+            lengths.append(length);
+            m_lengths.insert(a, length);
+            m_recognized.insert(a, qMakePair(frame.term, results.last()));
+        }
+    }
+
+    Q_ASSERT(results.count() == 1);
+    return results.last();
+}
+
+CombinatorPtr Recognizer::match(const CombinatorPtr& term, qint64 length)
+{
+    QString text;
+    for (int definition = 0; definition < m_count; ++definition) {
+        if (qint64(qstrlen(m_definitions[definition])) != length)
+            continue;
+        if (text.isNull())
+            text = term->toString();
+        if (text == QLatin1String(m_definitions[definition]))
+            return replace(term, definition);
+    }
+    return term;
+}
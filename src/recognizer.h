@@ -0,0 +1,47 @@
+#ifndef recognizer_h
+#define recognizer_h
+
+#include <QtCore>
+
+class Combinator;
+typedef QSharedPointer<Combinator> CombinatorPtr;
+
+/**
+ * Finds the subterms of a parsed program that are spelled exactly like one
+ * of a table of definitions and hands them to replace().  The terms are
+ * walked bottom up without recursion, with the length each prints at, so
+ * only terms as long as a definition are ever printed and compared, and a
+ * subterm shared with $ and @n; is recognized once and stays shared.
+ *
+ * The arguments given directly to P, and every top level term after a P,
+ * are left as they were written.
+ */
+class Recognizer {
+public:
+    QList<CombinatorPtr> recognize(const QList<CombinatorPtr>& terms);
+    CombinatorPtr recognize(const CombinatorPtr& term);
+
+protected:
+    // definitions is a table of count hof programs
+    Recognizer(const char* const* definitions, int count);
+    virtual ~Recognizer();
+
+    // what the term spelled like definitions[definition] is replaced with
+    virtual CombinatorPtr replace(const CombinatorPtr& term, int definition) = 0;
+
+    // the replacement if the term, length long, is spelled like a definition
+    CombinatorPtr match(const CombinatorPtr& term, qint64 length);
+
+private:
+    Q_DISABLE_COPY(Recognizer)
+    CombinatorPtr recognizeAll(const CombinatorPtr& term);
+
+    const char* const* m_definitions;
+    int m_count;
+
+    // each application holds on to itself as well so its address is not reused
+    QHash<const Combinator*, QPair<CombinatorPtr, CombinatorPtr> > m_recognized;
+    QHash<const Combinator*, qint64> m_lengths;
+};
+
+#endif // recognizer_h
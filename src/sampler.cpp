@@ -0,0 +1,112 @@
+#include "sampler.h"
+
+#include "cache.h"
+#include "hof.h"
+#include "random.h"
+#include "threadpool.h"
+
+class SampleRunnable : public QRunnable {
+public:
+    SampleRunnable(Sampler* sampler, int index)
+        : m_sampler(sampler)
+        , m_index(index) { }
+
+    void run() { m_sampler->runSample(m_index); }
+
+private:
+    Sampler* m_sampler;
+    int m_index;
+};
+
+static bool bucketLessThan(const Sampler::Bucket& a, const Sampler::Bucket& b)
+{
+    if (a.count != b.count)
+        return a.count > b.count;
+    return a.output < b.output;
+}
+
+Sampler::Sampler(int threads)
+    : m_pool(new WorkStealingPool(threads))
+    , m_seed(0)
+{
+    for (int i = 0; i < m_pool->threadCount(); ++i)
+        m_engines.append(new Hof(0));
+}
+
+Sampler::~Sampler()
+{
+    delete m_pool;
+    qDeleteAll(m_engines);
+}
+
+void Sampler::setLimits(const HofLimits& limits)
+{
+    foreach (Hof* hof, m_engines)
+        hof->context()->setLimits(limits);
+}
+
+void Sampler::setSharing(bool sharing)
+{
+    foreach (Hof* hof, m_engines)
+        hof->setSharing(sharing);
+}
+
+int Sampler::run(const QString& program, int samples)
+{
+    m_program = program;
+    m_histograms.fill(Histogram(), m_engines.count());
+    m_failed.fill(0, m_engines.count());
+
+    for (int i = 0; i < samples; ++i)
+        m_pool->start(new SampleRunnable(this, i));
+    m_pool->waitForDone();
+
+    int failed = 0;
+    foreach (int f, m_failed)
+        failed += f;
+    return failed;
+}
+
+void Sampler::runSample(int index)
+{
+    int worker = m_pool->currentWorker();
+    Hof* hof = m_engines.at(worker);
+
+    // results that depended on an earlier sample's draws must not leak into this one
+    hof->context()->cache()->clear();
+    hof->context()->random()->seed(m_seed, index);
+
+    QString output;
+    QTextStream stream(&output);
+    hof->context()->setOutput(&stream);
+    HofContext::Status status = hof->run(m_program);
+    hof->context()->setOutput(0);
+    stream.flush();
+
+    if (status != HofContext::Finished) {
+        output = "<" + HofContext::statusName(status) + ">";
+        m_failed[worker]++;
+    }
+    m_histograms[worker][output]++;
+}
+
+QList<Sampler::Bucket> Sampler::histogram() const
+{
+    Histogram merged;
+    foreach (const Histogram& histogram, m_histograms) {
+        Histogram::const_iterator it = histogram.constBegin();
+        for (; it != histogram.constEnd(); ++it)
+            merged[it.key()] += it.value();
+    }
+
+    QList<Bucket> buckets;
+    Histogram::const_iterator it = merged.constBegin();
+    for (; it != merged.constEnd(); ++it) {
+        Bucket bucket;
+        bucket.output = it.key();
+        bucket.count = it.value();
+        buckets.append(bucket);
+    }
+    std::sort(buckets.begin(), buckets.end(), bucketLessThan);
+    return buckets;
+}
@@ -0,0 +1,60 @@
+#ifndef sampler_h
+#define sampler_h
+
+#include <QtCore>
+
+#include "context.h"
+
+class Hof;
+class WorkStealingPool;
+
+/**
+ * Monte Carlo evaluation of programs that use the R combinator.  The same
+ * program is run many times on a work stealing thread pool and the output
+ * of every sample is collected into a histogram.
+ *
+ * Sample n draws from stream n of the seed, so a given seed always
+ * produces the same histogram no matter how many threads are used or in
+ * which order the samples happen to run.
+ */
+class Sampler {
+public:
+    struct Bucket {
+        Bucket() : count(0) { }
+        QString output;
+        int count;
+    };
+
+    Sampler(int threads);
+    ~Sampler();
+
+    quint64 seed() const { return m_seed; }
+    void setSeed(quint64 seed) { m_seed = seed; }
+
+    // limits applied to every sample
+    void setLimits(const HofLimits& limits);
+
+    // whether the program is read with $ and @n; sharing, see Hof
+    void setSharing(bool sharing);
+
+    // returns the number of samples that did not finish
+    int run(const QString& program, int samples);
+
+    // most frequent output first
+    QList<Bucket> histogram() const;
+
+    void runSample(int index);
+
+private:
+    typedef QHash<QString, int> Histogram;
+    Q_DISABLE_COPY(Sampler)
+
+    WorkStealingPool* m_pool;
+    QList<Hof*> m_engines;
+    QVector<Histogram> m_histograms;
+    QVector<int> m_failed;
+    QString m_program;
+    quint64 m_seed;
+};
+
+#endif // sampler_h
@@ -0,0 +1,204 @@
+#include "scheduler.h"
+
+#include "fiber.h"
+#include "hof.h"
+
+/**
+ * Collects P output until the scheduler comes to take it.
+ */
+class PendingOutput : public QIODevice {
+public:
+    PendingOutput() { open(QIODevice::WriteOnly); }
+
+    QString take()
+    {
+        QString output = QString::fromUtf8(m_pending);
+        m_pending.clear();
+        return output;
+    }
+
+protected:
+    qint64 readData(char* data, qint64 maxSize)
+    {
+        Q_UNUSED(data);
+        Q_UNUSED(maxSize);
+        return -1;
+    }
+
+    qint64 writeData(const char* data, qint64 size)
+    {
+        m_pending.append(data, size);
+        return size;
+    }
+
+private:
+    QByteArray m_pending;
+};
+
+class SchedulerTask : public Fiber {
+public:
+    SchedulerTask(int id, int generation, const QString& program, EvaluationCache* cache,
+                  const HofLimits& limits, qint64 collectorBudget, qint64 slice)
+        : Fiber(limits.maxDepth)
+        , m_id(id)
+        , m_generation(generation)
+        , m_program(program)
+        , m_stream(&m_output)
+        , m_hof(&m_stream)
+        , m_status(HofContext::Running)
+    {
+        m_hof.context()->setCache(cache);
+        m_hof.context()->setLimits(limits);
+        m_hof.context()->setCollectorBudget(collectorBudget);
+        m_hof.context()->setFiber(this, slice);
+    }
+
+    int id() const { return m_id; }
+    int generation() const { return m_generation; }
+    HofContext* context() const { return m_hof.context(); }
+    HofContext::Status status() const { return m_status; }
+
+    QString takeOutput()
+    {
+        m_stream.flush();
+        return m_output.take();
+    }
+
+protected:
+    void run()
+    {
+        m_status = m_hof.run(m_program);
+    }
+
+private:
+    int m_id;
+    int m_generation;
+    QString m_program;
+    PendingOutput m_output;
+    QTextStream m_stream;
+    Hof m_hof;
+    HofContext::Status m_status;
+};
+
+class SchedulerThread : public QThread {
+public:
+    SchedulerThread(Scheduler* scheduler)
+        : m_scheduler(scheduler)
+        , m_quit(false) { }
+
+    void enqueue(SchedulerTask* task)
+    {
+        QMutexLocker locker(&m_mutex);
+        m_queue.append(task);
+        m_wake.wakeOne();
+    }
+
+    void quit()
+    {
+        QMutexLocker locker(&m_mutex);
+        m_quit = true;
+        m_wake.wakeOne();
+    }
+
+protected:
+    void run()
+    {
+        forever {
+            SchedulerTask* task = 0;
+            {
+                QMutexLocker locker(&m_mutex);
+                while (m_queue.isEmpty() && !m_quit)
+                    m_wake.wait(&m_mutex);
+                if (m_queue.isEmpty())
+                    return;
+                task = m_queue.takeFirst();
+            }
+
+            if (task->generation() != m_scheduler->m_generation.load())
+                task->context()->stop(HofContext::Cancelled);
+
+            // runs until the slice is used up or the program ends
+            bool running = task->resume();
+
+            QString output = task->takeOutput();
+            if (!output.isEmpty())
+                m_scheduler->m_listener->output(task->id(), output);
+
+            if (running) {
+                QMutexLocker locker(&m_mutex);
+                m_queue.append(task);
+                continue;
+            }
+
+            m_scheduler->m_listener->finished(task->id(), task->status(), task->context()->reductions);
+            delete task;
+            m_scheduler->finished();
+        }
+    }
+
+private:
+    Scheduler* m_scheduler;
+    QList<SchedulerTask*> m_queue;
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    bool m_quit;
+};
+
+Scheduler::Scheduler(SchedulerListener* listener, int threads, qint64 slice)
+    : m_listener(listener)
+    , m_cache(0)
+    , m_collectorBudget(0)
+    , m_slice(slice)
+    , m_nextId(0)
+    , m_pending(0)
+    , m_generation(0)
+{
+    threads = qMax(1, threads);
+    for (int i = 0; i < threads; ++i)
+        m_threads.append(new SchedulerThread(this));
+    foreach (SchedulerThread* thread, m_threads)
+        thread->start();
+}
+
+Scheduler::~Scheduler()
+{
+    cancelAll();
+    waitForDone();
+    foreach (SchedulerThread* thread, m_threads) {
+        thread->quit();
+        thread->wait();
+    }
+    qDeleteAll(m_threads);
+}
+
+int Scheduler::submit(const QString& program)
+{
+    return submit(program, m_limits);
+}
+
+int Scheduler::submit(const QString& program, const HofLimits& limits)
+{
+    int id = m_nextId.fetchAndAddRelaxed(1);
+    m_pending.ref();
+    m_threads.at(id % m_threads.count())->enqueue(new SchedulerTask(id, m_generation.load(), program, m_cache, limits, m_collectorBudget, m_slice));
+    return id;
+}
+
+void Scheduler::cancelAll()
+{
+    m_generation.ref();
+}
+
+void Scheduler::waitForDone()
+{
+    QMutexLocker locker(&m_doneMutex);
+    while (m_pending.load() > 0)
+        m_done.wait(&m_doneMutex);
+}
+
+void Scheduler::finished()
+{
+    QMutexLocker locker(&m_doneMutex);
+    if (!m_pending.deref())
+        m_done.wakeAll();
+}
@@ -0,0 +1,80 @@
+#ifndef scheduler_h
+#define scheduler_h
+
+#include <QtCore>
+
+#include "context.h"
+
+class EvaluationCache;
+class SchedulerTask;
+class SchedulerThread;
+
+/**
+ * Told about the progress of programs running on a Scheduler.  Called
+ * from the scheduler's threads.
+ */
+class SchedulerListener {
+public:
+    virtual ~SchedulerListener() { }
+
+    // P output printed since the program last yielded
+    virtual void output(int id, const QString& output) = 0;
+    virtual void finished(int id, HofContext::Status status, qint64 reductions) = 0;
+};
+
+/**
+ * Interleaves many in-flight programs on a few threads.  Every program
+ * runs in a fiber and yields back to its thread after a slice of
+ * reductions, at which point its pending P output is handed to the
+ * listener and the next program in that thread's run queue gets a turn.
+ * A runaway program like OMEGA can then only ever take its fair share and
+ * a short job waits at most one slice per program ahead of it.
+ */
+class Scheduler {
+public:
+    Scheduler(SchedulerListener* listener, int threads, qint64 slice = 10000);
+    ~Scheduler();
+
+    qint64 slice() const { return m_slice; }
+
+    // all programs share this cache if set, otherwise each has its own
+    void setCache(EvaluationCache* cache) { m_cache = cache; }
+
+    // limits applied to every program submitted from now on
+    void setLimits(const HofLimits& limits) { m_limits = limits; }
+
+    // collector budget of every program submitted from now on, 0 for none
+    void setCollectorBudget(qint64 budget) { m_collectorBudget = budget; }
+
+    // returns the id that the listener will be called with, safe to call
+    // from any thread
+    int submit(const QString& program);
+    int submit(const QString& program, const HofLimits& limits);
+
+    // stop every program submitted so far, they finish as Cancelled
+    void cancelAll();
+
+    void waitForDone();
+
+    // programs submitted that have not finished yet
+    int pending() const { return m_pending.load(); }
+
+private:
+    friend class SchedulerThread;
+    Q_DISABLE_COPY(Scheduler)
+    void finished();
+
+    SchedulerListener* m_listener;
+    QList<SchedulerThread*> m_threads;
+    EvaluationCache* m_cache;
+    HofLimits m_limits;
+    qint64 m_collectorBudget;
+    qint64 m_slice;
+    QAtomicInt m_nextId;
+    QAtomicInt m_pending;
+    QAtomicInt m_generation;
+    QMutex m_doneMutex;
+    QWaitCondition m_done;
+};
+
+#endif // scheduler_h
@@ -0,0 +1,478 @@
+#include "server.h"
+
+#include "cache.h"
+#include "lambda.h"
+#include "ski.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// no sane request comes anywhere near this
+static const quint32 s_maximumFrame = 64 * 1024 * 1024;
+
+struct Server::Job {
+    Job() : fd(-1), done(false), status(HofContext::Running), reductions(0) { }
+    int fd;
+    bool done;
+    HofContext::Status status;
+    qint64 reductions;
+    QMutex mutex;
+    QWaitCondition finished;
+};
+
+class ServerConnection : public QThread {
+public:
+    ServerConnection(Server* server, int fd)
+        : m_server(server)
+        , m_fd(fd) { }
+
+    ~ServerConnection() { ::close(m_fd); }
+
+    void shutdown() { ::shutdown(m_fd, SHUT_RDWR); }
+
+protected:
+    void run()
+    {
+        char type;
+        QByteArray payload;
+        while (Server::readFrame(m_fd, &type, &payload)) {
+            switch (type) {
+            case Server::Request:
+                m_server->handle(m_fd, payload);
+                break;
+            case Server::Metrics:
+                Server::writeFrame(m_fd, Server::Metrics, QJsonDocument(m_server->metrics()).toJson(QJsonDocument::Compact));
+                break;
+            case Server::Quit:
+                Server::writeFrame(m_fd, Server::Metrics, QJsonDocument(m_server->metrics()).toJson(QJsonDocument::Compact));
+                m_server->stop();
+                return;
+            default:
+                return;
+            }
+        }
+    }
+
+private:
+    Server* m_server;
+    int m_fd;
+};
+
+static bool readFully(int fd, char* data, qint64 size)
+{
+    while (size > 0) {
+        ssize_t r = ::read(fd, data, size);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        data += r;
+        size -= r;
+    }
+    return true;
+}
+
+static bool writeFully(int fd, const char* data, qint64 size)
+{
+    while (size > 0) {
+        ssize_t w = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return false;
+        data += w;
+        size -= w;
+    }
+    return true;
+}
+
+bool Server::readFrame(int fd, char* type, QByteArray* payload)
+{
+    uchar header[5];
+    if (!readFully(fd, reinterpret_cast<char*>(header), sizeof(header)))
+        return false;
+
+    quint32 size = qFromBigEndian<quint32>(header + 1);
+    if (size > s_maximumFrame)
+        return false;
+
+    *type = header[0];
+    payload->resize(size);
+    return readFully(fd, payload->data(), size);
+}
+
+bool Server::writeFrame(int fd, char type, const QByteArray& payload)
+{
+    uchar header[5];
+    header[0] = type;
+    qToBigEndian<quint32>(payload.size(), header + 1);
+    return writeFully(fd, reinterpret_cast<const char*>(header), sizeof(header))
+        && writeFully(fd, payload.constData(), payload.size());
+}
+
+Server::Server(const QString& path, int threads, qint64 slice)
+    : m_path(path)
+    , m_listenFd(-1)
+    , m_stopped(0)
+    , m_threads(qMax(1, threads))
+    , m_cache(new EvaluationCache(EvaluationCache::Concurrent))
+    , m_scheduler(new Scheduler(this, m_threads, slice))
+    , m_requests(0)
+    , m_failed(0)
+    , m_reductions(0)
+{
+    m_scheduler->setCache(m_cache);
+}
+
+Server::~Server()
+{
+    stop();
+    foreach (ServerConnection* connection, m_connections) {
+        connection->wait();
+        delete connection;
+    }
+    delete m_scheduler;
+    delete m_cache;
+    if (m_listenFd != -1) {
+        ::close(m_listenFd);
+        ::unlink(QFile::encodeName(m_path).constData());
+    }
+}
+
+// a translation with no variables left means nothing about where the
+// definition is used can change it
+static bool isClosed(const QString& hof)
+{
+    foreach (QChar ch, hof) {
+        if (!QStringLiteral("IKSPRA").contains(ch))
+            return false;
+    }
+    return !hof.isEmpty();
+}
+
+void Server::preload(const QString& definitions)
+{
+    m_preloaded.append(definitions);
+    m_preloaded.append("\n");
+
+    // each definition is translated with all of them in scope, as the lines
+    // of a request would be, and anything else stays lambda text
+    QStringList lines;
+    QList<QStringList> named;
+    foreach (const QString& line, m_preloaded.split("\n")) {
+        QStringList split = line.split("=");
+        if (split.length() == 2)
+            named.append(split);
+        else
+            lines.append(line);
+    }
+
+    QString scope;
+    foreach (const QStringList& definition, named)
+        scope.append(definition.join("=") + "\n");
+
+    m_translated.clear();
+    foreach (const QStringList& definition, named) {
+        bool ok = true;
+        QString hof = Lambda::fromLambda(scope + definition.at(1).trimmed(), &ok);
+        if (ok && isClosed(hof))
+            m_translated.insert(definition.at(0).trimmed(), hof);
+        else
+            lines.append(definition.join("="));
+    }
+    m_definitions = withDefinitions(lines.join("\n")) + "\n";
+}
+
+// splices the translated definitions into a lambda program as {hof}
+QString Server::withDefinitions(const QString& lambda) const
+{
+    if (m_translated.isEmpty())
+        return lambda;
+
+    QString program = lambda;
+    QRegExp rx("\\{(\\w+)\\}");
+    int pos = 0;
+    while ((pos = rx.indexIn(program, pos)) != -1) {
+        QHash<QString, QString>::const_iterator it = m_translated.constFind(rx.cap(1));
+        if (it == m_translated.constEnd()) {
+            pos += rx.matchedLength();
+            continue;
+        }
+        QString hof = "{" + it.value() + "}";
+        program.replace(pos, rx.matchedLength(), hof);
+        pos += hof.length();
+    }
+    return program;
+}
+
+bool Server::listen()
+{
+    QByteArray path = QFile::encodeName(m_path);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (size_t(path.size()) >= sizeof(address.sun_path)) {
+        m_errorString = "socket path is too long: " + m_path;
+        return false;
+    }
+    memcpy(address.sun_path, path.constData(), path.size());
+
+    m_listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_listenFd == -1) {
+        m_errorString = QString::fromLocal8Bit(strerror(errno));
+        return false;
+    }
+
+    // a stale socket from a previous server would make bind fail
+    ::unlink(path.constData());
+    if (::bind(m_listenFd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1
+        || ::listen(m_listenFd, SOMAXCONN) == -1) {
+        m_errorString = QString::fromLocal8Bit(strerror(errno));
+        ::close(m_listenFd);
+        m_listenFd = -1;
+        return false;
+    }
+
+    m_uptime.start();
+    return true;
+}
+
+void Server::exec()
+{
+    Q_ASSERT(m_listenFd != -1);
+    while (!m_stopped.load()) {
+        int fd = ::accept(m_listenFd, 0, 0);
+        if (fd == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        QMutexLocker locker(&m_connectionsMutex);
+        if (m_stopped.load()) {
+            ::close(fd);
+            break;
+        }
+
+        // reap clients that have gone away
+        for (int i = m_connections.count() - 1; i >= 0; --i) {
+            if (m_connections.at(i)->isFinished())
+                delete m_connections.takeAt(i);
+        }
+
+        ServerConnection* connection = new ServerConnection(this, fd);
+        m_connections.append(connection);
+        connection->start();
+    }
+}
+
+void Server::stop()
+{
+    if (!m_stopped.testAndSetOrdered(0, 1))
+        return;
+
+    if (m_listenFd != -1)
+        ::shutdown(m_listenFd, SHUT_RDWR);
+
+    // requests still running finish as cancelled so their connections can end
+    m_scheduler->cancelAll();
+
+    QMutexLocker locker(&m_connectionsMutex);
+    foreach (ServerConnection* connection, m_connections)
+        connection->shutdown();
+}
+
+void Server::handle(int fd, const QByteArray& payload)
+{
+    QJsonParseError parseError;
+    QJsonDocument document = QJsonDocument::fromJson(payload, &parseError);
+    QJsonObject summary;
+
+    QString program;
+    QString error;
+    HofLimits limits = m_limits;
+    if (m_stopped.load()) {
+        error = "Error: the server is shutting down";
+    } else if (parseError.error != QJsonParseError::NoError || !document.isObject()) {
+        error = "Error: request is not a valid JSON object: " + parseError.errorString();
+    } else {
+        QJsonObject request = document.object();
+        program = request.value("program").toString();
+        QString translate = request.value("translate").toString();
+
+        bool ok = true;
+        if (translate == "ski")
+            program = Ski::fromSki(program, &ok);
+        else if (translate == "lambda")
+            program = Lambda::fromLambda(m_definitions + withDefinitions(program), &ok);
+        if (!ok)
+            error = program;
+
+        program += request.value("input").toString();
+
+        QJsonObject requestLimits = request.value("limits").toObject();
+        HofLimits asked;
+        asked.maxDepth = requestLimits.value("maxDepth").toInt(limits.maxDepth);
+        asked.maxReductions = qint64(requestLimits.value("maxReductions").toDouble());
+        asked.maxMsecs = qint64(requestLimits.value("maxTime").toDouble());
+        asked.maxMemory = qint64(requestLimits.value("maxMemory").toDouble());
+        asked.maxOutput = qint64(requestLimits.value("maxOutput").toDouble());
+        limits = limits.tightened(asked);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if (!error.isEmpty()) {
+        m_requests.fetchAndAddRelaxed(1);
+        m_failed.fetchAndAddRelaxed(1);
+        summary.insert("status", QStringLiteral("error"));
+        summary.insert("exit", -1);
+        summary.insert("error", error);
+    } else {
+        Job job;
+        job.fd = fd;
+        {
+            // hold the lock so a fast request cannot finish before it is known
+            QMutexLocker locker(&m_jobsMutex);
+            m_jobs.insert(m_scheduler->submit(program, limits), &job);
+        }
+
+        QMutexLocker locker(&job.mutex);
+        while (!job.done)
+            job.finished.wait(&job.mutex);
+
+        summary.insert("status", HofContext::statusName(job.status));
+        summary.insert("exit", HofContext::exitCode(job.status));
+        summary.insert("reductions", double(job.reductions));
+    }
+
+    summary.insert("msecs", timer.nsecsElapsed() / 1000000.0);
+    writeFrame(fd, End, QJsonDocument(summary).toJson(QJsonDocument::Compact));
+}
+
+void Server::output(int id, const QString& output)
+{
+    int fd;
+    {
+        QMutexLocker locker(&m_jobsMutex);
+        fd = m_jobs.value(id)->fd;
+    }
+    writeFrame(fd, Output, output.toUtf8());
+}
+
+void Server::finished(int id, HofContext::Status status, qint64 reductions)
+{
+    Job* job;
+    {
+        QMutexLocker locker(&m_jobsMutex);
+        job = m_jobs.take(id);
+    }
+
+    m_requests.fetchAndAddRelaxed(1);
+    if (status != HofContext::Finished)
+        m_failed.fetchAndAddRelaxed(1);
+    m_reductions.fetchAndAddRelaxed(reductions);
+
+    QMutexLocker locker(&job->mutex);
+    job->status = status;
+    job->reductions = reductions;
+    job->done = true;
+    job->finished.wakeAll();
+}
+
+QJsonObject Server::metrics() const
+{
+    EvaluationCache::Stats cache = m_cache->stats();
+    qreal seconds = qMax(qint64(1), m_uptime.nsecsElapsed()) / 1e9;
+
+    QJsonObject metrics;
+    metrics.insert("uptimeMsecs", seconds * 1000);
+    metrics.insert("requests", double(m_requests.load()));
+    metrics.insert("failed", double(m_failed.load()));
+    // each thread runs one request at a time, the others wait for their turn
+    int pending = m_scheduler->pending();
+    metrics.insert("queueDepth", qMax(0, pending - m_threads));
+    metrics.insert("active", qMin(pending, m_threads));
+    metrics.insert("threads", m_threads);
+    metrics.insert("reductions", double(m_reductions.load()));
+    metrics.insert("reductionsPerSec", m_reductions.load() / seconds);
+    metrics.insert("cacheSize", cache.size);
+    metrics.insert("cacheHitRate", cache.hitRate());
+    return metrics;
+}
+
+ServerClient::ServerClient()
+    : m_fd(-1)
+{ }
+
+ServerClient::~ServerClient()
+{
+    disconnect();
+}
+
+bool ServerClient::connectTo(const QString& path)
+{
+    disconnect();
+
+    QByteArray name = QFile::encodeName(path);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (size_t(name.size()) >= sizeof(address.sun_path))
+        return false;
+    memcpy(address.sun_path, name.constData(), name.size());
+
+    m_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_fd == -1)
+        return false;
+
+    if (::connect(m_fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1) {
+        disconnect();
+        return false;
+    }
+    return true;
+}
+
+void ServerClient::disconnect()
+{
+    if (m_fd != -1)
+        ::close(m_fd);
+    m_fd = -1;
+}
+
+QJsonObject ServerClient::request(const QJsonObject& request, QString* output)
+{
+    if (!Server::writeFrame(m_fd, Server::Request, QJsonDocument(request).toJson(QJsonDocument::Compact)))
+        return QJsonObject();
+
+    char type;
+    QByteArray payload;
+    while (Server::readFrame(m_fd, &type, &payload)) {
+        if (type == Server::Output && output)
+            output->append(QString::fromUtf8(payload));
+        else if (type == Server::End)
+            return QJsonDocument::fromJson(payload).object();
+    }
+    return QJsonObject();
+}
+
+QJsonObject ServerClient::metrics()
+{
+    char type;
+    QByteArray payload;
+    if (!Server::writeFrame(m_fd, Server::Metrics, QByteArray()) || !Server::readFrame(m_fd, &type, &payload))
+        return QJsonObject();
+    return QJsonDocument::fromJson(payload).object();
+}
+
+void ServerClient::quit()
+{
+    char type;
+    QByteArray payload;
+    if (Server::writeFrame(m_fd, Server::Quit, QByteArray()))
+        Server::readFrame(m_fd, &type, &payload);
+    disconnect();
+}
@@ -0,0 +1,126 @@
+#ifndef server_h
+#define server_h
+
+#include <QtCore>
+
+#include "context.h"
+#include "scheduler.h"
+
+class EvaluationCache;
+class ServerConnection;
+
+/**
+ * A long lived Hof daemon listening on a Unix domain socket.
+ *
+ * Every message is a frame: one type byte, a big endian 32 bit payload
+ * length and the payload.  Clients send
+ *
+ *   'R'  a JSON request with "program", optionally "input", "translate"
+ *        (ski|lambda) and "limits" with any of "maxDepth", "maxReductions",
+ *        "maxTime" (msecs), "maxMemory" (bytes) and "maxOutput" (characters),
+ *        limits can only be tightened below the server's own
+ *   'M'  an admin request for live metrics
+ *   'Q'  an admin request to shut the server down
+ *
+ * and the server answers a request with any number of 'O' frames carrying
+ * P output as it is printed followed by one 'E' frame with a JSON summary,
+ * and an admin request with one 'M' frame of JSON.
+ *
+ * Requests are interleaved on a Scheduler, so a runaway request only takes
+ * its share of a thread and the ones behind it still finish.  They share
+ * one concurrent evaluation cache that stays warm for the lifetime of the
+ * server; it only holds results computed without printing or choosing, so
+ * a repeated request prints the same as the first.  Lambda
+ * requests see every definition preloaded with preload(), which translates
+ * the closed ones to hof once so a request only splices them in.
+ */
+class Server : public SchedulerListener {
+public:
+    enum FrameType {
+        Request = 'R',
+        Metrics = 'M',
+        Quit = 'Q',
+        Output = 'O',
+        End = 'E'
+    };
+
+    Server(const QString& path, int threads, qint64 slice = 10000);
+    ~Server();
+
+    QString path() const { return m_path; }
+    QString errorString() const { return m_errorString; }
+
+    HofLimits limits() const { return m_limits; }
+    void setLimits(const HofLimits& limits) { m_limits = limits; }
+
+    // collector budget of every request, 0 for none
+    void setCollectorBudget(qint64 budget) { m_scheduler->setCollectorBudget(budget); }
+
+    // lambda definitions made available to every lambda request
+    void preload(const QString& definitions);
+
+    bool listen();
+
+    // accept connections until stop() is called
+    void exec();
+    void stop();
+
+    QJsonObject metrics() const;
+
+    static bool readFrame(int fd, char* type, QByteArray* payload);
+    static bool writeFrame(int fd, char type, const QByteArray& payload);
+
+    void output(int id, const QString& output);
+    void finished(int id, HofContext::Status status, qint64 reductions);
+
+private:
+    friend class ServerConnection;
+    struct Job;
+
+    Q_DISABLE_COPY(Server)
+    void handle(int fd, const QByteArray& payload);
+    QString withDefinitions(const QString& lambda) const;
+
+    QString m_path;
+    QString m_errorString;
+    QString m_preloaded;
+    QString m_definitions;                  // what is left as lambda text
+    QHash<QString, QString> m_translated;   // closed definitions as hof
+    HofLimits m_limits;
+    int m_listenFd;
+    QAtomicInt m_stopped;
+    int m_threads;
+    EvaluationCache* m_cache;
+    Scheduler* m_scheduler;
+    QHash<int, Job*> m_jobs;                // requests in flight by scheduler id
+    QMutex m_jobsMutex;
+    QList<ServerConnection*> m_connections;
+    QMutex m_connectionsMutex;
+    QElapsedTimer m_uptime;
+    QAtomicInteger<qint64> m_requests;
+    QAtomicInteger<qint64> m_failed;
+    QAtomicInteger<qint64> m_reductions;
+};
+
+/**
+ * A blocking client for Server, used by job runners and the tests.
+ */
+class ServerClient {
+public:
+    ServerClient();
+    ~ServerClient();
+
+    bool connectTo(const QString& path);
+    void disconnect();
+
+    // runs a request, appending streamed P output to output, and returns the summary
+    QJsonObject request(const QJsonObject& request, QString* output);
+    QJsonObject metrics();
+    void quit();
+
+private:
+    Q_DISABLE_COPY(ServerClient)
+    int m_fd;
+};
+
+#endif // server_h
@@ -0,0 +1,140 @@
+#include "sharing.h"
+
+#include "combinators.h"
+#include "parser.h"
+
+Sharing::Sharing(int minimumSize)
+    : m_minimumSize(minimumSize)
+    , m_names(0)
+{
+}
+
+QString Sharing::share(const QString& hof)
+{
+    QByteArray utf8 = hof.toUtf8();
+    Parser parser(1);
+    QElapsedTimer timer;
+    timer.start();
+    QList<CombinatorPtr> terms = parser.parse(utf8.constData(), utf8.size());
+    qint64 parseNsecs = timer.nsecsElapsed();
+    if (parser.stats().incomplete)
+        return hof;
+
+    QList<int> roots;
+    foreach (const CombinatorPtr& term, terms) {
+        int root = number(term.data());
+        ++m_nodes[root].parents;
+        roots.append(root);
+    }
+
+    QString shared;
+    foreach (int root, roots)
+        shared.append(write(root));
+
+    QByteArray sharedUtf8 = shared.toUtf8();
+    timer.restart();
+    parser.parse(sharedUtf8.constData(), sharedUtf8.size());
+    m_stats.parseNsecsBefore += parseNsecs;
+    m_stats.parseNsecsAfter += timer.nsecsElapsed();
+    m_stats.sizeBefore += hof.length();
+    m_stats.sizeAfter += shared.length();
+    m_stats.nodes += m_nodes.count();
+
+    m_nodes.clear();
+    m_symbols.clear();
+    m_applications.clear();
+    m_numbered.clear();
+    m_names = 0;
+    return shared;
+}
+
+// numbers the term bottom up without recursion, the input may be shared too
+int Sharing::number(const Combinator* term)
+{
+    QVector<QPair<const Combinator*, bool> > stack;
+    QVector<int> numbers;
+    stack.append(qMakePair(term, false));
+    while (!stack.isEmpty()) {
+        QPair<const Combinator*, bool> frame = stack.takeLast();
+        const Combinator* t = frame.first;
+        if (t->type() != Combinator::a_) {
+            numbers.append(number(t->toString()));
+        } else if (m_numbered.contains(t)) {
+            numbers.append(m_numbered.value(t));
+        } else if (!frame.second) {
+            const A* a = static_cast<const A*>(t);
+            stack.append(qMakePair(t, true));
+            stack.append(qMakePair<const Combinator*, bool>(a->right.data(), false));
+            stack.append(qMakePair<const Combinator*, bool>(a->left.data(), false));
+        } else {
+            int right = numbers.takeLast();
+            int left = numbers.takeLast();
+            int n = number(left, right);
+            m_numbered.insert(t, n);
+            numbers.append(n);
+        }
+    }
+    Q_ASSERT(numbers.count() == 1);
+    return numbers.last();
+}
+
+int Sharing::number(const QString& symbol)
+{
+    int n = m_symbols.value(symbol, -1);
+    if (n < 0) {
+        n = m_nodes.count();
+        m_symbols.insert(symbol, n);
+        m_nodes.append(Node());
+        m_nodes.last().symbol = symbol;
+    }
+    return n;
+}
+
+int Sharing::number(int left, int right)
+{
+    quint64 key = (quint64(uint(left)) << 32) | uint(right);
+    int n = m_applications.value(key, -1);
+    if (n >= 0)
+        return n;
+
+    // a new application is one more parent for each of its children
+    n = m_nodes.count();
+    m_applications.insert(key, n);
+    Node node;
+    node.left = left;
+    node.right = right;
+    node.size = 1 + m_nodes.at(left).size + m_nodes.at(right).size;
+    m_nodes.append(node);
+    ++m_nodes[left].parents;
+    ++m_nodes[right].parents;
+    return n;
+}
+
+QString Sharing::write(int root)
+{
+    QString text;
+    QVector<int> stack;
+    stack.append(root);
+    while (!stack.isEmpty()) {
+        Node& node = m_nodes[stack.takeLast()];
+        bool isShared = node.left >= 0 && node.parents > 1 && node.size >= m_minimumSize;
+        if (isShared && node.name >= 0) {
+            text.append(QString("@%1;").arg(node.name));
+            ++m_stats.references;
+            continue;
+        }
+        if (isShared) {
+            node.name = m_names++;
+            text.append('$');
+            ++m_stats.shared;
+        }
+        if (node.left < 0) {
+            text.append(node.symbol);
+            continue;
+        }
+        text.append('A');
+        stack.append(node.right);
+        stack.append(node.left);
+    }
+    return text;
+}
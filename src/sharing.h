@@ -0,0 +1,67 @@
+#ifndef sharing_h
+#define sharing_h
+
+#include <QtCore>
+
+class Combinator;
+
+/**
+ * Turns a hof program into a DAG by hash consing.  Every application is
+ * numbered by the numbers of its two children, bottom up, so structurally
+ * equal subterms get the same number however far apart they are.  A
+ * subterm that more than one application refers to is then written out
+ * once, after a $, and as @n; everywhere after that, where n counts the $
+ * written before it.
+ *
+ * The interpreter and the Parser both keep such nodes shared, so the
+ * translated program is smaller to store and quicker to parse, and the
+ * reducer sees one node where the tree had many.
+ */
+class Sharing {
+public:
+    struct Stats {
+        Stats() : sizeBefore(0), sizeAfter(0), nodes(0), shared(0), references(0), parseNsecsBefore(0), parseNsecsAfter(0) { }
+        int sizeBefore;             // characters
+        int sizeAfter;
+        int nodes;                  // distinct subterms
+        int shared;                 // written with $
+        int references;             // written as @n;
+        qint64 parseNsecsBefore;
+        qint64 parseNsecsAfter;
+    };
+
+    // subterms smaller than this are cheaper to repeat than to refer to
+    Sharing(int minimumSize = 4);
+
+    QString share(const QString& hof);
+
+    Stats stats() const { return m_stats; }
+    void clear() { m_stats = Stats(); }
+
+private:
+    struct Node {
+        Node() : left(-1), right(-1), size(1), parents(0), name(-1) { }
+        int left;       // both -1 for a symbol
+        int right;
+        qint64 size;    // symbols once written out in full
+        int parents;
+        int name;       // n of its $ once written
+        QString symbol;
+    };
+    Q_DISABLE_COPY(Sharing)
+
+    int number(const Combinator* term);
+    int number(const QString& symbol);
+    int number(int left, int right);
+    QString write(int root);
+
+    int m_minimumSize;
+    QVector<Node> m_nodes;
+    QHash<QString, int> m_symbols;
+    QHash<quint64, int> m_applications;
+    QHash<const Combinator*, int> m_numbered;
+    int m_names;
+    Stats m_stats;
+};
+
+#endif // sharing_h
@@ -1,4 +1,5 @@
 #include "ski.h"
+#include "lexer.h"
 #include "verbose.h"
 
 class SkiTerm {
@@ -78,25 +79,29 @@ private:
     bool m_closed;
 };
 
-QString Ski::fromSki(const QString& string, bool* ok)
+QString Ski::fromSki(const QString& string, bool* ok, Verbose* verbose)
 {
-    Verbose::instance()->generateProgramString("ski: " + string);
-    bool isSub = false;
-    QString sub = QString();
+    QByteArray utf8 = string.toUtf8();
+    return fromSki(utf8.constData(), utf8.size(), ok, verbose);
+}
+
+QString Ski::fromSki(const char* data, int length, bool* ok, Verbose* verbose)
+{
+    Lexer lexer(data, length, Lexer::SkiSyntax);
+    if (verbose && verbose->isVerbose())
+        verbose->generateProgramString("ski: " + lexer.toString());
     SkiSubTerm* subTerm = 0;
     QList<SkiTerm*> terms;
-    for (int x = 0; x < string.length(); x++) {
+    bool overflow = false;
+    while (!lexer.atEnd()) {
         SkiTerm* term = 0;
-        QChar ch = string.at(x);
-
-        if (isSub && ch != '}') {
-            sub.append(ch);
-            continue;
-        }
+        Lexer::Token token = lexer.next();
 
-        switch (ch.unicode()) {
-        case '(': term = new SkiSubTerm; break;
-        case ')':
+        switch (token.type) {
+        case Lexer::None: continue;
+        case Lexer::Overflow: overflow = true; continue;
+        case Lexer::LParen: term = new SkiSubTerm; break;
+        case Lexer::RParen:
             {
                 subTerm->close();
                 if (subTerm->isClosed()) {
@@ -105,21 +110,20 @@ QString Ski::fromSki(const QString& string, bool* ok)
                 }
                 continue;
             }
-        case 'S':
-        case 's': term = new SkiTerm("S"); break;
-        case 'K':
-        case 'k': term = new SkiTerm("K"); break;
-        case 'I':
-        case 'i': term = new SkiTerm("I"); break;
-        case '{': isSub = true; continue;
-        case '}':
-          {
-              term = new SkiTerm(sub);
-              isSub = false;
-              sub = QString();
-              break;
-          }
-        default: term = new SkiTerm(ch); break;
+        case Lexer::Sub: term = new SkiTerm(lexer.text(token)); break;
+        default:
+            {
+                switch (data[token.offset]) {
+                case 'S':
+                case 's': term = new SkiTerm("S"); break;
+                case 'K':
+                case 'k': term = new SkiTerm("K"); break;
+                case 'I':
+                case 'i': term = new SkiTerm("I"); break;
+                default: term = new SkiTerm(lexer.text(token)); break;
+                }
+                break;
+            }
         };
 
         if (subTerm)
@@ -133,6 +137,13 @@ QString Ski::fromSki(const QString& string, bool* ok)
     if (subTerm)
         terms.append(subTerm); // wasn't closed properly
 
+    if (overflow) {
+        qDeleteAll(terms);
+        if (ok)
+            *ok = false;
+        return QString("Error: from ski to hof: a substitution is longer than %1 bytes").arg(int(Lexer::MaximumLength));
+    }
+
     bool error = false;
     QString hof;
     QTextStream stream(&hof);
@@ -3,9 +3,14 @@
 
 #include <QtCore>
 
+class Verbose;
+
 class Ski {
 public:
-    static QString fromSki(const QString& ski, bool* ok = 0);
+    static QString fromSki(const QString& ski, bool* ok = 0, Verbose* verbose = 0);
+
+    // lexes a UTF-8 program in place, whitespace is ignored
+    static QString fromSki(const char* data, int length, bool* ok = 0, Verbose* verbose = 0);
 };
 
 #endif // ski_h
@@ -0,0 +1,278 @@
+#include "speculate.h"
+
+#include "cache.h"
+#include "threadpool.h"
+#include "verbose.h"
+
+// walking the term is not free so larger thunks are simply not sparked
+static const int s_maximumWalk = 1024;
+
+static bool isPure(const CombinatorPtr& term, int* size)
+{
+    QVector<const Combinator*> stack;
+    stack.append(term.data());
+    while (!stack.isEmpty()) {
+        const Combinator* c = stack.takeLast();
+        if (++*size > s_maximumWalk)
+            return false;
+
+        switch (c->type()) {
+        case Combinator::p_:
+        case Combinator::r_:
+        case Combinator::foreign_:
+            return false;
+        case Combinator::a_:
+          {
+              const A* a = static_cast<const A*>(c);
+              if (a->left)
+                  stack.append(a->left.data());
+              if (a->right)
+                  stack.append(a->right.data());
+              break;
+          }
+        case Combinator::capture_:
+          {
+              const Capture* cap = static_cast<const Capture*>(c);
+              stack.append(cap->callback.data());
+              foreach (const CombinatorPtr& arg, cap->args)
+                  stack.append(arg.data());
+              break;
+          }
+        case Combinator::numeral_:
+          {
+              const Numeral* n = static_cast<const Numeral*>(c);
+              if (n->function)
+                  stack.append(n->function.data());
+              break;
+          }
+        case Combinator::fix_:
+          {
+              const Fix* fix = static_cast<const Fix*>(c);
+              if (fix->function)
+                  stack.append(fix->function.data());
+              break;
+          }
+        case Combinator::primitive_:
+          {
+              const Primitive* p = static_cast<const Primitive*>(c);
+              if (p->left)
+                  stack.append(p->left.data());
+              if (p->right)
+                  stack.append(p->right.data());
+              break;
+          }
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+class SparkRunnable : public QRunnable {
+public:
+    SparkRunnable(Speculator* speculator, const SparkPtr& spark)
+        : m_speculator(speculator)
+        , m_spark(spark) { }
+
+    void run()
+    {
+        m_speculator->run(m_spark);
+    }
+
+private:
+    Speculator* m_speculator;
+    SparkPtr m_spark;
+};
+
+Spark::Spark(Speculator* speculator, const CombinatorPtr& left, const CombinatorPtr& right, int generation, int depth)
+    : m_speculator(speculator)
+    , m_left(left)
+    , m_right(right)
+    , m_generation(generation)
+    , m_depth(depth)
+    , m_speculated(false)
+    , m_state(Pending)
+    , m_used(0)
+    , m_cancelled(0)
+{ }
+
+bool Spark::claim()
+{
+    return m_state.testAndSetOrdered(Pending, Running);
+}
+
+void Spark::publish(const CombinatorPtr& result, bool ok)
+{
+    QMutexLocker locker(&m_mutex);
+    if (ok)
+        m_result = result;
+    m_state.storeRelease(ok ? Done : Failed);
+    m_published.wakeAll();
+}
+
+CombinatorPtr Spark::force(HofContext* context)
+{
+    forever {
+        switch (m_state.loadAcquire()) {
+        case Done:
+            // fitting under the limit from the spark's depth says nothing
+            // about a deeper force, which evaluates it again to stop where
+            // a sequential run would
+            if (m_speculated && context->evaluationDepth > m_depth)
+                return eval(context, m_left, m_right);
+            if (m_speculated && m_used.testAndSetRelaxed(0, 1))
+                m_speculator->m_converted.fetchAndAddRelaxed(1);
+            return m_result;
+        case Pending:
+          {
+              if (!claim())
+                  continue;
+              m_speculator->m_fizzled.fetchAndAddRelaxed(1);
+              CombinatorPtr result = eval(context, m_left, m_right);
+              publish(result, !context->isStopped());
+              return result;
+          }
+        case Running:
+          {
+              // workers never wait so they can never wait on each other
+              if (m_speculator->isWorker())
+                  return eval(context, m_left, m_right);
+
+              QMutexLocker locker(&m_mutex);
+              while (m_state.loadAcquire() == Running)
+                  m_published.wait(&m_mutex);
+              continue;
+          }
+        default:
+            return eval(context, m_left, m_right);
+        }
+    }
+}
+
+void Spark::run(HofContext* context)
+{
+    if (m_generation != m_speculator->m_generation.load())
+        cancel();
+
+    if (!claim()) {
+        if (m_state.loadAcquire() == Cancelled)
+            m_speculator->m_discarded.fetchAndAddRelaxed(1);
+        return;
+    }
+
+    context->reset();
+    context->evaluationDepth = m_depth;
+    context->setInterrupt(&m_cancelled);
+    CombinatorPtr result = eval(context, m_left, m_right);
+    bool ok = !context->isStopped();
+    context->setInterrupt(0);
+
+    m_speculated = ok;
+    if (ok)
+        m_speculator->m_completed.fetchAndAddRelaxed(1);
+    else if (m_cancelled.load())
+        m_speculator->m_discarded.fetchAndAddRelaxed(1);
+    else
+        m_speculator->m_failed.fetchAndAddRelaxed(1);
+    publish(result, ok);
+}
+
+void Spark::cancel()
+{
+    m_cancelled.store(1);
+    m_state.testAndSetOrdered(Pending, Cancelled);
+}
+
+Speculator::Speculator(int threads, const HofLimits& limits)
+    : m_pool(new WorkStealingPool(threads))
+    , m_cache(new EvaluationCache(EvaluationCache::Concurrent))
+    , m_generation(0)
+    , m_outstanding(0)
+    , m_minimumSize(8)
+    , m_sparked(0)
+    , m_converted(0)
+    , m_fizzled(0)
+    , m_completed(0)
+    , m_discarded(0)
+    , m_failed(0)
+{
+    for (int i = 0; i < m_pool->threadCount(); ++i) {
+        HofContext* context = new HofContext;
+        context->setCache(m_cache);
+        context->setLimits(limits);
+        context->setSpeculator(this);
+        m_contexts.append(context);
+    }
+}
+
+Speculator::~Speculator()
+{
+    cancelAll();
+    delete m_pool;
+    qDeleteAll(m_contexts);
+    delete m_cache;
+}
+
+bool Speculator::isWorker() const
+{
+    return m_pool->currentWorker() != -1;
+}
+
+SparkPtr Speculator::spark(HofContext* context, const CombinatorPtr& left, const CombinatorPtr& right)
+{
+    // the tracer prints evaluation in order and cannot follow other threads
+    if (context->verbose()->isVerbose())
+        return SparkPtr();
+
+    // every worker already has plenty queued up
+    if (m_outstanding.load() >= m_pool->threadCount() * 4)
+        return SparkPtr();
+
+    int size = 0;
+    if (!isPure(left, &size) || !isPure(right, &size) || size < m_minimumSize)
+        return SparkPtr();
+
+    SparkPtr spark(new Spark(this, left, right, m_generation.load(), context->evaluationDepth));
+    m_sparked.fetchAndAddRelaxed(1);
+    m_outstanding.ref();
+    m_pool->start(new SparkRunnable(this, spark));
+    return spark;
+}
+
+void Speculator::run(const SparkPtr& spark)
+{
+    HofContext* context = m_contexts.at(m_pool->currentWorker());
+
+    m_runningMutex.lock();
+    m_running.append(spark.data());
+    m_runningMutex.unlock();
+
+    spark->run(context);
+
+    m_runningMutex.lock();
+    m_running.removeOne(spark.data());
+    m_runningMutex.unlock();
+
+    m_outstanding.deref();
+}
+
+void Speculator::cancelAll()
+{
+    m_generation.ref();
+
+    QMutexLocker locker(&m_runningMutex);
+    foreach (Spark* spark, m_running)
+        spark->cancel();
+}
+
+Speculator::Stats Speculator::stats() const
+{
+    Stats stats;
+    stats.sparked = m_sparked.load();
+    stats.converted = m_converted.load();
+    stats.fizzled = m_fizzled.load();
+    stats.completed = m_completed.load();
+    stats.discarded = m_discarded.load();
+    stats.failed = m_failed.load();
+    return stats;
+}
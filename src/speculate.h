@@ -0,0 +1,128 @@
+#ifndef speculate_h
+#define speculate_h
+
+#include "combinators.h"
+#include "context.h"
+
+#include <QtCore>
+
+class EvaluationCache;
+class Speculator;
+class WorkStealingPool;
+
+/**
+ * A pure thunk that has been handed to the speculator.  Whoever gets to it
+ * first evaluates it: a pool worker running it in the background or the
+ * thread that forces the thunk.  Once a value is published every later
+ * force of the thunk simply returns it.
+ */
+class Spark {
+public:
+    enum State {
+        Pending,
+        Running,
+        Done,
+        Failed,
+        Cancelled
+    };
+
+    Spark(Speculator* speculator, const CombinatorPtr& left, const CombinatorPtr& right, int generation, int depth);
+
+    // the value of left applied to right, evaluating it inline if need be
+    CombinatorPtr force(HofContext* context);
+
+    // background evaluation on a pool worker
+    void run(HofContext* context);
+
+    // called once nobody can force the thunk anymore
+    void cancel();
+
+private:
+    friend class Speculator;
+    Q_DISABLE_COPY(Spark)
+    bool claim();
+    void publish(const CombinatorPtr& result, bool ok);
+
+    Speculator* m_speculator;
+    CombinatorPtr m_left;
+    CombinatorPtr m_right;
+    CombinatorPtr m_result;
+    int m_generation;
+    int m_depth;            // evaluation depth of the context that sparked it
+    bool m_speculated;
+    QAtomicInt m_state;
+    QAtomicInt m_used;
+    QAtomicInt m_cancelled;
+    QMutex m_mutex;
+    QWaitCondition m_published;
+};
+
+/**
+ * Opt-in parallel reduction.  S::apply evaluates xz eagerly but leaves yz
+ * as a lazy thunk; when yz contains no P or R it is independent of the
+ * spine, so the speculator sparks it onto a work stealing pool where an
+ * idle core can reduce it while the spine carries on.
+ *
+ * Work is only ever duplicated, never reordered, so output is identical to
+ * a sequential run.  A spark is evaluated from the depth it was sparked at
+ * and its result is only taken by a force no deeper than that, so the
+ * depth limit stops a program exactly where it stops a sequential run.  Sparks whose thunk is dropped before a worker gets to
+ * them are cancelled and running ones are interrupted.  Only the thread
+ * driving the program ever blocks on a running spark; pool workers
+ * evaluate the thunk themselves instead so they can never wait on each
+ * other.
+ */
+class Speculator {
+public:
+    struct Stats {
+        Stats() : sparked(0), converted(0), fizzled(0), completed(0), discarded(0), failed(0) { }
+        qint64 sparked;
+        qint64 converted;
+        qint64 fizzled;
+        qint64 completed;
+        qint64 discarded;
+        qint64 failed;
+    };
+
+    Speculator(int threads, const HofLimits& limits = HofLimits());
+    ~Speculator();
+
+    // concurrent cache that contexts using this speculator must share
+    EvaluationCache* cache() const { return m_cache; }
+
+    // thunks smaller than this are cheaper to reduce than to spark
+    int minimumSize() const { return m_minimumSize; }
+    void setMinimumSize(int size) { m_minimumSize = size; }
+
+    // returns a spark for the thunk left applied to right if it is worth one
+    SparkPtr spark(HofContext* context, const CombinatorPtr& left, const CombinatorPtr& right);
+
+    // drop all outstanding speculative work
+    void cancelAll();
+
+    Stats stats() const;
+
+private:
+    friend class Spark;
+    friend class SparkRunnable;
+    Q_DISABLE_COPY(Speculator)
+    bool isWorker() const;
+    void run(const SparkPtr& spark);
+
+    WorkStealingPool* m_pool;
+    EvaluationCache* m_cache;
+    QList<HofContext*> m_contexts;
+    QVector<Spark*> m_running;
+    QMutex m_runningMutex;
+    QAtomicInt m_generation;
+    QAtomicInt m_outstanding;
+    int m_minimumSize;
+    mutable QAtomicInteger<qint64> m_sparked;
+    mutable QAtomicInteger<qint64> m_converted;
+    mutable QAtomicInteger<qint64> m_fizzled;
+    mutable QAtomicInteger<qint64> m_completed;
+    mutable QAtomicInteger<qint64> m_discarded;
+    mutable QAtomicInteger<qint64> m_failed;
+};
+
+#endif // speculate_h
@@ -0,0 +1,295 @@
+#ifndef statichof_h
+#define statichof_h
+
+#include <QtCore>
+
+#include "combinators.h"
+
+/**
+ * Hof programs parsed, and where possible normalized, by the compiler.
+ *
+ * parseHof() turns a string literal into a static table of nodes so an
+ * embedded program costs nothing to parse at startup:
+ *
+ *     static constexpr auto isZero = parseHof("AASAASIAKAKAKIAKK");
+ *     hof.run(isZero.terms());
+ *
+ * normalizeHof() also reduces the program to its normal form at compile
+ * time, leftmost outermost with a bound on the reductions.  Programs that
+ * use P or R are left alone since printing and randomness only make sense
+ * at runtime, and so is anything that runs out of fuel or room.
+ *
+ *     static_assert(normalizeHof("AASAASIAKAKAKIAKK" "AKI").equals("K"), "");
+ *
+ * Only ascii programs are supported.
+ */
+template <int Capacity>
+class StaticHof {
+public:
+    enum Status {
+        Parsed,
+        Normalized,
+        Incomplete,     // an application is missing an argument
+        Unsupported,    // a symbol outside of ascii
+        Impure,         // P or R would be reduced at compile time
+        Overflow,       // more nodes than Capacity
+        OutOfFuel,      // no normal form within the reduction bound
+        TooDeep
+    };
+
+    constexpr StaticHof()
+        : m_symbol()
+        , m_left()
+        , m_right()
+        , m_roots()
+        , m_size(0)
+        , m_rootCount(0)
+        , m_status(Parsed) { }
+
+    // forgets the program without touching the tables, for reuse at runtime
+    constexpr void clear()
+    {
+        m_size = 0;
+        m_rootCount = 0;
+        m_status = Parsed;
+    }
+
+    constexpr Status status() const { return m_status; }
+    constexpr bool isValid() const { return m_status == Parsed || m_status == Normalized; }
+    constexpr bool isNormalized() const { return m_status == Normalized; }
+    constexpr int size() const { return m_size; }
+    constexpr int termCount() const { return m_rootCount; }
+
+    // parses the symbols of a program, whitespace is skipped
+    constexpr void parse(const char* program, int length)
+    {
+        // right to left a prefix program needs nothing but a stack of terms,
+        // which m_roots doubles as
+        for (int i = length - 1; i >= 0 && isValid(); --i) {
+            char ch = program[i];
+            if (ch == ' ' || (ch >= '\t' && ch <= '\r') || ch == '\0')
+                continue;
+            if (uchar(ch) >= 0x80) {
+                m_status = Unsupported;
+                return;
+            }
+            if (ch != 'A') {
+                m_roots[m_rootCount++] = node(ch);
+                continue;
+            }
+            if (m_rootCount < 2) {
+                m_status = Incomplete;
+                return;
+            }
+            int left = m_roots[--m_rootCount];
+            int right = m_roots[--m_rootCount];
+            m_roots[m_rootCount++] = node('A', left, right);
+        }
+
+        // the first term ends up on top of the stack
+        for (int i = 0; i < m_rootCount / 2; ++i) {
+            int root = m_roots[i];
+            m_roots[i] = m_roots[m_rootCount - 1 - i];
+            m_roots[m_rootCount - 1 - i] = root;
+        }
+    }
+
+    // reduces the program, applying each term to the result of the last
+    constexpr void normalize(int fuel)
+    {
+        if (!isValid() || !m_rootCount)
+            return;
+
+        for (int i = 0; i < m_size; ++i) {
+            if (m_symbol[i] == 'P' || m_symbol[i] == 'R') {
+                m_status = Impure;
+                return;
+            }
+        }
+
+        int term = m_roots[0];
+        for (int i = 1; i < m_rootCount && isValid(); ++i)
+            term = node('A', term, m_roots[i]);
+        term = normal(term, &fuel, 0);
+        if (!isValid())
+            return;
+
+        m_roots[0] = term;
+        m_rootCount = 1;
+        m_status = Normalized;
+    }
+
+    // compares the program, as hof without whitespace, against text
+    template <int N>
+    constexpr bool equals(const char (&text)[N]) const
+    {
+        int position = 0;
+        int stack[Capacity] = { };
+        for (int r = 0; r < m_rootCount; ++r) {
+            int depth = 0;
+            stack[depth++] = m_roots[r];
+            while (depth) {
+                int n = stack[--depth];
+                if (position >= N - 1 || text[position++] != m_symbol[n])
+                    return false;
+                if (m_symbol[n] == 'A') {
+                    // shared nodes can spell out more than Capacity symbols
+                    if (depth + 2 > Capacity)
+                        return false;
+                    stack[depth++] = m_right[n];
+                    stack[depth++] = m_left[n];
+                }
+            }
+        }
+        return isValid() && position == N - 1;
+    }
+
+    // the terms ready to be run with Hof::run
+    QList<CombinatorPtr> terms() const
+    {
+        QList<CombinatorPtr> terms;
+        for (int r = 0; r < m_rootCount; ++r)
+            terms.append(combinator(m_roots[r]));
+        return terms;
+    }
+
+    QString toString() const
+    {
+        QString string;
+        foreach (const CombinatorPtr& term, terms())
+            string.append(term->toString());
+        return string;
+    }
+
+private:
+    constexpr int node(char symbol, int left = -1, int right = -1)
+    {
+        if (m_size == Capacity) {
+            m_status = Overflow;
+            return 0;
+        }
+        m_symbol[m_size] = symbol;
+        m_left[m_size] = left;
+        m_right[m_size] = right;
+        return m_size++;
+    }
+
+    static constexpr int arity(char symbol)
+    {
+        return symbol == 'I' ? 1 : symbol == 'K' ? 2 : symbol == 'S' ? 3 : 0;
+    }
+
+    // the ith argument of a spine with count arguments
+    constexpr int argument(int term, int count, int i) const
+    {
+        for (int n = count - 1; n > i; --n)
+            term = m_left[term];
+        return m_right[term];
+    }
+
+    constexpr int head(int term, int* count) const
+    {
+        *count = 0;
+        while (m_symbol[term] == 'A') {
+            term = m_left[term];
+            ++*count;
+        }
+        return term;
+    }
+
+    // reduces the head until it is stuck or short of arguments
+    constexpr int weak(int term, int* fuel)
+    {
+        while (isValid()) {
+            int count = 0;
+            char symbol = m_symbol[head(term, &count)];
+            int needed = arity(symbol);
+            if (!needed || count < needed)
+                return term;
+
+            if (--*fuel < 0) {
+                m_status = OutOfFuel;
+                return term;
+            }
+
+            int x = argument(term, count, 0);
+            int reduced = x;
+            if (symbol == 'S') {
+                int y = argument(term, count, 1);
+                int z = argument(term, count, 2);
+                reduced = node('A', node('A', x, z), node('A', y, z));
+            }
+            for (int i = needed; i < count; ++i)
+                reduced = node('A', reduced, argument(term, count, i));
+            term = reduced;
+        }
+        return term;
+    }
+
+    constexpr int normal(int term, int* fuel, int depth)
+    {
+        if (depth > 200) {
+            m_status = TooDeep;
+            return term;
+        }
+
+        term = weak(term, fuel);
+        int count = 0;
+        int reduced = head(term, &count);
+        bool changed = false;
+        for (int i = 0; i < count && isValid(); ++i) {
+            int before = argument(term, count, i);
+            int after = normal(before, fuel, depth + 1);
+            changed = changed || after != before;
+            reduced = node('A', reduced, after);
+        }
+        return changed ? reduced : term;
+    }
+
+    CombinatorPtr combinator(int n) const
+    {
+        switch (m_symbol[n]) {
+        case 'I': return i();
+        case 'K': return k();
+        case 'S': return s();
+        case 'P': return p();
+        case 'R': return r();
+        case 'A':
+            {
+                A* a = new A;
+                a->left = combinator(m_left[n]);
+                a->right = combinator(m_right[n]);
+                return CombinatorPtr(a);
+            }
+        default: return CombinatorPtr(new Var(QChar(m_symbol[n])));
+        }
+    }
+
+    char m_symbol[Capacity];
+    int m_left[Capacity];
+    int m_right[Capacity];
+    int m_roots[Capacity];
+    int m_size;
+    int m_rootCount;
+    Status m_status;
+};
+
+template <int N>
+constexpr StaticHof<N> parseHof(const char (&program)[N])
+{
+    StaticHof<N> hof;
+    hof.parse(program, N - 1);
+    return hof;
+}
+
+// normal forms are often larger than the program, so room is given apart
+template <int Capacity = 1024, int N>
+constexpr StaticHof<Capacity> normalizeHof(const char (&program)[N], int fuel = 10000)
+{
+    StaticHof<Capacity> hof;
+    hof.parse(program, N - 1);
+    hof.normalize(fuel);
+    return hof;
+}
+
+#endif // statichof_h
@@ -1,6 +1,36 @@
 #include <QtCore>
+#include <limits>
 #include <random>
 
+#if defined(Q_OS_UNIX)
+#include <unistd.h>
+#endif
+
+#include "batch.h"
+#include "cache.h"
+#include "collector.h"
+#include "colors.h"
+#include "ffi.h"
+#include "fiber.h"
+#include "fixpoints.h"
+#include "combinators.h"
+#include "hof.h"
+#include "interactionnet.h"
+#include "lambda.h"
+#include "lambdamachine.h"
+#include "lexer.h"
+#include "numerals.h"
+#include "libhof.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "partial.h"
+#include "sampler.h"
+#include "scheduler.h"
+#include "server.h"
+#include "sharing.h"
+#include "ski.h"
+#include "speculate.h"
+#include "statichof.h"
 #include "testhof.h"
 
 enum Expectation {
@@ -76,6 +106,43 @@ QString runHof(const QString& program,
     return hof.readAll().trimmed();
 }
 
+// both sides of an application are the very same node
+static bool isSharedApplication(const CombinatorPtr& term)
+{
+    if (term->type() != Combinator::a_)
+        return false;
+    const A* a = static_cast<const A*>(term.data());
+    return a->left == a->right && a->isWellFormed();
+}
+
+// a complete application of left to right
+static CombinatorPtr application(const CombinatorPtr& left, const CombinatorPtr& right)
+{
+    A* a = new A;
+    a->left = left;
+    a->right = right;
+    a->isComplete = true;
+    return CombinatorPtr(a);
+}
+
+// an unevaluated application like the ones S makes
+static CombinatorPtr thunk(const CombinatorPtr& left, const CombinatorPtr& right)
+{
+    CombinatorPtr term = application(left, right);
+    static_cast<A*>(term.data())->isThunk = true;
+    return term;
+}
+
+static CombinatorPtr force(HofContext* context, const CombinatorPtr& term)
+{
+    return static_cast<const A*>(term.data())->apply(context);
+}
+
+static bool isForced(const CombinatorPtr& term)
+{
+    return !static_cast<const A*>(term.data())->forced.isNull();
+}
+
 // built-in combinators
 #define I "I"
 #define K "K"
@@ -475,3 +542,1808 @@ void TestHof::testTranslateLambda()
     QVERIFY(ok);
 }
 
+
+class HofThread : public QThread {
+public:
+    HofThread(const QString& program)
+        : status(HofContext::Running)
+        , m_program(program) { }
+
+    QString output;
+    HofContext::Status status;
+
+protected:
+    void run()
+    {
+        QTextStream stream(&output);
+        Hof hof(&stream);
+        status = hof.run(m_program);
+        stream.flush();
+    }
+
+private:
+    QString m_program;
+};
+
+void TestHof::testEmbeddedEngines()
+{
+    QList<HofThread*> threads;
+    for (int i = 0; i < 8; ++i) {
+        QString program = i % 2 ? QString(DEC(FIVE)) + PRINT(I) : QString(FOUR) + PRINT(K);
+        threads.append(new HofThread(program));
+    }
+
+    foreach (HofThread* thread, threads)
+        thread->start();
+    foreach (HofThread* thread, threads)
+        thread->wait();
+
+    for (int i = 0; i < threads.count(); ++i) {
+        QCOMPARE(threads.at(i)->output, QString(i % 2 ? "IIII" : "KKKK"));
+        QCOMPARE(threads.at(i)->status, HofContext::Finished);
+    }
+    qDeleteAll(threads);
+
+    // an engine survives exceeding the stack depth and can be reused
+    QString out;
+    QTextStream stream(&out);
+    Hof hof(&stream);
+    QCOMPARE(hof.run(QString(Y("AASIK"))), HofContext::DepthExceeded);
+    QCOMPARE(hof.run(QString(TWO) + PRINT(I)), HofContext::Finished);
+    stream.flush();
+    QCOMPARE(out, QString("II"));
+}
+
+void TestHof::testBatchBenchmark()
+{
+    int jobs = 100;
+    QString program = QString(DEC(FIVE)) + PRINT(I);
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < jobs; ++i) {
+        bool ok = false;
+        QString out = runHof(program, &ok);
+        QCOMPARE(out, QString("IIII"));
+        QVERIFY(ok);
+    }
+    qreal processRate = jobs * 1000.0 / qMax(qint64(1), timer.elapsed());
+
+    QTemporaryFile jobsFile;
+    QVERIFY(jobsFile.open());
+    for (int i = 0; i < jobs; ++i)
+        jobsFile.write(program.toUtf8() + "\n");
+    jobsFile.flush();
+
+    QDir bin(QCoreApplication::applicationDirPath());
+    QProcess hof;
+    hof.setProgram(bin.path() + QDir::separator() + "hof");
+    hof.setArguments(QStringList() << "--batch" << jobsFile.fileName());
+
+    timer.start();
+    hof.start();
+    QVERIFY(hof.waitForFinished(30000));
+    qreal batchRate = jobs * 1000.0 / qMax(qint64(1), timer.elapsed());
+
+    QList<QByteArray> results = hof.readAllStandardOutput().trimmed().split('\n');
+    QCOMPARE(results.count(), jobs);
+    for (int i = 0; i < results.count(); ++i) {
+        QJsonObject result = QJsonDocument::fromJson(results.at(i)).object();
+        QCOMPARE(result.value("id").toInt(), i);
+        QCOMPARE(result.value("exit").toInt(), EXIT_SUCCESS);
+        QCOMPARE(result.value("output").toString(), QString("IIII"));
+    }
+    QCOMPARE(hof.exitStatus(), QProcess::NormalExit);
+    QCOMPARE(hof.exitCode(), EXIT_SUCCESS);
+
+    // a failed job fails the batch
+    jobsFile.write(QByteArray(Y("AASIK")) + "\n");
+    jobsFile.flush();
+    hof.start();
+    QVERIFY(hof.waitForFinished(30000));
+    QCOMPARE(hof.readAllStandardOutput().trimmed().split('\n').count(), jobs + 1);
+    QVERIFY(hof.exitCode() != EXIT_SUCCESS);
+
+    // options a job cannot carry are rejected rather than ignored
+    hof.setArguments(QStringList() << "--batch" << jobsFile.fileName() << "--literals");
+    hof.start();
+    QVERIFY(hof.waitForFinished(30000));
+    QVERIFY(hof.readAllStandardOutput().isEmpty());
+    QVERIFY(hof.exitCode() != EXIT_SUCCESS);
+
+    // the rates depend on the machine and its load, so they are reported
+    // and only the results are checked
+    qDebug() << "jobs" << jobs
+             << "process jobs/sec" << processRate
+             << "batch jobs/sec" << batchRate;
+}
+
+void TestHof::testSharedCacheScaling()
+{
+    QByteArray jobs;
+    QStringList expected;
+    for (int i = 0; i < 16; ++i) {
+        jobs += QByteArray(DEC(FIVE)) + PRINT(I) + "\n";
+        expected << "IIII";
+        jobs += QByteArray(SUBTRACT(THREE, ONE)) + PRINT(K) + "\n";
+        expected << "KK";
+        jobs += QByteArray(IF("A" ISNIL("A" FIRST("AA" CONS(ONE, NIL))), PTERM(I), PTERM(K))) + "\n";
+        expected << "K";
+        // prints through a nested application, every worker must print it
+        jobs += QByteArray("AA" "AKP" I S) + "\n";
+        expected << "S";
+    }
+
+    QList<int> threadCounts = QList<int>() << 1 << 2 << 4 << QThread::idealThreadCount();
+    foreach (int threads, threadCounts) {
+        QString out;
+        QTextStream stream(&out);
+        Batch batch(&stream, threads);
+        batch.setSharedCache(true);
+        batch.addJobs(jobs);
+
+        QElapsedTimer timer;
+        timer.start();
+        QCOMPARE(batch.run(), 0);
+        qint64 nsecs = qMax(qint64(1), timer.nsecsElapsed());
+
+        QStringList results = out.trimmed().split("\n");
+        QCOMPARE(results.count(), expected.count());
+        for (int i = 0; i < results.count(); ++i) {
+            QJsonObject result = QJsonDocument::fromJson(results.at(i).toUtf8()).object();
+            QCOMPARE(result.value("output").toString(), expected.at(i));
+        }
+
+        EvaluationCache::Stats stats = batch.sharedCache()->stats();
+        QVERIFY(stats.hits > 0);
+
+        qDebug() << "threads" << threads
+                 << "jobs/sec" << batch.jobCount() * 1e9 / nsecs
+                 << "hit rate" << stats.hitRate()
+                 << "contended" << stats.contended << "of" << stats.locks;
+    }
+}
+
+void TestHof::testCachedEffects()
+{
+    // K P I is P, so the application prints K although its head is K; an
+    // engine reused for the next job must not serve it from its cache
+    QByteArray jobs;
+    for (int i = 0; i < 64; ++i)
+        jobs += QByteArray("AA" "AKP" I K "\n") + "AP" "AA" "AAKR" I K S "\n";
+
+    for (int shared = 0; shared < 2; ++shared) {
+        QString out;
+        QTextStream stream(&out);
+        Batch batch(&stream, shared ? 4 : 1);
+        batch.setSharedCache(shared);
+        batch.addJobs(jobs);
+        QCOMPARE(batch.run(), 0);
+
+        QStringList results = out.trimmed().split("\n");
+        QCOMPARE(results.count(), 128);
+        QSet<QString> choices;
+        for (int i = 0; i < results.count(); ++i) {
+            QJsonObject result = QJsonDocument::fromJson(results.at(i).toUtf8()).object();
+            if (i % 2)
+                choices.insert(result.value("output").toString());
+            else
+                QCOMPARE(result.value("output").toString(), QString("K"));
+        }
+
+        // nor is a choice R made further in remembered
+        QCOMPARE(choices, QSet<QString>() << "K" << "S");
+    }
+}
+
+void TestHof::testParallelReduction()
+{
+    // nine squared, a pure computation with a little output at the end
+    QString program = QString("AA") + TWO + INC(INC(INC(INC(INC(INC(INC(TWO))))))) + PRINT(I);
+
+    QString sequential;
+    QTextStream sequentialStream(&sequential);
+    QElapsedTimer timer;
+    timer.start();
+    {
+        Hof hof(&sequentialStream);
+        QCOMPARE(hof.run(program), HofContext::Finished);
+    }
+    qint64 sequentialNsecs = timer.nsecsElapsed();
+    QCOMPARE(sequential.count("I"), 81);
+
+    Speculator speculator(QThread::idealThreadCount());
+    QString parallel;
+    QTextStream parallelStream(&parallel);
+    timer.restart();
+    {
+        Hof hof(&parallelStream);
+        hof.context()->setCache(speculator.cache());
+        hof.context()->setSpeculator(&speculator);
+        QCOMPARE(hof.run(program), HofContext::Finished);
+    }
+    qint64 parallelNsecs = timer.nsecsElapsed();
+    QCOMPARE(parallel, sequential);
+
+    Speculator::Stats stats = speculator.stats();
+    QVERIFY(stats.sparked > 0);
+
+    qDebug() << "sequential msecs" << sequentialNsecs / 1000000.0
+             << "parallel msecs" << parallelNsecs / 1000000.0
+             << "sparked" << stats.sparked << "converted" << stats.converted
+             << "fizzled" << stats.fizzled << "discarded" << stats.discarded;
+}
+
+void TestHof::testParallelDepthLimit()
+{
+    // sparks are reduced on other threads from the depth they were sparked
+    // at, so every depth limit stops a parallel run where it stops a
+    // sequential one
+    QString program = QString("AA") + TWO + INC(INC(INC(INC(INC(INC(INC(TWO))))))) + PRINT(I);
+    int runs = 0;
+    int finished = 0;
+    for (int depth = 8; depth <= HofLimits().maxDepth; depth += 8, ++runs) {
+        HofLimits limits;
+        limits.maxDepth = depth;
+
+        QString sequential;
+        QTextStream sequentialStream(&sequential);
+        HofContext::Status expected;
+        {
+            Hof hof(&sequentialStream);
+            hof.context()->setLimits(limits);
+            expected = hof.run(program);
+        }
+
+        Speculator speculator(QThread::idealThreadCount(), limits);
+        QString parallel;
+        QTextStream parallelStream(&parallel);
+        HofContext::Status actual;
+        {
+            Hof hof(&parallelStream);
+            hof.context()->setLimits(limits);
+            hof.context()->setCache(speculator.cache());
+            hof.context()->setSpeculator(&speculator);
+            actual = hof.run(program);
+        }
+        speculator.cancelAll();
+
+        QCOMPARE(HofContext::exitCode(actual), HofContext::exitCode(expected));
+        if (expected == HofContext::Finished) {
+            sequentialStream.flush();
+            parallelStream.flush();
+            QCOMPARE(parallel, sequential);
+            ++finished;
+        }
+    }
+
+    // the sweep reaches both sides of the limit
+    QVERIFY(finished > 0);
+    QVERIFY(finished < runs);
+}
+
+void TestHof::testMonteCarlo()
+{
+    QString program = RANDOM(PTERM(I), PTERM(K));
+
+    Sampler sequential(1);
+    sequential.setSeed(42);
+    QCOMPARE(sequential.run(program, 2000), 0);
+    QList<Sampler::Bucket> expected = sequential.histogram();
+
+    QCOMPARE(expected.count(), 2);
+    QCOMPARE(expected.at(0).count + expected.at(1).count, 2000);
+    QVERIFY(expected.at(1).count > 800);
+
+    // the same seed gives the same histogram however the samples are spread
+    Sampler parallel(4);
+    parallel.setSeed(42);
+    QCOMPARE(parallel.run(program, 2000), 0);
+    QList<Sampler::Bucket> actual = parallel.histogram();
+
+    QCOMPARE(actual.count(), expected.count());
+    for (int i = 0; i < actual.count(); ++i) {
+        QCOMPARE(actual.at(i).output, expected.at(i).output);
+        QCOMPARE(actual.at(i).count, expected.at(i).count);
+    }
+}
+
+class ServerThread : public QThread {
+public:
+    ServerThread(Server* server) : m_server(server) { }
+    void run() { m_server->exec(); }
+
+private:
+    Server* m_server;
+};
+
+void TestHof::testServer()
+{
+    QTemporaryDir dir;
+    Server server(dir.path() + "/hof.sock", 2);
+    server.preload(QString::fromUtf8("p = {P}\ntrue = \u03bbx.\u03bby.x"));
+    server.preload(QString::fromUtf8("pf = {p} f"));
+    QVERIFY2(server.listen(), qPrintable(server.errorString()));
+
+    ServerThread thread(&server);
+    thread.start();
+
+    ServerClient client;
+    QVERIFY(client.connectTo(server.path()));
+
+    QString out;
+    QJsonObject request;
+    request.insert("program", QString(DEC(FIVE)));
+    request.insert("input", QString(PRINT(I)));
+    QJsonObject summary = client.request(request, &out);
+    QCOMPARE(summary.value("status").toString(), QString("finished"));
+    QCOMPARE(out, QString("IIII"));
+
+    // per request limits
+    out.clear();
+    QJsonObject limits;
+    limits.insert("maxDepth", 50);
+    request = QJsonObject();
+    request.insert("program", QString(Y("AASIK")));
+    request.insert("limits", limits);
+    summary = client.request(request, &out);
+    QCOMPARE(summary.value("status").toString(), QString("depth-exceeded"));
+    QCOMPARE(summary.value("exit").toInt(), 2);
+
+    // preloaded definitions
+    out.clear();
+    request = QJsonObject();
+    request.insert("program", QString("({p})({true})"));
+    request.insert("translate", QString("lambda"));
+    summary = client.request(request, &out);
+    QCOMPARE(summary.value("status").toString(), QString("finished"));
+    QCOMPARE(out, QString("K"));
+
+    // a definition with a free variable is bound where it is used
+    out.clear();
+    request.insert("program", QString::fromUtf8("(\u03bbf.{pf})({true})"));
+    summary = client.request(request, &out);
+    QCOMPARE(summary.value("status").toString(), QString("finished"));
+    QCOMPARE(out, QString("K"));
+
+    // the cache is shared between requests, a repeated program that prints
+    // through a nested application prints every time
+    for (int i = 0; i < 2; ++i) {
+        out.clear();
+        request = QJsonObject();
+        request.insert("program", QString("AA" "AKP" I K));
+        summary = client.request(request, &out);
+        QCOMPARE(summary.value("status").toString(), QString("finished"));
+        QCOMPARE(out, QString("K"));
+    }
+
+    QJsonObject metrics = client.metrics();
+    QCOMPARE(metrics.value("requests").toInt(), 6);
+    QCOMPARE(metrics.value("failed").toInt(), 1);
+    QCOMPARE(metrics.value("queueDepth").toInt(), 0);
+    QVERIFY(metrics.value("cacheSize").toInt() > 0);
+    QVERIFY(metrics.value("reductionsPerSec").toDouble() > 0);
+
+    client.quit();
+    QVERIFY(thread.wait(5000));
+}
+
+class RequestThread : public QThread {
+public:
+    RequestThread(const QJsonObject& request) : m_request(request) { }
+    void run() { summary = client.request(m_request, 0); }
+
+    ServerClient client;
+    QJsonObject summary;
+
+private:
+    QJsonObject m_request;
+};
+
+void TestHof::testServerTimeSlicing()
+{
+    QTemporaryDir dir;
+    Server server(dir.path() + "/hof.sock", 1, 1000);
+    QVERIFY2(server.listen(), qPrintable(server.errorString()));
+
+    ServerThread thread(&server);
+    thread.start();
+
+    // a runaway request on the only thread
+    QJsonObject runaway;
+    runaway.insert("program", QString(OMEGA));
+    RequestThread omega(runaway);
+    QVERIFY(omega.client.connectTo(server.path()));
+    omega.start();
+
+    ServerClient client;
+    QVERIFY(client.connectTo(server.path()));
+    QElapsedTimer timer;
+    timer.start();
+    while (client.metrics().value("active").toInt() < 1 && timer.elapsed() < 5000)
+        QThread::msleep(1);
+    QCOMPARE(client.metrics().value("active").toInt(), 1);
+
+    // still gets its turns and finishes while the runaway is in flight
+    QString out;
+    QJsonObject request;
+    request.insert("program", QString(DEC(FIVE)));
+    request.insert("input", QString(PRINT(I)));
+    QJsonObject summary = client.request(request, &out);
+    QCOMPARE(summary.value("status").toString(), QString("finished"));
+    QCOMPARE(out, QString("IIII"));
+    QVERIFY(omega.isRunning());
+
+    // shutting down cancels it, the connection may close before its summary is sent
+    client.quit();
+    QVERIFY(thread.wait(5000));
+    QVERIFY(omega.wait(5000));
+    QVERIFY(omega.summary.value("status").toString() != QString("finished"));
+}
+
+class CollectingListener : public SchedulerListener {
+public:
+    CollectingListener() : finishedCount(0) { }
+
+    void output(int id, const QString& output)
+    {
+        QMutexLocker locker(&mutex);
+        outputs[id].append(output);
+        chunks[id]++;
+    }
+
+    void finished(int id, HofContext::Status status, qint64 reductions)
+    {
+        Q_UNUSED(reductions);
+        QMutexLocker locker(&mutex);
+        statuses[id] = status;
+        finishedCount++;
+        changed.wakeAll();
+    }
+
+    QMutex mutex;
+    QWaitCondition changed;
+    QHash<int, QString> outputs;
+    QHash<int, int> chunks;
+    QHash<int, HofContext::Status> statuses;
+    int finishedCount;
+};
+
+void TestHof::testTimeSlicing()
+{
+    CollectingListener listener;
+    Scheduler scheduler(&listener, 2, 1000);
+
+    // runaways that would otherwise hold on to their threads forever
+    int y = scheduler.submit(Y("API"));
+    int omega = scheduler.submit(OMEGA);
+
+    // a fiber's stack holds evaluation all the way down to the depth limit
+    int deep = scheduler.submit(Y("AASIK"));
+    QVERIFY(Fiber::stackSize(HofLimits().maxDepth) > Fiber::stackSize(50));
+
+    QList<int> jobs;
+    for (int i = 0; i < 50; ++i)
+        jobs.append(scheduler.submit(QString(DEC(FIVE)) + PRINT(I)));
+
+    {
+        QMutexLocker locker(&listener.mutex);
+        while (listener.finishedCount < jobs.count() + 1)
+            QVERIFY(listener.changed.wait(&listener.mutex, 10000));
+    }
+    QCOMPARE(listener.statuses.value(deep), HofContext::DepthExceeded);
+    QVERIFY(!listener.statuses.contains(y));
+    QVERIFY(!listener.statuses.contains(omega));
+
+    foreach (int id, jobs) {
+        QCOMPARE(listener.statuses.value(id), HofContext::Finished);
+        QCOMPARE(listener.outputs.value(id), QString("IIII"));
+    }
+
+    // output of the runaway printer arrives as it yields, not at the end
+    int chunks = 0;
+    QString output;
+    QElapsedTimer timer;
+    timer.start();
+    while (chunks < 2 && timer.elapsed() < 5000) {
+        QMutexLocker locker(&listener.mutex);
+        listener.changed.wait(&listener.mutex, 10);
+        chunks = listener.chunks.value(y);
+        output = listener.outputs.value(y);
+    }
+    QVERIFY(chunks > 1);
+    QVERIFY(output.count('I') > 1);
+
+    scheduler.cancelAll();
+    scheduler.waitForDone();
+    QCOMPARE(listener.statuses.value(y), HofContext::Cancelled);
+    QCOMPARE(listener.statuses.value(omega), HofContext::Cancelled);
+}
+
+void TestHof::testResourceLimits()
+{
+    QString out;
+    QTextStream stream(&out);
+    Hof hof(&stream);
+
+    HofLimits limits;
+    limits.maxReductions = 10000;
+    hof.context()->setLimits(limits);
+    QCOMPARE(hof.run(OMEGA), HofContext::ReductionsExceeded);
+    QCOMPARE(hof.context()->reductions, qint64(10000));
+
+    limits = HofLimits();
+    limits.maxMsecs = 100;
+    hof.context()->setLimits(limits);
+    QElapsedTimer timer;
+    timer.start();
+    QCOMPARE(hof.run(OMEGA), HofContext::TimeExceeded);
+    QVERIFY(timer.elapsed() < 5000);
+
+    // output up to the limit is still printed
+    limits = HofLimits();
+    limits.maxOutput = 10;
+    hof.context()->setLimits(limits);
+    QCOMPARE(hof.run(Y("API")), HofContext::OutputExceeded);
+    stream.flush();
+    QCOMPARE(out, QString("IIIIIIIIII"));
+
+#if defined(Q_OS_UNIX)
+    // any process is already past a megabyte, so the first checkpoint stops
+    // it, the time limit only keeps a broken check from hanging the test
+    limits = HofLimits();
+    limits.maxMemory = 1024 * 1024;
+    hof.context()->setLimits(limits);
+    QCOMPARE(hof.run(OMEGA), HofContext::MemoryExceeded);
+
+    QDir bin(QCoreApplication::applicationDirPath());
+    QProcess process;
+    process.setProgram(bin.path() + QDir::separator() + "hof");
+    process.setArguments(QStringList() << "--max-memory" << "1M" << "--max-time" << "30000" << "--program" << OMEGA);
+    process.start();
+    QVERIFY(process.waitForFinished(60000));
+    QCOMPARE(process.exitStatus(), QProcess::NormalExit);
+    QCOMPARE(process.exitCode(), 6);
+    QVERIFY(process.readAllStandardError().contains("stopped: memory-exceeded after"));
+#endif
+
+    QSet<int> exitCodes;
+    exitCodes << HofContext::exitCode(HofContext::Finished)
+              << HofContext::exitCode(HofContext::DepthExceeded)
+              << HofContext::exitCode(HofContext::Cancelled)
+              << HofContext::exitCode(HofContext::ReductionsExceeded)
+              << HofContext::exitCode(HofContext::TimeExceeded)
+              << HofContext::exitCode(HofContext::MemoryExceeded)
+              << HofContext::exitCode(HofContext::OutputExceeded);
+    QCOMPARE(exitCodes.count(), 7);
+}
+
+static void appendOutput(const char* data, size_t length, void* userData)
+{
+    static_cast<QByteArray*>(userData)->append(data, int(length));
+}
+
+void TestHof::testCApi()
+{
+    QCOMPARE(hof_api_version(), HOF_API_VERSION);
+
+    hof_context* context = hof_context_create();
+    QByteArray out;
+    hof_context_set_output(context, appendOutput, &out);
+
+    // whitespace is skipped...
+    QByteArray program = QByteArray(DEC(FIVE)) + "\n  " + PRINT(I) + " ";
+    QCOMPARE(hof_context_load(context, program.constData(), program.size()), 0);
+    QCOMPARE(hof_context_run(context), HOF_FINISHED);
+    QCOMPARE(out, QByteArray("IIII"));
+    QVERIFY(hof_context_reductions(context) > 0);
+
+    // a length an int cannot hold is refused, never read, and the program
+    // loaded before is kept
+    if (sizeof(size_t) > sizeof(int)) {
+        out.clear();
+        size_t length = size_t(std::numeric_limits<int>::max()) + 1;
+        QCOMPARE(hof_context_load(context, program.constData(), length), -1);
+        QCOMPARE(hof_context_run(context), HOF_FINISHED);
+        QCOMPARE(out, QByteArray("IIII"));
+    }
+
+    // ...and non ascii variables are decoded in place
+    out.clear();
+    program = "A P \xce\xbb";
+    QCOMPARE(hof_context_load(context, program.constData(), program.size()), 0);
+    QCOMPARE(hof_context_run(context), HOF_FINISHED);
+    QCOMPARE(out, QByteArray("\xce\xbb"));
+
+    hof_limits limits;
+    hof_limits_init(&limits);
+    QCOMPARE(limits.max_depth, HofLimits().maxDepth);
+    limits.max_reductions = 1000;
+    hof_context_set_limits(context, &limits);
+
+    QByteArray omega(OMEGA);
+    QCOMPARE(hof_context_load(context, omega.constData(), omega.size()), 0);
+    hof_status status = hof_context_run(context);
+    QCOMPARE(status, HOF_REDUCTIONS_EXCEEDED);
+    QCOMPARE(QString(hof_status_name(status)), QString("reductions-exceeded"));
+    QCOMPARE(hof_status_exit_code(status), 4);
+
+    hof_context_destroy(context);
+}
+
+void TestHof::testLexerBenchmark()
+{
+    // tokens are offsets into the span and 'λ' is its two byte sequence
+    QByteArray small("(\xce\xbbx. x {two})\n");
+    Lexer::Tokens tokens = Lexer::tokenize(small.constData(), small.size(), Lexer::LambdaSyntax);
+    QCOMPARE(tokens.count(), 7);
+    QCOMPARE(int(tokens.at(1).type), int(Lexer::Lambda));
+    QCOMPARE(int(tokens.at(1).length), 2);
+    QCOMPARE(int(tokens.at(2).offset), 3);
+    QCOMPARE(int(tokens.at(3).type), int(Lexer::Dot));
+    QCOMPARE(int(tokens.at(5).type), int(Lexer::Sub));
+    Lexer lexer(small.constData(), small.size(), Lexer::LambdaSyntax);
+    QCOMPARE(lexer.text(tokens.at(5)), QString("two"));
+    QCOMPARE(sizeof(Lexer::Token), size_t(8));
+
+    // a substitution too long for the length field is an error, not cut short
+    QByteArray overlong(Lexer::MaximumLength + 3, 'x');
+    overlong[0] = '{';
+    overlong[overlong.size() - 1] = '}';
+    tokens = Lexer::tokenize(overlong.constData(), overlong.size(), Lexer::LambdaSyntax);
+    QCOMPARE(tokens.count(), 1);
+    QCOMPARE(int(tokens.at(0).type), int(Lexer::Overflow));
+    bool ok = true;
+    Ski::fromSki(overlong.constData(), overlong.size(), &ok);
+    QVERIFY(!ok);
+    overlong[0] = '"';
+    overlong[overlong.size() - 1] = '"';
+    Parser literals(1);
+    literals.setLiterals(true);
+    QVERIFY(literals.parse(overlong.constData(), overlong.size()).isEmpty());
+    QVERIFY(literals.stats().overflow);
+    overlong.clear();
+
+    // whitespace is folded into lexing so translations no longer need it stripped
+    QCOMPARE(Lambda::fromLambda(QString("\xce\xbbx . \xce\xbby .\n x")), QString("K"));
+    QCOMPARE(Ski::fromSki(QString("S (K (S I I))\n")), QString("SAKAASII"));
+
+    struct Input {
+        const char* name;
+        QByteArray line;
+        Lexer::Syntax syntax;
+    } inputs[] = {
+        { "hof", QByteArray(Y("API")) + " \n", Lexer::HofSyntax },
+        { "ski", "S(K(SII)) (S(S(KS)K)(K(SII)))\n", Lexer::SkiSyntax },
+        { "lambda", "\xce\xbbn.\xce\xbb" "f.\xce\xbbx. n (\xce\xbbg.\xce\xbbh. h (g f)) (\xce\xbbu.x) {id}\n",
+          Lexer::LambdaSyntax }
+    };
+
+    const int megabytes = 4;
+    for (const Input& input : inputs) {
+        QByteArray data;
+        while (data.size() < megabytes * 1024 * 1024)
+            data.append(input.line);
+
+        QElapsedTimer timer;
+        timer.start();
+        tokens = Lexer::tokenize(data.constData(), data.size(), input.syntax);
+        qint64 lexNsecs = qMax(qint64(1), timer.nsecsElapsed());
+        QVERIFY(!tokens.isEmpty());
+
+        // what the front ends used to do: decode, strip twice and a string per token
+        timer.restart();
+        QString program = QString::fromUtf8(data).simplified();
+        program.replace("\n", "");
+        program.replace(" ", "");
+        QList<QString> strings;
+        for (int i = 0; i < program.length(); ++i)
+            strings.append(QString(program.at(i)));
+        qint64 stringNsecs = qMax(qint64(1), timer.nsecsElapsed());
+        QVERIFY(strings.count() >= tokens.count());
+
+        qDebug() << input.name << data.size() / 1024 << "KiB in" << tokens.count() << "tokens:"
+                 << data.size() * 1000.0 / lexNsecs << "MB/s lexed vs"
+                 << data.size() * 1000.0 / stringNsecs << "MB/s through QString";
+    }
+}
+
+// a random complete term in prefix notation with some whitespace mixed in
+static QByteArray randomTerm(std::mt19937* random, int leaves, const QList<QByteArray>& symbols)
+{
+    QByteArray term;
+    int need = 1;
+    int emitted = 0;
+    while (need > 0) {
+        if ((*random)() % 7 == 0)
+            term.append((*random)() % 2 ? " " : "\n");
+        if (emitted + need < leaves && (*random)() % 2) {
+            term.append('A');
+            ++need;
+        } else {
+            term.append(symbols.at(int((*random)() % symbols.count())));
+            ++emitted;
+            --need;
+        }
+    }
+    return term;
+}
+
+void TestHof::testParallelParser()
+{
+    QList<QByteArray> symbols = QList<QByteArray>() << "I" << "K" << "S" << "P" << "R" << "x" << "\xce\xbb";
+
+    // tiny chunks so applications span many of them
+    Parser parser(3);
+    parser.setMinimumChunk(5);
+    std::mt19937 random(12345);
+    for (int round = 0; round < 200; ++round) {
+        QByteArray program;
+        QStringList expected;
+        int terms = 1 + int(random() % 6);
+        for (int t = 0; t < terms; ++t) {
+            QByteArray term = randomTerm(&random, 1 + int(random() % 40), symbols);
+            program.append(term);
+            expected.append(QString::fromUtf8(term).remove(' ').remove('\n'));
+        }
+        bool unfinished = round % 3 == 0;
+        if (unfinished)
+            program.append("AAS I");
+
+        QList<CombinatorPtr> parsed = parser.parse(program.constData(), program.size());
+        QStringList actual;
+        foreach (const CombinatorPtr& term, parsed)
+            actual.append(term->toString());
+        QCOMPARE(actual, expected);
+        QCOMPARE(parser.stats().incomplete, unfinished);
+    }
+
+    // parsed terms run exactly like the streaming interpreter
+    QByteArray program;
+    for (int i = 0; i < 50; ++i)
+        program.append(QByteArray(DEC(FIVE)) + " " + PRINT(I) + "\n");
+    program.append("AP\xce\xbb");
+    QString streamed;
+    QString prepared;
+    {
+        QTextStream stream(&streamed);
+        Hof hof(&stream);
+        QCOMPARE(hof.run(program.constData(), program.size()), HofContext::Finished);
+    }
+    {
+        QTextStream stream(&prepared);
+        Hof hof(&stream);
+        QCOMPARE(hof.run(parser.parse(program.constData(), program.size())), HofContext::Finished);
+    }
+    QCOMPARE(prepared, streamed);
+
+    // machine generated programs of tens of megabytes
+    QByteArray huge;
+    QList<QByteArray> leaves = QList<QByteArray>() << "I" << "K" << "S";
+    while (huge.size() < 8 * 1024 * 1024)
+        huge.append(randomTerm(&random, 100000, leaves));
+
+    int threadCounts[] = { 1, QThread::idealThreadCount() };
+    int symbolCount = -1;
+    int termCount = -1;
+    for (int threads : threadCounts) {
+        Parser huger(threads);
+        QElapsedTimer timer;
+        timer.start();
+        QList<CombinatorPtr> parsed = huger.parse(huge.constData(), huge.size());
+        qint64 nsecs = qMax(qint64(1), timer.nsecsElapsed());
+        Parser::Stats stats = huger.stats();
+        QVERIFY(!stats.incomplete);
+        if (symbolCount >= 0) {
+            QCOMPARE(stats.symbols, symbolCount);
+            QCOMPARE(stats.terms, termCount);
+        }
+        symbolCount = stats.symbols;
+        termCount = stats.terms;
+
+        qDebug() << threads << "threads:" << huge.size() / (1024 * 1024) << "MiB in" << nsecs / 1000000.0 << "ms,"
+                 << huge.size() * 1000.0 / nsecs << "MB/s (lex" << stats.lexNsecs / 1000000.0
+                 << "scan" << stats.scanNsecs / 1000000.0 << "link" << stats.linkNsecs / 1000000.0
+                 << "build" << stats.buildNsecs / 1000000.0 << "ms)";
+    }
+}
+
+void TestHof::testStaticHof()
+{
+    // everything here is parsed and reduced by the compiler
+    static constexpr auto isZeroZero = normalizeHof(ISZERO(ZERO));
+    static_assert(isZeroZero.isNormalized() && isZeroZero.equals(TRUE), "ISZERO(ZERO) is TRUE");
+    static_assert(normalizeHof(ISZERO(ONE)).equals(FALSE), "ISZERO(ONE) is FALSE");
+    static_assert(normalizeHof(IF(FALSE, "x", "y")).equals("y"), "IF(FALSE, x, y) is y");
+    static_assert(normalizeHof(" AAS K\nK x").equals("x"), "whitespace is skipped");
+    static_assert(normalizeHof(PRINT(I)).status() == StaticHof<1024>::Impure, "P is left for runtime");
+    static_assert(!normalizeHof(OMEGA).isValid(), "OMEGA has no normal form");
+    static_assert(parseHof("AAS").status() == StaticHof<4>::Incomplete, "unfinished applications");
+
+    static constexpr auto program = parseHof(DEC(FIVE) PRINT(I));
+    static_assert(program.isValid() && program.termCount() == 4, "DEC, FIVE, P and I");
+    static constexpr auto four = normalizeHof(DEC(FIVE));
+    static_assert(four.isNormalized(), "DEC(FIVE) normalizes");
+
+    // the static tables run just like the parsed program
+    QString output;
+    QTextStream stream(&output);
+    Hof hof(&stream);
+    QCOMPARE(hof.run(program.terms()), HofContext::Finished);
+    stream.flush();
+    QCOMPARE(output, QString("IIII"));
+
+    output.clear();
+    QCOMPARE(hof.run(four.toString() + PRINT(I)), HofContext::Finished);
+    stream.flush();
+    QCOMPARE(output, QString("IIII"));
+    QVERIFY(four.toString().length() < QString(DEC(FIVE)).length());
+}
+
+void TestHof::testOptimizer()
+{
+    Optimizer text;
+    QCOMPARE(text.optimize(QString("AASKK")), QString("I"));
+    QCOMPARE(text.optimize(QString("AASAKpAKq")), QString("AKApq"));
+    QCOMPARE(text.optimize(QString("AASAKpI")), QString("p"));
+    QCOMPARE(text.optimize(QString("AAKxy AIz")), QString("xz"));
+    QCOMPARE(text.fired(Optimizer::SkpKqToKpq), 1);
+
+    // B and C have no text so only terms get them
+    QCOMPARE(text.optimize(QString("AASAKpq")), QString("AASAKpq"));
+
+    // what P prints is left as written
+    QCOMPARE(text.optimize(QString("PAIK")), QString("PAIK"));
+    QCOMPARE(text.optimize(QString("APAIK")), QString("APAIK"));
+    // and so is any argument, as K P y hands AIa on to P
+    QCOMPARE(text.optimize(QString("AAAKPyAIa")), QString("APAIa"));
+
+    QStringList programs = QStringList()
+        << QString(DEC(FIVE)) + PRINT(I)
+        << QString(SUBTRACT(THREE, ONE)) + PRINT(I)
+        << QString(IF(ISZERO(ZERO), PTERM(I), PTERM(K)))
+        << Lambda::fromLambda("\xce\xbbn.\xce\xbb" "f.\xce\xbbx.n (\xce\xbbg.\xce\xbbh.h (g f)) (\xce\xbbu.x) (\xce\xbbu.u)")
+           + FOUR + PRINT(I)
+        << QString("AAAKPyAIa");
+
+    // only heads are rewritten, so a program that starts with a lone I as
+    // SUBTRACT does has nothing to optimize
+    int fired = 0;
+    qint64 plainTotal = 0;
+    qint64 optimizedTotal = 0;
+    foreach (const QString& program, programs) {
+        QByteArray utf8 = program.toUtf8();
+
+        QString plainOutput;
+        QTextStream plainStream(&plainOutput);
+        Hof plain(&plainStream);
+        QCOMPARE(plain.run(utf8.constData(), utf8.size()), HofContext::Finished);
+        plainStream.flush();
+
+        Parser parser(1);
+        Optimizer optimizer;
+        QList<CombinatorPtr> terms = optimizer.optimize(parser.parse(utf8.constData(), utf8.size()));
+        fired += optimizer.fired();
+
+        QString optimizedOutput;
+        QTextStream optimizedStream(&optimizedOutput);
+        Hof optimized(&optimizedStream);
+        QCOMPARE(optimized.run(terms), HofContext::Finished);
+        optimizedStream.flush();
+
+        QCOMPARE(optimizedOutput, plainOutput);
+        QVERIFY(optimized.context()->reductions <= plain.context()->reductions);
+        plainTotal += plain.context()->reductions;
+        optimizedTotal += optimized.context()->reductions;
+        qDebug() << plainOutput << plain.context()->reductions << "->" << optimized.context()->reductions
+                 << "reductions," << optimizer.report();
+    }
+    QVERIFY(fired > 0);
+    QVERIFY(optimizedTotal < plainTotal);
+}
+
+void TestHof::testPartialEvaluation()
+{
+    PartialEvaluator text;
+    QCOMPARE(text.evaluate(QString("AAASKKI x")), QString("Ix"));
+    QCOMPARE(text.evaluate(QString("A" ISZERO("AKI"))), QString("K"));
+    QCOMPARE(text.stats().normalized, 2);
+
+    // variables, P and R keep a subterm open, its closed parts are still tried
+    QCOMPARE(text.evaluate(QString("AAKxAAKIS")), QString("AAKxI"));
+    QCOMPARE(text.evaluate(QString("AAAAKISAPIx")), QString("AAIAPIx"));
+    QCOMPARE(text.evaluate(QString("PAAKIS")), QString("PAAKIS"));
+
+    // in a program that prints any argument may be printed, K P y prints AIK
+    QCOMPARE(text.evaluate(QString("AAKAPIAAKIS")), QString("AAKAPIAAKIS"));
+    QCOMPARE(text.evaluate(QString("AAAKPyAIK")), QString("AAAKPyAIK"));
+    QString printed;
+    QTextStream printedStream(&printed);
+    Hof printing(&printedStream);
+    QCOMPARE(printing.run(text.evaluate(QString("AAAKPyAIK"))), HofContext::Finished);
+    printedStream.flush();
+    QCOMPARE(printed, QString("AIK"));
+
+    // the sizes of a term shared 64 deep add up past any integer, only the
+    // level small enough to print is normalized
+    CombinatorPtr shared = k();
+    for (int i = 0; i < 64; ++i) {
+        A* a = new A;
+        a->left = shared;
+        a->right = shared;
+        a->isComplete = true;
+        shared = CombinatorPtr(a);
+    }
+    text.clear();
+    text.evaluate(QList<CombinatorPtr>() << shared);
+    QCOMPARE(text.stats().candidates, 1);
+
+    // no normal form within the fuel, so nothing changes
+    text.clear();
+    QCOMPARE(text.evaluate(QString("AAASIIAASII")), QString("AAASIIAASII"));
+    QVERIFY(text.stats().exhausted > 0);
+    QCOMPARE(text.stats().normalized, 0);
+
+    // a closed library combinator applied to constants in translated code
+    QString isZeroOne = Lambda::fromLambda("(\xce\xbbn.n (\xce\xbbx.\xce\xbbx.\xce\xbby.y) \xce\xbbx.\xce\xbby.x) (\xce\xbb" "f.\xce\xbbx.f x)");
+    QString program = isZeroOne + PTERM(K) + PTERM(I);
+
+    QString plainOutput;
+    QTextStream plainStream(&plainOutput);
+    Hof plain(&plainStream);
+    QCOMPARE(plain.run(program), HofContext::Finished);
+    plainStream.flush();
+
+    PartialEvaluator partial;
+    QString evaluated = partial.evaluate(program);
+    QVERIFY(evaluated.length() < program.length());
+    QVERIFY(partial.stats().normalized > 0);
+
+    QString evaluatedOutput;
+    QTextStream evaluatedStream(&evaluatedOutput);
+    Hof hof(&evaluatedStream);
+    QCOMPARE(hof.run(evaluated), HofContext::Finished);
+    evaluatedStream.flush();
+
+    QCOMPARE(evaluatedOutput, plainOutput);
+    QVERIFY(hof.context()->reductions < plain.context()->reductions);
+    qDebug() << program << "->" << evaluated << ":" << plain.context()->reductions << "->"
+             << hof.context()->reductions << "reductions";
+}
+
+static QString runToString(const QString& program, bool sharing = false)
+{
+    QString output;
+    QTextStream stream(&output);
+    Hof hof(&stream);
+    hof.setSharing(sharing);
+    hof.run(program);
+    stream.flush();
+    return output;
+}
+
+void TestHof::testSharing()
+{
+    QByteArray syntax("$AI@12;@x");
+    Lexer::Tokens tokens = Lexer::tokenize(syntax.constData(), syntax.size(), Lexer::HofSyntax, true);
+    QCOMPARE(tokens.count(), 6);
+    QCOMPARE(int(tokens.at(0).type), int(Lexer::Share));
+    QCOMPARE(int(tokens.at(3).type), int(Lexer::Reference));
+    QCOMPARE(Lexer(syntax.constData(), syntax.size()).number(tokens.at(3)), 12);
+    QCOMPARE(int(tokens.at(4).type), int(Lexer::Symbol));
+
+    // without sharing $ and @ are symbols like any other
+    tokens = Lexer::tokenize(syntax.constData(), syntax.size());
+    QCOMPARE(tokens.count(), syntax.size());
+    QCOMPARE(int(tokens.at(0).type), int(Lexer::Symbol));
+    QCOMPARE(int(tokens.at(3).type), int(Lexer::Symbol));
+    QCOMPARE(runToString("AP$"), QString("$"));
+    QCOMPARE(runToString("AP$", true), QString());
+    QByteArray plainSyntax("AP$ AP@0;");
+    Parser plainParser(1);
+    QList<CombinatorPtr> plainTerms = plainParser.parse(plainSyntax.constData(), plainSyntax.size());
+    QCOMPARE(plainTerms.count(), 4);
+    QCOMPARE(plainTerms.at(0)->toString(), QString("AP$"));
+    QCOMPARE(plainTerms.at(1)->toString(), QString("AP@"));
+    QCOMPARE(plainParser.stats().shared, 0);
+
+    // the nth $ names node n and the parser keeps it shared
+    Parser parser(1);
+    parser.setSharing(true);
+    QByteArray dag("A$AKI@0;");
+    QList<CombinatorPtr> terms = parser.parse(dag.constData(), dag.size());
+    QCOMPARE(terms.count(), 1);
+    QCOMPARE(terms.first()->toString(), QString("AAKIAKI"));
+    QVERIFY(isSharedApplication(terms.first()));
+    QCOMPARE(parser.stats().references, 1);
+
+    // unknown and unfinished nodes are a plain @
+    QByteArray cyclic("A$AK@0;I AI@7;");
+    terms = parser.parse(cyclic.constData(), cyclic.size());
+    QCOMPARE(terms.count(), 2);
+    QCOMPARE(terms.at(0)->toString(), QString("AAK@I"));
+    QCOMPARE(terms.at(1)->toString(), QString("AI@"));
+    QCOMPARE(parser.stats().references, 0);
+
+    // both interpreters agree with the tree
+    QString plain = runToString("AAKPI AAKPI x");
+    QCOMPARE(runToString("$AAKPI @0; x", true), plain);
+    QByteArray utf8("$AAKPI @0; x");
+    QString output;
+    QTextStream stream(&output);
+    Hof hof(&stream);
+    hof.setSharing(true);
+    hof.run(utf8.constData(), utf8.size());
+    stream.flush();
+    QCOMPARE(output, plain);
+    QCOMPARE(runToString("A$AK@0;I x", true), runToString("AAK@I x"));
+
+    // forty nested levels spell out 2^41 - 1 symbols and parse in an instant
+    QByteArray deep;
+    for (int level = 0; level < 40; ++level)
+        deep.append("$A");
+    deep.append("$AII");
+    for (int level = 40; level > 0; --level)
+        deep.append(QString("@%1;").arg(level).toLatin1());
+    terms = parser.parse(deep.constData(), deep.size());
+    QCOMPARE(terms.count(), 1);
+    QCOMPARE(parser.stats().references, 40);
+    QVERIFY(isSharedApplication(terms.first()));
+
+    Sharing sharing;
+    QString reshared = sharing.share(QString::fromLatin1(deep));
+    QVERIFY(reshared.length() < 400);
+    // all but the root and AII, which is shorter than a reference to it
+    QCOMPARE(sharing.stats().shared, 39);
+
+    // translated programs repeat themselves and the dag spells out the same tree
+    QStringList programs = QStringList()
+        << QString(DEC(FIVE)) + PRINT(I)
+        << QString(SUBTRACT(THREE, ONE)) + PRINT(I)
+        << Lambda::fromLambda("\xce\xbbn.\xce\xbb" "f.\xce\xbbx.n (\xce\xbbg.\xce\xbbh.h (g f)) (\xce\xbbu.x) (\xce\xbbu.u)")
+           + FOUR + PRINT(I);
+    foreach (const QString& program, programs) {
+        sharing.clear();
+        QString shared = sharing.share(program);
+        Sharing::Stats stats = sharing.stats();
+        QVERIFY(stats.shared > 0);
+        QVERIFY(stats.sizeAfter < stats.sizeBefore);
+        QCOMPARE(stats.sizeAfter, shared.length());
+
+        QByteArray sharedUtf8 = shared.toUtf8();
+        QString expanded;
+        foreach (const CombinatorPtr& term, parser.parse(sharedUtf8.constData(), sharedUtf8.size()))
+            expanded.append(term->toString());
+        QCOMPARE(expanded, QString(program).remove(' '));
+        QCOMPARE(runToString(shared, true), runToString(program));
+        qDebug() << stats.sizeBefore << "->" << stats.sizeAfter << "characters," << stats.shared << "shared,"
+                 << stats.parseNsecsBefore / 1000.0 << "->" << stats.parseNsecsAfter / 1000.0 << "us to parse";
+    }
+}
+
+// runs a lambda program on the lambda machine, with hof input applied to it
+static QString runLambdaMachine(const QString& lambda, const QString& input, qint64* reductions = 0)
+{
+    QString output;
+    QTextStream stream(&output);
+    HofContext context;
+    context.setOutput(&stream);
+    LambdaMachine machine(&context);
+    QByteArray utf8 = lambda.toUtf8();
+    if (!machine.load(utf8.constData(), utf8.size(), input.toUtf8()))
+        return QString("error");
+    machine.run();
+    stream.flush();
+    if (reductions)
+        *reductions = context.reductions;
+    return output;
+}
+
+static QString withLambdas(QString lambda)
+{
+    return lambda.replace('\\', QChar(0x03BB));
+}
+
+void TestHof::testLambdaMachine()
+{
+    QStringList examples = QStringList() << "decrement" << "print-list";
+    QStringList inputs = QStringList() << TWO << QString();
+    for (int i = 0; i < examples.count(); ++i) {
+        QFile file(QString("examples/%1.lambda").arg(examples.at(i)));
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QString lambda = QString::fromUtf8(file.readAll());
+        QCOMPARE(runLambdaMachine(lambda, inputs.at(i)), runToString(Lambda::fromLambda(lambda) + inputs.at(i)));
+    }
+
+    // combinators, symbols and values print as the hof engine prints them
+    QStringList printed = QStringList() << "{P} x" << "{P} (\\x.\\y.x)" << "(\\x.{P} (x x)) {K}";
+    foreach (const QString& lambda, printed)
+        QCOMPARE(runLambdaMachine(withLambdas(lambda), QString()), runToString(Lambda::fromLambda(withLambdas(lambda))));
+    QCOMPARE(runLambdaMachine(withLambdas("(\\x.x) {P}"), QString("I")), QString("I"));
+    QCOMPARE(runLambdaMachine(withLambdas("(\\x.x"), QString()), QString("error"));
+
+    // a value read back under a binder of the same name is not captured by it
+    QCOMPARE(runLambdaMachine(withLambdas("{P} ((\\x.\\a.x) a)"), QString()), QString("AKa"));
+
+    // an engine that does not exist is an error, not the default engine
+    QDir bin(QCoreApplication::applicationDirPath());
+    QProcess unknown;
+    unknown.setProgram(bin.path() + QDir::separator() + "hof");
+    unknown.setArguments(QStringList() << "--engine" << "krivine" << "--program" << PRINT(I));
+    unknown.start();
+    QVERIFY(unknown.waitForFinished(5000));
+    QVERIFY(unknown.exitCode() != EXIT_SUCCESS);
+
+    // call by need only evaluates an argument once however often it is used
+    QString twice = withLambdas("(\\x.\\f.f x x) ({APa} b) (\\u.\\v.u v)");
+    QCOMPARE(runLambdaMachine(twice, QString()), QString("a"));
+
+    // church numeral exponentiation against bracket abstraction, which runs
+    // out of stack depth by 3^(2^3)
+    QString numerals = withLambdas(
+        "two = \\f.\\x.f (f x)\n"
+        "three = \\f.\\x.f (f (f x))\n"
+        "exp = \\m.\\n.n m\n"
+        "({exp}) ({three}) (({exp}) ({two}) ({two})) {P} {I}\n");
+    QElapsedTimer timer;
+    timer.start();
+    QString hof = Lambda::fromLambda(numerals);
+    QString output;
+    QTextStream stream(&output);
+    Hof engine(&stream);
+    QCOMPARE(engine.run(hof), HofContext::Finished);
+    stream.flush();
+    qint64 hofNsecs = timer.nsecsElapsed();
+    QCOMPARE(output, QString(81, 'I'));
+
+    timer.restart();
+    qint64 reductions = 0;
+    QCOMPARE(runLambdaMachine(numerals, QString(), &reductions), output);
+    qint64 machineNsecs = timer.nsecsElapsed();
+    qDebug() << "3^(2^2):" << engine.context()->reductions << "reductions in" << hofNsecs / 1000000.0 << "ms with hof,"
+             << reductions << "in" << machineNsecs / 1000000.0 << "ms on the lambda machine";
+
+    // the hof engine's cache answers the numerals' repeated applications, the
+    // machine only shares what a closure binds, but call by need keeps it
+    // within a small factor rather than running out of depth
+    QVERIFY(reductions > engine.context()->reductions);
+    QVERIFY(reductions < 10 * engine.context()->reductions);
+}
+
+// reduces a lambda program, or hof, to normal form as an interaction net,
+// numerals are only counted since reading them back is slow
+static QString reduceNet(const QString& program, bool isLambda, int threads = 1, qint64* numeral = 0, InteractionNet::Stats* stats = 0)
+{
+    LambdaCode code;
+    QByteArray utf8 = program.toUtf8();
+    int root = isLambda ? Lambda::toCode(utf8.constData(), utf8.size(), &code) : code.hof(program);
+    HofContext context;
+    InteractionNet net(&context, threads);
+    if (root < 0 || !net.load(code, root))
+        return QString("error");
+    if (net.reduce() != HofContext::Finished)
+        return QString("stopped");
+    if (stats)
+        *stats = net.stats();
+    if (!numeral) {
+        bool ok = true;
+        QString hof = net.toHof(&ok);
+        return ok ? hof : QString("unreadable");
+    }
+    *numeral = net.numeral();
+    return QString();
+}
+
+void TestHof::testInteractionNet()
+{
+    QCOMPARE(reduceNet(QString(A) + A + K + "xy", false), QString("x"));
+    QCOMPARE(reduceNet(QString(A) + A + A + S + K + K + "x", false), QString("x"));
+    QCOMPARE(reduceNet(withLambdas("(\\x.\\y.y x) a (\\z.z)"), true), QString("a"));
+    QCOMPARE(reduceNet(QString(A) + P + "x", false), QString("error"));
+
+    QString four = withLambdas("\\f.\\x.f (f (f (f x)))");
+    QString numerals = withLambdas(
+        "two = \\f.\\x.f (f x)\n"
+        "three = \\f.\\x.f (f (f x))\n"
+        "exp = \\m.\\n.n m\n");
+    qint64 numeral = -1;
+    QCOMPARE(reduceNet(numerals + "({exp}) ({two}) ({two})\n", true), Lambda::fromLambda(four));
+    reduceNet(four, true, 1, &numeral);
+    QCOMPARE(numeral, qint64(4));
+    reduceNet(withLambdas("\\f.\\x.f"), true, 1, &numeral);
+    QCOMPARE(numeral, qint64(-1));
+
+    // self application overlaps duplications, which is caught reading back
+    QCOMPARE(reduceNet(withLambdas("(\\x.x x) (\\y.y)"), true), QString("I"));
+    QCOMPARE(reduceNet(withLambdas("(\\x.x x) (\\f.\\x.f (f x))"), true), QString("unreadable"));
+
+    // compiled and read back without recursion however deep the term is
+    LambdaCode deep;
+    int body = deep.free('x');
+    for (int i = 0; i < 100000; ++i)
+        body = deep.abstraction('y', body);
+    {
+        HofContext context;
+        InteractionNet net(&context);
+        QVERIFY(net.load(deep, body));
+        QCOMPARE(net.reduce(), HofContext::Finished);
+        bool ok = false;
+        QCOMPARE(net.toLambda(&ok).length(), 5 * 100000 + 1);
+        QVERIFY(ok);
+    }
+
+    // enough independent redexes for the rounds to be split across threads
+    QString wide = "x";
+    for (int i = 0; i < 5000; ++i)
+        wide += QString(A) + A + K + "y" + QChar('a' + i % 26);
+    InteractionNet::Stats stats;
+    InteractionNet::Stats parallelStats;
+    QCOMPARE(reduceNet(wide, false, 4, 0, &parallelStats), QString("y"));
+    QCOMPARE(reduceNet(wide, false, 1, 0, &stats), QString("y"));
+    QCOMPARE(parallelStats.interactions, stats.interactions);
+    QCOMPARE(stats.erasures, qint64(5000));
+
+    // numeral exponentiation against eval(), which prints the numeral one I
+    // at a time and runs out of stack depth by 3^(2^3)
+    QStringList bases = QStringList() << "two" << "three" << "two" << "three" << "two";
+    QStringList exponents = QStringList() << "two" << "two" << "three" << "three" << "({exp}) ({two}) ({two})";
+    QList<qint64> expected = QList<qint64>() << 16 << 81 << 256 << 6561 << 65536;
+    for (int i = 0; i < bases.count(); ++i) {
+        QString program = QString("({exp}) ({%1}) (({exp}) ({two}) (%2))\n").arg(bases.at(i))
+            .arg(exponents.at(i).startsWith('(') ? exponents.at(i) : "{" + exponents.at(i) + "}");
+        QElapsedTimer timer;
+        timer.start();
+        reduceNet(numerals + program, true, 1, &numeral, &stats);
+        qint64 netNsecs = timer.nsecsElapsed();
+        QCOMPARE(numeral, expected.at(i));
+
+        timer.restart();
+        reduceNet(numerals + program, true, 4, &numeral, &parallelStats);
+        qint64 parallelNsecs = timer.nsecsElapsed();
+        QCOMPARE(numeral, expected.at(i));
+        QCOMPARE(parallelStats.interactions, stats.interactions);
+
+        QDebug debug = qDebug();
+        debug << qPrintable(QString("%1:").arg(expected.at(i))) << stats.interactions << "interactions in"
+              << stats.rounds << "rounds," << netNsecs / 1000000.0 << "ms on one thread," << parallelNsecs / 1000000.0 << "on four";
+        if (expected.at(i) > 256)
+            continue;
+
+        timer.restart();
+        QString output;
+        QTextStream stream(&output);
+        Hof engine(&stream);
+        QCOMPARE(engine.run(Lambda::fromLambda(numerals + program) + P + I), HofContext::Finished);
+        stream.flush();
+        QCOMPARE(output, QString(int(expected.at(i)), 'I'));
+        debug << "against" << engine.context()->reductions << "reductions in" << timer.nsecsElapsed() / 1000000.0 << "ms with eval()";
+    }
+}
+
+// runs a program with its Church numerals as native integers
+static QString runNumerals(const QString& program, qint64* reductions = 0, Numerals::Stats* stats = 0)
+{
+    QByteArray utf8 = program.toUtf8();
+    Parser parser(1);
+    Numerals numerals;
+    QList<CombinatorPtr> terms = numerals.recognize(parser.parse(utf8.constData(), utf8.size()));
+    QString output;
+    QTextStream stream(&output);
+    Hof hof(&stream);
+    hof.run(terms);
+    stream.flush();
+    if (reductions)
+        *reductions = hof.context()->reductions;
+    if (stats)
+        *stats = numerals.stats();
+    return output;
+}
+
+void TestHof::testNumerals()
+{
+    // INC and DEC on their own, as ADD and SUBTRACT need them inside a term
+    QString inc = "ASAASAKSK";
+    QString dec = DEC("");
+    auto add = [&](const QString& m, const QString& n) { return "AA" + n + inc + m; };
+    auto subtract = [&](const QString& m, const QString& n) { return "AA" + n + dec + m; };
+    QString seven = add(FOUR, THREE);
+
+    QStringList programs = QStringList()
+        << QString(DEC(FIVE)) + PRINT(I)
+        << QString(SUBTRACT(THREE, ONE)) + PRINT(I)
+        << seven + PRINT(I)
+        << QString(IF(ISZERO(ZERO), PTERM(I), PTERM(K)))
+        << QString(IF(ISZERO(ONE), PTERM(I), PTERM(K)))
+        << QString("A" ISZERO("")) + subtract(THREE, THREE) + PTERM(I) + PTERM(K)
+        << QString("A" THREE TWO) + PRINT(I)
+        << QString("A" TWO "AKx") + PRINT(I)
+        << PRINT(INC(TWO))
+        // a function that prints does so every time it is applied
+        << QString("AA" THREE "API" "x");
+    foreach (const QString& program, programs)
+        QCOMPARE(runNumerals(program), runToString(program));
+
+    Numerals::Stats stats;
+    runNumerals(QString("A" ISZERO("")) + subtract(THREE, ONE) + PTERM(I) + PTERM(K), 0, &stats);
+    // THREE has two and DEC builds its pairs with one of its own
+    QCOMPARE(stats.successors, 3);
+    QCOMPARE(stats.predecessors, 1);
+    QCOMPARE(stats.tests, 1);
+
+    // 4^10 and arithmetic on it in a handful of reductions
+    QString million = "A" + add(FIVE, FIVE) + FOUR;
+    QString difference = subtract(subtract(add(million, million), million), million);
+    qint64 reductions = 0;
+    QCOMPARE(runNumerals(QString("A" ISZERO("")) + difference + PTERM(I) + PTERM(K), &reductions), QString("I"));
+    QVERIFY(reductions < 1000);
+    QCOMPARE(runNumerals(subtract(add(million, seven), million) + PRINT(I), &reductions), QString(7, 'I'));
+    QVERIFY(reductions < 1000);
+}
+
+static QString runFixpoints(const QString& program, qint64* reductions = 0, int* recognized = 0, qint64 maxOutput = 0)
+{
+    QByteArray utf8 = program.toUtf8();
+    Parser parser(1);
+    Fixpoints fixpoints;
+    QList<CombinatorPtr> terms = fixpoints.recognize(parser.parse(utf8.constData(), utf8.size()));
+    QString output;
+    QTextStream stream(&output);
+    Hof hof(&stream);
+    HofLimits limits;
+    limits.maxOutput = maxOutput;
+    hof.context()->setLimits(limits);
+    hof.run(terms);
+    stream.flush();
+    if (reductions)
+        *reductions = hof.context()->reductions;
+    if (recognized)
+        *recognized = fixpoints.recognized();
+    return output;
+}
+
+void TestHof::testFixpoints()
+{
+    QString y = Lambda::fromLambda("\xce\xbb" "f.(\xce\xbbx.f (x x)) (\xce\xbbx.f (x x))");
+    QCOMPARE(y, QString("AASAASAASAKSKAKAASIIAASAASAKSKAKAASII"));
+
+    // every one loops printing I for as long as it is let
+    QStringList loops = QStringList() << Y("API") << Y1("API") << y + "API";
+    foreach (const QString& loop, loops) {
+        qint64 reductions = 0;
+        int recognized = 0;
+        QCOMPARE(runFixpoints(loop, &reductions, &recognized, 1000), QString(1000, 'I'));
+        QCOMPARE(recognized, 1);
+
+        QString output;
+        QTextStream stream(&output);
+        Hof hof(&stream);
+        HofLimits limits;
+        limits.maxOutput = 1000;
+        hof.context()->setLimits(limits);
+        QCOMPARE(hof.run(loop), HofContext::OutputExceeded);
+        QVERIFY(reductions < hof.context()->reductions);
+    }
+
+    // recursion in a translated program runs the same
+    QFile file(HOF_SOURCE_DIR "/../examples/decrement.lambda");
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QString decrement = Lambda::fromLambda(QString::fromUtf8(file.readAll())) + FOUR;
+    int recognized = 0;
+    QCOMPARE(runFixpoints(decrement, 0, &recognized), runToString(decrement));
+    QCOMPARE(recognized, 1);
+
+    // a program starting with Y spread over its terms has them folded into one
+    QByteArray utf8 = QByteArray(Y("")) + "x";
+    Parser parser(1);
+    Fixpoints fixpoints;
+    QList<CombinatorPtr> terms = fixpoints.recognize(parser.parse(utf8.constData(), utf8.size()));
+    QCOMPARE(terms.count(), 2);
+    QCOMPARE(int(terms.first()->type()), int(Combinator::fix_));
+    QCOMPARE(terms.first()->toString(), QString("AASAKAASIIAASAASAKSKAKAASII"));
+}
+
+static QString runLiterals(const QString& program, qint64* reductions = 0)
+{
+    QByteArray utf8 = program.toUtf8();
+    Parser parser(1);
+    parser.setLiterals(true);
+    QString output;
+    QTextStream stream(&output);
+    Hof hof(&stream);
+    hof.run(parser.parse(utf8.constData(), utf8.size()));
+    stream.flush();
+    if (reductions)
+        *reductions = hof.context()->reductions;
+    return output;
+}
+
+void TestHof::testLiterals()
+{
+    QByteArray syntax("#12;\"a\\\"b\"#+;#x\"");
+    Lexer::Tokens tokens = Lexer::tokenize(syntax.constData(), syntax.size(), Lexer::LiteralSyntax);
+    QCOMPARE(tokens.count(), 6);
+    Lexer lexer(syntax.constData(), syntax.size(), Lexer::LiteralSyntax);
+    QCOMPARE(int(tokens.at(0).type), int(Lexer::Integer));
+    QCOMPARE(lexer.integer(tokens.at(0)), qint64(12));
+    QCOMPARE(int(tokens.at(1).type), int(Lexer::String));
+    QCOMPARE(lexer.bytes(tokens.at(1)), QByteArray("a\"b"));
+    QCOMPARE(int(tokens.at(2).type), int(Lexer::Primitive));
+    // without a closing ; or quote they are plain symbols
+    QCOMPARE(int(tokens.at(3).type), int(Lexer::Symbol));
+    QCOMPARE(int(tokens.at(5).type), int(Lexer::Symbol));
+    QCOMPARE(Lexer::tokenize(syntax.constData(), syntax.size()).count(), syntax.size());
+
+    // S (K P) f x prints f x once forced, a byte string as its bytes
+    QString print = "AAASAKP";
+    QCOMPARE(runLiterals(print + "A#+;\"foo\"\" bar\""), QString("foo bar"));
+    QByteArray escaped("\"a\\\\b\\\"\"");
+    QCOMPARE(runLiterals("P" + escaped), QString("a\\b\""));
+    Parser parser(1);
+    parser.setLiterals(true);
+    QCOMPARE(parser.parse(escaped.constData(), escaped.size()).at(0)->toString(), QString(escaped));
+
+    // bytes that are not UTF-8 reach the output device as they are
+    QByteArray raw("P\"a\xff\xc3\"");
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    {
+        QTextStream rawStream(&buffer);
+        Hof hof(&rawStream);
+        QCOMPARE(hof.run(parser.parse(raw.constData(), raw.size())), HofContext::Finished);
+    }
+    QCOMPARE(buffer.data(), QByteArray("a\xff\xc3"));
+    QCOMPARE(runLiterals(print + "A#*;#6;#7;"), QString("#42;"));
+    QCOMPARE(runLiterals(print + "A#-;#2;#5;"), QString("#0;"));
+    QCOMPARE(runLiterals(print + "A#%;#17;#5;"), QString("#2;"));
+    QCOMPARE(runLiterals("AA#<;#2;#3;" PTERM(I) PTERM(K)), QString("I"));
+    QCOMPARE(runLiterals("AA#=;\"a\"\"b\"" PTERM(I) PTERM(K)), QString("K"));
+
+    // integers are Church numerals, I and KI are numbers too
+    QCOMPARE(runLiterals("AA#+;#2;" THREE PRINT(I)), QString(5, 'I'));
+    QCOMPARE(runLiterals(print + "A#+;" ZERO "#3;"), QString("#3;"));
+
+    // no result leaves the application as it is
+    QCOMPARE(runLiterals(print + "A#/;#1;#0;"), QString("#/;#1;#0;"));
+    QCOMPARE(runLiterals(print + "A#+;\"a\"#5;"), QString("#+;\"a\"#5;"));
+    // nor does a free symbol or P, which is not run to count it
+    QCOMPARE(runLiterals(print + "A#+;a#2;"), QString("#+;a#2;"));
+    QCOMPARE(runLiterals(print + "A#+;AAKPI#2;"), QString("#+;P#2;"));
+    QCOMPARE(runLiterals(print + "A#*;#4294967296;#4294967296;"), QString("#*;#4294967296;#4294967296;"));
+
+    // a product a Church encoding would take millions of reductions for
+    qint64 reductions = 0;
+    QCOMPARE(runLiterals(print + "A#*;#1000000;#1000000;", &reductions), QString("#1000000000000;"));
+    QVERIFY(reductions < 10);
+}
+
+// multiplies, counts its calls, chooses between two unevaluated terms and
+// upper cases bytes
+static const char s_foreignLibrary[] =
+    "#include \"hofffi.h\"\n"
+    "#include <ctype.h>\n"
+    "static int multiply(const hof_ffi_value* a, hof_ffi_value* r, void* u)\n"
+    "{ (void)u; r->type = HOF_FFI_INTEGER; r->integer = a[0].integer * a[1].integer; return 0; }\n"
+    "static int calls(const hof_ffi_value* a, hof_ffi_value* r, void* u)\n"
+    "{ static long long n; (void)a; (void)u; r->type = HOF_FFI_INTEGER; r->integer = ++n; return 0; }\n"
+    "static int choose(const hof_ffi_value* a, hof_ffi_value* r, void* u)\n"
+    "{ (void)u; r->type = HOF_FFI_TERM; r->integer = a[0].integer ? 1 : 2; return 0; }\n"
+    "static int upper(const hof_ffi_value* a, hof_ffi_value* r, void* u)\n"
+    "{\n"
+    "    static char buffer[256];\n"
+    "    size_t i;\n"
+    "    (void)u;\n"
+    "    if (a[0].length > sizeof(buffer)) return 1;\n"
+    "    for (i = 0; i < a[0].length; ++i) buffer[i] = (char)toupper((unsigned char)a[0].bytes[i]);\n"
+    "    r->type = HOF_FFI_BYTES; r->bytes = buffer; r->length = a[0].length;\n"
+    "    return 0;\n"
+    "}\n"
+    "static const hof_ffi_definition definitions[] = {\n"
+    "    { \"m\", \"ii\", multiply, 0 },\n"
+    "    { \"n\", \"ii\", calls, 0 },\n"
+    "    { \"c\", \"itt\", choose, 0 },\n"
+    "    { \"u\", \"b\", upper, 0 },\n"
+    "    { \"\xce\xbc\", \"ii\", multiply, 0 },\n"
+    "    { 0, 0, 0, 0 }\n"
+    "};\n"
+    "HOF_FFI_EXPORT const hof_ffi_definition* hof_ffi_register(int version)\n"
+    "{ return version == HOF_FFI_VERSION ? definitions : 0; }\n";
+
+void TestHof::testForeignFunctions()
+{
+    QTemporaryDir dir;
+    QFile source(dir.filePath("foreign.c"));
+    QVERIFY(source.open(QIODevice::WriteOnly));
+    source.write(s_foreignLibrary);
+    source.close();
+
+    QString library = dir.filePath("libforeign.so");
+    QProcess compiler;
+    compiler.start("cc", QStringList() << "-shared" << "-fPIC" << "-I" HOF_SOURCE_DIR
+                                       << "-o" << library << source.fileName());
+    if (!compiler.waitForStarted())
+        QSKIP("no C compiler to build the library with");
+    QVERIFY(compiler.waitForFinished(30000));
+    QCOMPARE(compiler.exitCode(), 0);
+
+    ForeignFunctions functions;
+    QString error;
+    QVERIFY(!functions.load(dir.filePath("missing.so"), &error));
+    QVERIFY(!error.isEmpty());
+    QVERIFY2(functions.load(library, &error), qPrintable(error));
+    // names outside Latin-1 are as good as any other
+    QCOMPARE(functions.names(), QStringList() << "c:itt" << "m:ii" << "n:ii" << "u:b" << QString::fromUtf8("\xce\xbc:ii"));
+
+    // in process, with byte strings from literals
+    QByteArray program("AAASAKPu\"hof\" AAASAKPAmAu\"x\"#2;");
+    Parser parser(1);
+    parser.setLiterals(true);
+    QList<CombinatorPtr> terms = functions.bind(parser.parse(program.constData(), program.size()));
+    QCOMPARE(functions.bound(), 3);
+    QString output;
+    QTextStream stream(&output);
+    Hof hof(&stream);
+    QCOMPARE(hof.run(terms), HofContext::Finished);
+    stream.flush();
+    // a string is no integer so the product is left as written
+    QCOMPARE(output, QString("HOFm\"X\"#2;"));
+
+    // a native function need not be pure, so the same call is made again
+    // rather than served from the cache or a forced thunk
+    program = "AAASAKPAn#3;#4; AAASAKPAn#3;#4;";
+    terms = functions.bind(parser.parse(program.constData(), program.size()));
+    QString counted;
+    QTextStream countedStream(&counted);
+    Hof counting(&countedStream);
+    QCOMPARE(counting.run(terms), HofContext::Finished);
+    countedStream.flush();
+    QCOMPARE(counted, QString("#1;#2;"));
+
+    // from a lambda program, where omega is never forced as c's argument is lazy
+    QFile lambda(dir.filePath("foreign.lambda"));
+    QVERIFY(lambda.open(QIODevice::WriteOnly));
+    lambda.write("zero = \xce\xbb" "f.\xce\xbbx.x\n"
+                 "three = \xce\xbb" "f.\xce\xbbx.f (f (f x))\n"
+                 "four = \xce\xbb" "f.\xce\xbbx.f (f (f (f x)))\n"
+                 "omega = (\xce\xbbx.x x) (\xce\xbbx.x x)\n"
+                 "((((c {zero}) ({omega})) ((m {three}) {four})) ({API})) (I)\n");
+    lambda.close();
+
+    QDir bin(QCoreApplication::applicationDirPath());
+    QProcess hofProcess;
+    hofProcess.setProgram(bin.path() + QDir::separator() + "hof");
+    hofProcess.setArguments(QStringList() << "--ffi" << library << "--file" << lambda.fileName());
+    hofProcess.start();
+    QVERIFY(hofProcess.waitForFinished(5000));
+    QCOMPARE(hofProcess.exitCode(), 0);
+    QCOMPARE(QString(hofProcess.readAllStandardOutput().trimmed()), QString(12, 'I'));
+}
+
+void TestHof::testCollector()
+{
+    // every distinct application 5^4 takes is cached and never asked for again
+    QString program = QString("A" FOUR FIVE) + PRINT(I);
+    QString expected = runToString(program);
+    QCOMPARE(expected, QString(625, 'I'));
+
+    int uncollected = 0;
+    {
+        QString output;
+        QTextStream stream(&output);
+        Hof hof(&stream);
+        hof.run(program);
+        uncollected = hof.context()->cache()->stats().size;
+    }
+
+    // the singletons are all made by now, whatever a run leaves alive is a leak
+    qint64 baseline = Combinator::liveCount();
+    {
+        QString output;
+        QTextStream stream(&output);
+        Hof hof(&stream);
+        hof.context()->setCollectorBudget(500);
+        hof.run(program);
+        stream.flush();
+        QCOMPARE(output, expected);
+
+        Collector::Stats stats = hof.context()->collector()->stats();
+        QVERIFY(stats.collections > 0);
+        QVERIFY(stats.swept > 0);
+        QVERIFY(stats.peak >= stats.live);
+        QVERIFY(hof.context()->cache()->stats().size < uncollected);
+    }
+    QCOMPARE(Combinator::liveCount(), baseline);
+}
+
+// resident bytes of another process, 0 where /proc is not there
+static qint64 residentMemory(qint64 pid)
+{
+#if defined(Q_OS_UNIX)
+    QFile statm(QString("/proc/%1/statm").arg(pid));
+    if (!statm.open(QIODevice::ReadOnly))
+        return 0;
+    QList<QByteArray> fields = statm.readAll().split(' ');
+    return fields.count() > 1 ? fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE) : 0;
+#else
+    Q_UNUSED(pid);
+    return 0;
+#endif
+}
+
+// runs a program printing an I per iteration and samples its memory twenty
+// times along the way, the curve is left in hof-soak-name.csv in the
+// temporary directory
+static QList<qint64> soak(const QString& name, const QString& program, qint64 iterations)
+{
+    QDir bin(QCoreApplication::applicationDirPath());
+    QProcess hof;
+    hof.setProgram(bin.path() + QDir::separator() + "hof");
+    hof.setArguments(QStringList() << "--program" << program);
+    hof.start();
+
+    QFile curve(QDir::temp().filePath(QString("hof-soak-%1.csv").arg(name)));
+    curve.open(QIODevice::WriteOnly | QIODevice::Truncate);
+    QTextStream csv(&curve);
+    csv << "iterations,rss\n";
+
+    QList<qint64> samples;
+    qint64 interval = qMax(qint64(1), iterations / 20);
+    qint64 totalRead = 0;
+    while (totalRead < iterations && hof.waitForReadyRead(5000)) {
+        QByteArray output = hof.readAll();
+        for (int i = 0; i < output.size() && totalRead < iterations; ++i) {
+            if (output.at(i) != 'I')
+                continue;
+            if (++totalRead % interval == 0) {
+                qint64 rss = residentMemory(hof.processId());
+                samples.append(rss);
+                csv << totalRead << "," << rss << "\n";
+            }
+        }
+    }
+
+    hof.kill();
+    hof.waitForFinished();
+    return samples;
+}
+
+void TestHof::testConstantSpace()
+{
+    if (!QFile::exists("/proc/self/statm"))
+        QSKIP("no /proc to read the memory of the interpreter from");
+
+    // a million or more for a real soak
+    qint64 iterations = qgetenv("HOF_SOAK_ITERATIONS").toLongLong();
+    if (iterations <= 0)
+        iterations = 20000;
+
+    QMap<QString, QString> programs;
+    programs.insert("y", Y("API"));
+    // the condition applies the state so every new one is forced and printed
+    programs.insert("while", WHILE("AASIAKK", P, I));
+
+    QMapIterator<QString, QString> it(programs);
+    while (it.hasNext()) {
+        it.next();
+        QList<qint64> samples = soak(it.key(), it.value(), iterations);
+        QCOMPARE(samples.count(), 20);
+
+        // once warmed up memory stays flat, give or take the cache's budget
+        qint64 warm = samples.at(samples.count() / 4);
+        qint64 peak = 0;
+        for (int i = samples.count() / 4; i < samples.count(); ++i)
+            peak = qMax(peak, samples.at(i));
+        qDebug() << it.key() << "iterations" << iterations << "rss" << warm << "peak" << peak;
+        QVERIFY2(peak <= warm + warm / 4 + 8 * 1024 * 1024, qPrintable(it.key()));
+    }
+}
+
+void TestHof::testPrinterBenchmark()
+{
+    // a balanced application of 2^20 leaves, a million applications
+    QVector<CombinatorPtr> level(1 << 20, i());
+    while (level.count() > 1) {
+        QVector<CombinatorPtr> next;
+        next.reserve(level.count() / 2);
+        for (int n = 0; n < level.count(); n += 2)
+            next.append(application(level.at(n), level.at(n + 1)));
+        level = next;
+    }
+    CombinatorPtr term = level.first();
+
+    QElapsedTimer timer;
+    timer.start();
+    QString string = term->toString();
+    qint64 stringNsecs = timer.nsecsElapsed();
+    QCOMPARE(string.length(), (1 << 21) - 1);
+    QVERIFY(string.startsWith("AAA"));
+    QVERIFY(string.endsWith("II"));
+
+    QString streamed;
+    QTextStream stream(&streamed);
+    timer.restart();
+    QCOMPARE(term->print(&stream), string.length());
+    stream.flush();
+    qint64 streamNsecs = timer.nsecsElapsed();
+    QCOMPARE(streamed, string);
+
+    // keys for the cache are printed into one string as well
+    QCOMPARE(term->toStringApply(i()), string + I);
+    QCOMPARE(s()->toStringApply(k(), Bash), GREEN(Bash) + S + RED(Bash) + K + RESET(Bash));
+
+    // the times depend on the machine and its load, so they are reported
+    // and only the output is checked
+    qDebug() << "nodes" << string.length()
+             << "string" << stringNsecs / 1000000.0 << "ms," << string.length() * 1000.0 / qMax(qint64(1), stringNsecs) << "MB/s"
+             << "stream" << streamNsecs / 1000000.0 << "ms," << string.length() * 1000.0 / qMax(qint64(1), streamNsecs) << "MB/s";
+}
+
+void TestHof::testCaptureSharing()
+{
+    HofContext context;
+    CombinatorPtr first = eval(&context, s(), i());
+    CombinatorPtr second = eval(&context, s(), i());
+    QCOMPARE(int(first->type()), int(Combinator::capture_));
+    QCOMPARE(first.data(), second.data());
+    QCOMPARE(context.cache()->stats().hits, qint64(1));
+
+    // extending the shared capture leaves it as it was
+    CombinatorPtr extended = eval(&context, first, k());
+    QCOMPARE(extended->toString(), QString("SIK"));
+    QCOMPARE(first->toString(), QString("SI"));
+    QCOMPARE(static_cast<Capture*>(first.data())->args.count(), 1);
+
+    // a random choice is never remembered
+    CombinatorPtr choice = eval(&context, r(), i());
+    EvaluationCache::Stats before = context.cache()->stats();
+    eval(&context, choice, k());
+    QCOMPARE(context.cache()->stats().inserts, before.inserts);
+
+    // curried combinators are partially applied to the same arguments over
+    // and over, so caching the captures they make raises the hit rate
+    qreal rates[2];
+    for (int cachesCaptures = 0; cachesCaptures < 2; ++cachesCaptures) {
+        QString output;
+        QTextStream stream(&output);
+        Hof hof(&stream);
+        hof.context()->cache()->setCachesCaptures(cachesCaptures);
+        QCOMPARE(hof.run(QString(DEC(FIVE)) + PRINT(I)), HofContext::Finished);
+        stream.flush();
+        QCOMPARE(output, QString("IIII"));
+        EvaluationCache::Stats stats = hof.context()->cache()->stats();
+        qDebug() << "captures cached" << bool(cachesCaptures) << "hits" << stats.hits << "misses" << stats.misses << "rate" << stats.hitRate();
+        rates[cachesCaptures] = stats.hitRate();
+    }
+    QVERIFY(rates[1] > rates[0]);
+}
+
+void TestHof::testForcedThunks()
+{
+    // a thunk prints as it was written before and after it is forced
+    HofContext context;
+    CombinatorPtr term = thunk(eval(&context, k(), i()), s());
+    QString before = term->toString();
+    QCOMPARE(force(&context, term)->toString(), QString("I"));
+    QVERIFY(isForced(term));
+    QCOMPARE(term->toString(), before);
+
+    // only a private cache lets thunks remember their values, the output
+    // is the same either way
+    QStringList programs = QStringList()
+        << QString(DEC(FIVE)) + PRINT(I)
+        << QString("A" FOUR FIVE) + PRINT(I)
+        << QString("AASAKPAASIIxAKI")
+        // prints a capture holding a thunk
+        << QString("AAASAKPAASAKKIx");
+    foreach (const QString& program, programs) {
+        QString expected = runToString(program);
+
+        EvaluationCache shared(EvaluationCache::Concurrent);
+        QString output;
+        QTextStream stream(&output);
+        Hof hof(&stream);
+        hof.context()->setCache(&shared);
+        hof.run(program);
+        stream.flush();
+        QCOMPARE(output, expected);
+    }
+}
@@ -19,6 +19,35 @@ private slots:
     void testTranslateSki();
     void testTranslateLambda();
     void testExamples();
+    void testEmbeddedEngines();
+    void testBatchBenchmark();
+    void testSharedCacheScaling();
+    void testCachedEffects();
+    void testParallelReduction();
+    void testParallelDepthLimit();
+    void testMonteCarlo();
+    void testServer();
+    void testServerTimeSlicing();
+    void testTimeSlicing();
+    void testResourceLimits();
+    void testCApi();
+    void testLexerBenchmark();
+    void testParallelParser();
+    void testStaticHof();
+    void testOptimizer();
+    void testPartialEvaluation();
+    void testSharing();
+    void testLambdaMachine();
+    void testInteractionNet();
+    void testNumerals();
+    void testFixpoints();
+    void testLiterals();
+    void testForeignFunctions();
+    void testCollector();
+    void testConstantSpace();
+    void testForcedThunks();
+    void testPrinterBenchmark();
+    void testCaptureSharing();
 };
 
 #endif // testhof_h
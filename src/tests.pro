@@ -6,9 +6,16 @@ TARGET = hoftests
 DESTDIR = $$OUTPUT_DIR/bin
 QT += testlib
 
+# the foreign function test builds a library against hofffi.h
+DEFINES += HOF_SOURCE_DIR=\\\"$$PWD\\\"
+
 DEPENDPATH += .
 INCLUDEPATH += .
 
+# the C API is tested through the library the way embedders use it
+LIBS += -L$$OUTPUT_DIR/lib -lhof
+!hof_static:QMAKE_RPATHDIR += $$OUTPUT_DIR/lib
+
 HEADERS += testhof.h
 
 SOURCES += main_tests.cpp \
@@ -0,0 +1,138 @@
+#include "threadpool.h"
+
+struct WorkerIdentity {
+    const WorkStealingPool* pool;
+    int index;
+};
+
+static thread_local WorkerIdentity t_worker = { 0, -1 };
+
+class WorkStealingWorker : public QThread {
+public:
+    WorkStealingWorker(WorkStealingPool* pool, int index)
+        : m_pool(pool)
+        , m_index(index) { }
+
+    QMutex mutex;
+    QList<QRunnable*> queue;
+
+protected:
+    void run()
+    {
+        t_worker.pool = m_pool;
+        t_worker.index = m_index;
+        m_pool->run(m_index);
+    }
+
+private:
+    WorkStealingPool* m_pool;
+    int m_index;
+};
+
+WorkStealingPool::WorkStealingPool(int threadCount)
+    : m_nextQueue(0)
+    , m_queued(0)
+    , m_pending(0)
+    , m_steals(0)
+    , m_quit(false)
+{
+    threadCount = qMax(1, threadCount);
+    for (int i = 0; i < threadCount; ++i)
+        m_workers.append(new WorkStealingWorker(this, i));
+    foreach (WorkStealingWorker* worker, m_workers)
+        worker->start();
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    waitForDone();
+
+    m_idleMutex.lock();
+    m_quit = true;
+    m_wake.wakeAll();
+    m_idleMutex.unlock();
+
+    foreach (WorkStealingWorker* worker, m_workers)
+        worker->wait();
+    qDeleteAll(m_workers);
+}
+
+int WorkStealingPool::currentWorker() const
+{
+    return t_worker.pool == this ? t_worker.index : -1;
+}
+
+void WorkStealingPool::start(QRunnable* runnable)
+{
+    Q_ASSERT(runnable);
+    m_pending.ref();
+
+    int index = currentWorker();
+    if (index == -1)
+        index = quint32(m_nextQueue.fetchAndAddRelaxed(1)) % m_workers.count();
+
+    WorkStealingWorker* worker = m_workers.at(index);
+    worker->mutex.lock();
+    worker->queue.append(runnable);
+    worker->mutex.unlock();
+
+    m_idleMutex.lock();
+    m_queued.ref();
+    m_wake.wakeOne();
+    m_idleMutex.unlock();
+}
+
+void WorkStealingPool::waitForDone()
+{
+    QMutexLocker locker(&m_idleMutex);
+    while (m_pending.load() > 0)
+        m_done.wait(&m_idleMutex);
+}
+
+QRunnable* WorkStealingPool::take(int index)
+{
+    // newest work from our own queue first...
+    WorkStealingWorker* self = m_workers.at(index);
+    {
+        QMutexLocker locker(&self->mutex);
+        if (!self->queue.isEmpty())
+            return self->queue.takeLast();
+    }
+
+    // ...then the oldest work from everybody else
+    for (int i = 1; i < m_workers.count(); ++i) {
+        WorkStealingWorker* victim = m_workers.at((index + i) % m_workers.count());
+        QMutexLocker locker(&victim->mutex);
+        if (!victim->queue.isEmpty()) {
+            m_steals.fetchAndAddRelaxed(1);
+            return victim->queue.takeFirst();
+        }
+    }
+
+    return 0;
+}
+
+void WorkStealingPool::run(int index)
+{
+    forever {
+        QRunnable* runnable = take(index);
+        if (runnable) {
+            m_queued.deref();
+            runnable->run();
+            if (runnable->autoDelete())
+                delete runnable;
+
+            if (!m_pending.deref()) {
+                QMutexLocker locker(&m_idleMutex);
+                m_done.wakeAll();
+            }
+            continue;
+        }
+
+        QMutexLocker locker(&m_idleMutex);
+        if (m_quit)
+            return;
+        if (m_queued.load() <= 0)
+            m_wake.wait(&m_idleMutex);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef threadpool_h
+#define threadpool_h
+
+#include <QtCore>
+
+class WorkStealingWorker;
+
+/**
+ * A fixed size pool of threads, each owning its own double ended queue of
+ * runnables.  Work submitted from a worker thread is pushed onto that
+ * worker's own queue and popped LIFO so related work stays on a warm core,
+ * while idle workers steal the oldest work FIFO from the other queues.
+ *
+ * Runnables are deleted after they run if autoDelete() is set, the same
+ * as with QThreadPool.
+ */
+class WorkStealingPool {
+public:
+    WorkStealingPool(int threadCount = QThread::idealThreadCount());
+    ~WorkStealingPool();
+
+    int threadCount() const { return m_workers.count(); }
+
+    void start(QRunnable* runnable);
+    void waitForDone();
+
+    // index of the calling worker thread in this pool or -1
+    int currentWorker() const;
+
+    qint64 steals() const { return m_steals.load(); }
+
+private:
+    friend class WorkStealingWorker;
+    Q_DISABLE_COPY(WorkStealingPool)
+
+    QRunnable* take(int worker);
+    void run(int worker);
+
+    QList<WorkStealingWorker*> m_workers;
+    QAtomicInt m_nextQueue;
+    QAtomicInt m_queued;
+    QAtomicInt m_pending;
+    QAtomicInteger<qint64> m_steals;
+    QMutex m_idleMutex;
+    QWaitCondition m_wake;
+    QWaitCondition m_done;
+    bool m_quit;
+};
+
+#endif // threadpool_h
@@ -106,7 +106,7 @@ void Verbose::generateReturnString(const CombinatorPtr& r)
         return;
 
     QString program = "return type: " + r->typeToString() + "";
-    Verbose::instance()->generateProgramString(program);
+    generateProgramString(program);
 
     *m_stream << "  "
         << prefix()
@@ -122,7 +122,7 @@ void Verbose::generateInputString(const CombinatorPtr& input)
         return;
 
     // Whatever is left in the evaluation list is input
-    Verbose::instance()->generateProgramString("input");
+    generateProgramString("input");
     *m_stream << "  ";
     *m_stream << input->toString();
     *m_stream << "\n";
@@ -7,13 +7,7 @@
 
 class Verbose {
 public:
-    static Verbose* instance()
-    {
-        static Verbose* s_instance = 0;
-        if (!s_instance)
-            s_instance = new Verbose;
-        return s_instance;
-    }
+    Verbose();
 
     void print()
     {
@@ -67,7 +61,6 @@ public:
     void generateReplacementString(const CombinatorPtr& term1, const CombinatorPtr& term2);
 
 private:
-    Verbose();
     QString m_program;
     QStringList m_prefix;
     QStringList m_postfix;